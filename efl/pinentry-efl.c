@@ -46,6 +46,8 @@
 #include "getopt.h"
 #endif /* HAVE_GETOPT_H */
 
+#include <unistd.h>
+
 #include "pinentry.h"
 
 #ifdef FALLBACK_CURSES
@@ -543,6 +545,7 @@ create_window (void)
 
   elm_win_resize_object_add(win,obj);
   evas_object_show(win);
+  pinentry_timing ("dialog");
 
   if(entry)
     elm_object_focus_set (entry, EINA_TRUE);
@@ -569,6 +572,7 @@ efl_cmd_handler (pinentry_t pe)
   if (pe->display)
     ecore_x_init (pe->display);
   elm_init (pargc, pargv);
+  pinentry_timing ("toolkit");
   create_window ();
   ecore_main_loop_begin ();
 
@@ -593,9 +597,54 @@ efl_cmd_handler (pinentry_t pe)
     return (confirm_value == CONFIRM_OK) ? 1 : 0;
 }
 
+#ifdef ENABLE_MAINLOOP_SERVER
+/* Process the Assuan input.  This also runs from the main loop of
+   efl_cmd_handler.  */
+static Eina_Bool
+assuan_input_cb (void *data EINA_UNUSED,
+                 Ecore_Fd_Handler *fd_handler EINA_UNUSED)
+{
+  if (!pinentry_server_process ())
+    return ECORE_CALLBACK_RENEW;
+
+  /* The connection has ended.  Close an open window, which cancels
+     it, and leave the loop of run_server.  */
+  if (pinentry)
+    quit ();
+  else
+    ecore_main_loop_quit ();
+  return ECORE_CALLBACK_CANCEL;
+}
+
+/* Run the Assuan server from the Ecore main loop so that an open
+   window is closed when the connection ends.  */
+static int
+run_server (void)
+{
+  if (!ecore_init ())
+    return -1;
+  if (pinentry_server_start (STDIN_FILENO, STDOUT_FILENO))
+    {
+      ecore_shutdown ();
+      return -1;
+    }
+
+  ecore_main_fd_handler_add (pinentry_server_fd (),
+                             ECORE_FD_READ | ECORE_FD_ERROR,
+                             assuan_input_cb, NULL, NULL, NULL);
+  ecore_main_loop_begin ();
+
+  pinentry_server_stop ();
+  ecore_shutdown ();
+  return 0;
+}
+#endif /*ENABLE_MAINLOOP_SERVER*/
+
 int
 main (int argc, char *argv[])
 {
+  int rc;
+
   pinentry_init (PGMNAME);
 
 #ifdef FALLBACK_CURSES
@@ -616,7 +665,18 @@ main (int argc, char *argv[])
 #endif
 
   pinentry_parse_opts (argc, argv);
-  if (pinentry_loop ())
+
+#ifdef ENABLE_MAINLOOP_SERVER
+# ifdef FALLBACK_CURSES
+  if (pinentry_cmd_handler == curses_cmd_handler)
+    rc = pinentry_loop ();
+  else
+# endif
+    rc = run_server ();
+#else
+  rc = pinentry_loop ();
+#endif
+  if (rc)
     return 1;
 
   return 0;
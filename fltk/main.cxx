@@ -35,6 +35,7 @@
 #include <assert.h>
 
 #include "memory.h"
+#include "secmem++.h"
 #include <memory>
 
 #include <pinentry.h>
@@ -83,13 +84,13 @@ class cancel_exception
 
 };
 
-static int get_quality(const char *passwd, void *ptr)
+static int get_quality(const char *passwd, int len, void *ptr)
 {
-	if (NULL == passwd || 0 == *passwd)
+	if (NULL == passwd || 0 == len)
 		return 0;
 
 	pinentry_t* pe = reinterpret_cast<pinentry_t*>(ptr);
-	return pinentry_inq_quality(*pe, passwd, strlen(passwd));
+	return pinentry_inq_quality(*pe, passwd, len);
 }
 
 bool is_short(const char *str)
@@ -170,7 +171,7 @@ static int fltk_cmd_handler(pinentry_t pe)
 			if (NULL == window->passwd())
 				throw cancel_exception();
 
-			const std::string password = window->passwd();
+			const secmem::string password(window->passwd());
 			window.reset();
 
 			if (pe->repeat_passphrase)
@@ -287,6 +288,37 @@ static int fltk_cmd_handler(pinentry_t pe)
 
 pinentry_cmd_handler_t pinentry_cmd_handler = fltk_cmd_handler;
 
+#ifdef ENABLE_MAINLOOP_SERVER
+static bool server_done = false;
+
+// also runs from Fl::run of an open dialog
+static void assuan_input_cb(int fd, void*)
+{
+	if (0 == pinentry_server_process())
+		return;
+
+	Fl::remove_fd(fd);
+	server_done = true;
+
+	// hiding the windows ends Fl::run and fl_choice as on a cancel
+	while (Fl::first_window())
+		Fl::first_window()->hide();
+}
+
+static int run_server()
+{
+	if (pinentry_server_start(STDIN_FILENO, STDOUT_FILENO))
+		return -1;
+
+	Fl::add_fd(pinentry_server_fd(), FL_READ, assuan_input_cb);
+	while (!server_done)
+		Fl::wait();
+
+	pinentry_server_stop();
+	return 0;
+}
+#endif // ENABLE_MAINLOOP_SERVER
+
 int main(int argc, char *argv[])
 {
 	application = *argv;
@@ -322,7 +354,17 @@ int main(int argc, char *argv[])
 			}
 		}
 	}
+	pinentry_timing("toolkit");
 
 	pinentry_parse_opts(argc, argv);
+
+#ifdef ENABLE_MAINLOOP_SERVER
+# ifdef FALLBACK_CURSES
+	if (curses_cmd_handler == pinentry_cmd_handler)
+		return pinentry_loop() ?EXIT_FAILURE:EXIT_SUCCESS;
+# endif
+	return run_server() ?EXIT_FAILURE:EXIT_SUCCESS;
+#else
 	return pinentry_loop() ?EXIT_FAILURE:EXIT_SUCCESS;
+#endif
 }
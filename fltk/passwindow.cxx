@@ -27,7 +27,8 @@
 
 #include <FL/Fl_Window.H>
 #include <FL/Fl_Box.H>
-#include <FL/Fl_Input.H>
+
+#include "secretinput.h"
 
 const char *PassWindow::DESCRIPTION  = "Please enter the passphrase:";
 
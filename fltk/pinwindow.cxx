@@ -26,18 +26,18 @@
 #include <FL/Fl.H>
 #include <FL/Fl_Window.H>
 #include <FL/Fl_Box.H>
-#include <FL/Fl_Input.H>
 #include <FL/Fl_Button.H>
-#include <FL/Fl_Secret_Input.H>
 #include <FL/Fl_Return_Button.H>
 #include <FL/Fl_Pixmap.H>
 
 #include "memory.h"
+#include "pinentry.h"
 
 #include "encrypt.xpm"
 #include "icon.xpm"
 
 #include "pinwindow.h"
+#include "secretinput.h"
 
 const char *PinWindow::TITLE 		= "Password";
 const char *PinWindow::BUTTON_OK 	= "OK";
@@ -123,6 +123,7 @@ void PinWindow::showModal()
 	if (NULL != window_)
 	{
 		window_->show();
+		pinentry_timing("dialog");
 		Fl::run();
 	}
 	Fl::check();
@@ -133,6 +134,7 @@ void PinWindow::showModal(const int argc, char* argv[])
 	if (NULL != window_)
 	{
 		window_->show(argc, argv);
+		pinentry_timing("dialog");
 		Fl::run();
 	}
 	Fl::check();
@@ -152,7 +154,7 @@ int PinWindow::init(const int cx, const int cy)
     message_ = new Fl_Box(79, 5, cx-99, 44, PROMPT);
 	message_->align(Fl_Align(FL_ALIGN_LEFT_TOP | FL_ALIGN_WRAP | FL_ALIGN_INSIDE)); // left
 
-	input_ = new Fl_Secret_Input(79, 59, cx-99, 25);
+	input_ = new SecretInput(79, 59, cx-99, 25);
 	input_->labeltype(FL_NO_LABEL);
 
 
@@ -216,8 +218,8 @@ void PinWindow::ok_cb(Fl_Widget *button, void *val)
 
 	self->release();
 
-	const char *passwd = self->input_->value();
-	size_t len = strlen(passwd)+1;
+	const char *passwd = self->input_->secret();
+	size_t len = self->input_->secret_size()+1;
 	self->passwd_ = reinterpret_cast<char*>(secmem_malloc(len));
 	if (NULL != self->passwd_)
 		memcpy(self->passwd_, passwd, len);
@@ -228,17 +230,7 @@ void PinWindow::ok_cb(Fl_Widget *button, void *val)
 
 void PinWindow::wipe()
 {
-	int len = input_->size();
-	char* emul = new char[len+1];
-	for (int i=0; i<len; ++i)
-	{
-		emul[i] = 0x20 + rand()%(128-20); // [20..127]
-	}
-	emul[len] = 0;
-	input_->replace(0, len, emul, len);
-	delete[] emul;
-
-	input_->value(TITLE); // hide size too
+	input_->wipe();
 }
 
 PinWindow*  PinWindow::create()
@@ -30,7 +30,7 @@
 
 class Fl_Window;
 class Fl_Box;
-class Fl_Input;
+class SecretInput;
 class Fl_Button;
 class Fl_Widget;
 
@@ -53,7 +53,7 @@ protected:
 	Fl_Box		*icon_;
 
 	Fl_Box		*message_;
-	Fl_Input	*input_;
+	SecretInput	*input_;
 
 	Fl_Button	*ok_, *cancel_;
 
@@ -24,10 +24,10 @@
 
 #include <FL/Fl_Window.H>
 #include <FL/Fl_Box.H>
-#include <FL/Fl_Input.H>
 #include <FL/Fl_Progress.H>
 
 #include "qualitypasswindow.h"
+#include "secretinput.h"
 
 const char *QualityPassWindow::QUALITY = "Quality";
 
@@ -48,7 +48,8 @@ void QualityPassWindow::input_changed(Fl_Widget *input, void *val)
 
 	if (NULL != self->quality_ && NULL != self->get_quality_)
 	{
-		int result = self->get_quality_(self->input_->value(), self->get_quality_user_);
+		int result = self->get_quality_(self->input_->secret(), self->input_->secret_size(),
+									 self->get_quality_user_);
 		bool isErr = (result <= 0);
 		if (isErr)
 			result = -result;
@@ -34,7 +34,7 @@ protected:
 	static const char *QUALITY;
 
 public:
-	typedef int (*GetQualityFn)(const char *passwd, void *ptr);
+	typedef int (*GetQualityFn)(const char *passwd, int len, void *ptr);
 
 	static QualityPassWindow* create(GetQualityFn qualify, void* user);
 
@@ -0,0 +1,412 @@
+/*
+    secretinput.cxx - SecretInput is a fltk secret input field which keeps
+    the entered text in secure memory.
+
+    Copyright (C) 2026 g10 Code GmbH
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+    SPDX-License-Identifier: GPL-2.0+
+*/
+
+#include <FL/Fl.H>
+#include <FL/fl_ask.H>
+
+#include <string.h>
+
+#include "memory.h"
+#include "util.h"
+#undef wipe	// SecretInput::wipe
+
+#include "secretinput.h"
+
+static const int MIN_CAPACITY = 64;
+
+static inline bool is_lead(char c)
+{
+	return (c & 0xC0) != 0x80;
+}
+
+static int count_chars(const char *text, int len)
+{
+	int n = 0;
+	for (int i=0; i<len; ++i)
+		if (is_lead(text[i]))
+			++n;
+	return n;
+}
+
+SecretInput::SecretInput(int x, int y, int w, int h, const char *label)
+				: Fl_Secret_Input(x, y, w, h, label)
+				,buf_(NULL) ,size_(0) ,capacity_(0) ,chars_(0)
+				,mask_(NULL) ,mask_capacity_(0)
+				,undo_buf_(NULL) ,undo_size_(0) ,undo_capacity_(0)
+				,undo_at_(-1) ,undo_chars_(0)
+{
+}
+
+SecretInput::~SecretInput()
+{
+	secmem_free(buf_); // wipes the whole block
+	secmem_free(undo_buf_);
+	delete[] mask_;
+}
+
+void SecretInput::wipe()
+{
+	if (NULL != buf_)
+	{
+		fast_wipememory(buf_, size_);
+		buf_[0] = 0;
+	}
+	if (NULL != undo_buf_)
+		fast_wipememory(undo_buf_, undo_size_);
+	undo_size_ = 0;
+	undo_at_ = -1;
+	if (NULL != mask_)
+	{
+		mask_[chars_] = '*';
+		mask_[0] = 0;
+	}
+	size_ = chars_ = 0;
+	static_value(mask_, 0);
+}
+
+bool SecretInput::reserve(int bytes)
+{
+	if (bytes <= capacity_)
+		return true;
+
+	int capacity = capacity_ > MIN_CAPACITY ? capacity_ : MIN_CAPACITY;
+	while (capacity < bytes)
+		capacity *= 2;
+
+	// grows in place if the pool allows it, otherwise the old block
+	// is wiped on release
+	char *buf = reinterpret_cast<char*>(secmem_realloc(buf_, capacity));
+	if (NULL == buf)
+		return false;
+
+	buf_ = buf;
+	capacity_ = capacity;
+	return true;
+}
+
+bool SecretInput::reserve_undo(int bytes)
+{
+	if (bytes <= undo_capacity_)
+		return true;
+
+	int capacity = undo_capacity_ > MIN_CAPACITY ? undo_capacity_ : MIN_CAPACITY;
+	while (capacity < bytes)
+		capacity *= 2;
+
+	char *buf = reinterpret_cast<char*>(secmem_realloc(undo_buf_, capacity));
+	if (NULL == buf)
+		return false;
+
+	undo_buf_ = buf;
+	undo_capacity_ = capacity;
+	return true;
+}
+
+bool SecretInput::reserve_mask(int chars)
+{
+	if (chars <= mask_capacity_)
+		return true;
+
+	int capacity = mask_capacity_ > MIN_CAPACITY ? mask_capacity_ : MIN_CAPACITY;
+	while (capacity < chars)
+		capacity *= 2;
+
+	char *mask = new char[capacity];
+	memset(mask, '*', capacity);
+	// Fl_Input_ compares with its old value, so switch before freeing it
+	static_value(mask, size());
+	delete[] mask_;
+	mask_ = mask;
+	mask_capacity_ = capacity;
+	return true;
+}
+
+int SecretInput::char_to_byte(int pos) const
+{
+	int off = 0;
+	for (; off < size_; ++off)
+		if (is_lead(buf_[off]) && pos-- == 0)
+			break;
+	return off;
+}
+
+int SecretInput::byte_to_char(int off) const
+{
+	if (off <= 0)
+		return 0;
+	return count_chars(buf_, off < size_ ? off : size_);
+}
+
+void SecretInput::update_mask(int pos)
+{
+	mask_[chars_] = 0;
+	static_value(mask_, chars_);
+	position(pos);
+}
+
+// remember the bytes [begin, end) of the characters [from, to) which
+// are about to be replaced by added characters.  Like Fl_Input_, typing
+// and deleting in a row is merged into a single undo step.
+void SecretInput::record_undo(int from, int to, int begin, int end, int added)
+{
+	const int removed = end - begin;
+
+	if (undo_at_ >= 0 && 0 == removed && from == undo_at_ + undo_chars_)
+	{
+		undo_chars_ += added;
+		return;
+	}
+
+	if (undo_at_ >= 0 && 0 == added && 0 == undo_chars_
+		&& (to == undo_at_ || from == undo_at_))
+	{
+		if (!reserve_undo(undo_size_ + removed))
+		{
+			undo_at_ = -1;
+			return;
+		}
+		if (to == undo_at_)	// backspace
+		{
+			memmove(undo_buf_ + removed, undo_buf_, undo_size_);
+			memcpy(undo_buf_, buf_ + begin, removed);
+			undo_at_ = from;
+		}
+		else			// delete
+			memcpy(undo_buf_ + undo_size_, buf_ + begin, removed);
+		undo_size_ += removed;
+		return;
+	}
+
+	if (NULL != undo_buf_)
+		fast_wipememory(undo_buf_, undo_size_);
+	undo_size_ = 0;
+	if (!reserve_undo(removed))
+	{
+		undo_at_ = -1;
+		return;
+	}
+	if (removed > 0)
+		memcpy(undo_buf_, buf_ + begin, removed);
+	undo_size_ = removed;
+	undo_at_ = from;
+	undo_chars_ = added;
+}
+
+// swap the text of the last edit with the one it replaced, so that a
+// second undo redoes the edit
+int SecretInput::undo()
+{
+	if (undo_at_ < 0)
+		return 1;
+
+	const int from = undo_at_;
+	const int to = undo_at_ + undo_chars_;
+	const int begin = char_to_byte(from);
+	const int size = char_to_byte(to) - begin;
+	char *redo = NULL;
+
+	if (size > 0)
+	{
+		redo = reinterpret_cast<char*>(secmem_malloc(size));
+		if (NULL == redo)
+		{
+			fl_beep();
+			return 1;
+		}
+		memcpy(redo, buf_ + begin, size);
+	}
+
+	const int chars = count_chars(undo_buf_, undo_size_);
+	replace_secret(from, to, undo_buf_, undo_size_, false);
+
+	fast_wipememory(undo_buf_, undo_size_);
+	undo_size_ = 0;
+	if (size > 0 && reserve_undo(size))
+	{
+		memcpy(undo_buf_, redo, size);
+		undo_size_ = size;
+	}
+	undo_chars_ = chars;
+	secmem_free(redo);
+	return 1;
+}
+
+// replace the characters [from, to) with len bytes of text
+int SecretInput::replace_secret(int from, int to, const char *text, int len,
+								bool record)
+{
+	if (from > to)
+	{
+		const int tmp = from;
+		from = to;
+		to = tmp;
+	}
+	if (from < 0)
+		from = 0;
+	if (to > chars_)
+		to = chars_;
+
+	const int begin = char_to_byte(from);
+	const int end = char_to_byte(to);
+	const int size = size_ - (end - begin) + len;
+	const int added = count_chars(text, len);
+
+	if (!reserve(size + 1) || !reserve_mask(chars_ - (to - from) + added + 1))
+	{
+		fl_beep();
+		return 1;
+	}
+
+	if (record)
+		record_undo(from, to, begin, end, added);
+
+	memmove(buf_ + begin + len, buf_ + end, size_ - end);
+	if (len > 0)
+		memcpy(buf_ + begin, text, len);
+	if (size < size_)
+		fast_wipememory(buf_ + size, size_ - size);
+	buf_[size] = 0;
+	size_ = size;
+
+	mask_[chars_] = '*';
+	chars_ += added - (to - from);
+	update_mask(from + added);
+
+	set_changed();
+	if (when() & FL_WHEN_CHANGED)
+		do_callback();
+	return 1;
+}
+
+int SecretInput::erase(bool backward)
+{
+	int from = position(), to = mark();
+	if (from == to)
+	{
+		if (backward ? from <= 0 : to >= chars_)
+			return 1;
+		if (backward)
+			--from;
+		else
+			++to;
+	}
+	return replace_secret(from, to, NULL, 0);
+}
+
+int SecretInput::handle_key()
+{
+	const int key = Fl::event_key();
+	int del;
+
+	if (Fl::compose(del))
+	{
+		if (del)
+		{
+			// del counts the bytes of a pending composition
+			const int pos = position();
+			const int from = byte_to_char(char_to_byte(pos) - del);
+			return replace_secret(from, pos, Fl::event_text(), Fl::event_length());
+		}
+		if (Fl::event_length())
+			return replace_secret(position(), mark(), Fl::event_text(), Fl::event_length());
+		return 1;
+	}
+
+	switch (key)
+	{
+	case FL_BackSpace:
+		return erase(true);
+	case FL_Delete:
+		return erase(false);
+	case FL_Insert:
+		if (Fl::event_state(FL_SHIFT))
+			Fl::paste(*this, 1);
+		return 1;
+	}
+
+	if (Fl::event_state(FL_CTRL | FL_COMMAND))
+	{
+		switch (key)
+		{
+		case 'a':
+		case FL_Left: case FL_Right:
+		case FL_Up: case FL_Down:
+		case FL_Home: case FL_End:
+		case FL_Page_Up: case FL_Page_Down:
+			break;	// only move within the mask
+		case 'v':
+			Fl::paste(*this, 1);
+			return 1;
+		case 'x':
+			// like Fl_Secret_Input, nothing goes to the clipboard
+			if (position() == mark())
+				return 1;
+			return replace_secret(position(), mark(), NULL, 0);
+		case 'z':
+			return undo();
+		case 'u':
+			return replace_secret(0, chars_, NULL, 0);
+		default:
+			// kill line and friends would edit the mask
+			return 0;
+		}
+	}
+
+	return Fl_Secret_Input::handle(FL_KEYBOARD);
+}
+
+int SecretInput::handle(int event)
+{
+	switch (event)
+	{
+	case FL_KEYBOARD:
+		if (readonly())
+			break;
+		return handle_key();
+
+	case FL_PASTE:
+		if (readonly())
+		{
+			fl_beep();
+			return 1;
+		}
+		else
+		{
+			const char *text = Fl::event_text();
+			int len = Fl::event_length();
+
+			for (int i=0; i<len; ++i)
+			{
+				if ('\n' == text[i] || '\r' == text[i])	// single line only
+				{
+					len = i;
+					break;
+				}
+			}
+			if (0 == len && position() == mark())
+				return 1;
+			return replace_secret(position(), mark(), text, len);
+		}
+	}
+
+	return Fl_Secret_Input::handle(event);
+}
@@ -0,0 +1,80 @@
+/*
+    secretinput.h - SecretInput is a fltk secret input field which keeps
+    the entered text in secure memory.
+
+    Copyright (C) 2026 g10 Code GmbH
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+    SPDX-License-Identifier: GPL-2.0+
+*/
+
+#ifndef __SECRETINPUT_H__
+#define __SECRETINPUT_H__
+
+#include <FL/Fl_Secret_Input.H>
+
+// Fl_Secret_Input keeps its text in a malloc'ed buffer which is
+// reallocated while typing. SecretInput does the editing itself and
+// keeps the text in secure memory; Fl_Input_ only sees a static mask
+// with one '*' per character, which it draws as bullets.
+class SecretInput : public Fl_Secret_Input
+{
+protected:
+	SecretInput(const SecretInput&);
+	SecretInput& operator=(const SecretInput&);
+
+	char	*buf_;		// SECURE_MEMORY, NUL terminated
+	int		size_;		// bytes in buf_
+	int		capacity_;	// allocated bytes of buf_
+	int		chars_;		// UTF-8 characters in buf_
+
+	char	*mask_;		// '*' x mask_capacity_
+	int		mask_capacity_;
+
+	// the last edit replaced undo_chars_ characters at undo_at_
+	// with the ones it inserted; undo_at_ < 0 if there is none
+	char	*undo_buf_;	// SECURE_MEMORY, the replaced bytes
+	int		undo_size_;	// bytes in undo_buf_
+	int		undo_capacity_;	// allocated bytes of undo_buf_
+	int		undo_at_;
+	int		undo_chars_;	// characters inserted by the last edit
+
+public:
+	SecretInput(int x, int y, int w, int h, const char *label = 0);
+	virtual ~SecretInput();
+
+	virtual int handle(int event);
+
+	inline const char* secret() const { return (NULL != buf_)?buf_:""; }
+	inline int secret_size() const { return size_; }
+
+	void wipe();		// clear the text, keep the buffer
+
+protected:
+	int handle_key();
+	int erase(bool backward);
+	int replace_secret(int from, int to, const char *text, int len,
+					   bool record = true);
+	void record_undo(int from, int to, int begin, int end, int added);
+	int undo();
+	bool reserve(int bytes);
+	bool reserve_undo(int bytes);
+	bool reserve_mask(int chars);
+	int char_to_byte(int pos) const;
+	int byte_to_char(int off) const;
+	void update_mask(int pos);
+};
+
+#endif //#ifndef __SECRETINPUT_H__
@@ -27,6 +27,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <assuan.h>
 
@@ -49,18 +50,27 @@
 struct pe_gnome3_run_s {
   pinentry_t pinentry;
   GcrPrompt *prompt;
-  GMainLoop *main_loop;
+  GMainLoop *main_loop;   /* NULL if the result is deferred.  */
   int ret;
   guint timeout_id;
   int timed_out;
 };
 
+#ifdef ENABLE_MAINLOOP_SERVER
+/* The request whose prompt is shown or NULL.  */
+static struct pe_gnome3_run_s *current_run;
+
+/* The main loop which runs the Assuan server.  */
+static GMainLoop *server_loop;
+#endif
+
 static void pe_gcr_prompt_password_done (GObject *source_object,
                                          GAsyncResult *res, gpointer user_data);
 
 static void pe_gcr_prompt_confirm_done (GObject *source_object,
                                         GAsyncResult *res, gpointer user_data);
 static gboolean pe_gcr_timeout_done (gpointer user_data);
+static GDBusConnection *pe_gnome_session_bus (void);
 
 
 
@@ -125,6 +135,9 @@ create_prompt (pinentry_t pe, int confirm)
   char *msg, *p;
   char window_id[32];
 
+  /* Make sure gcr finds our shared session bus connection.  */
+  pe_gnome_session_bus ();
+
   /* Create the prompt.  */
   prompt = GCR_PROMPT (gcr_system_prompt_open (pe->timeout ? pe->timeout : -1, NULL, &error));
   if (! prompt)
@@ -235,11 +248,87 @@ create_prompt (pinentry_t pe, int confirm)
   return prompt;
 }
 
+/* Show the prompt of STATE->PINENTRY; its callbacks set STATE->RET.
+   Returns -1 on error.  */
+static int
+pe_gnome3_run_start (struct pe_gnome3_run_s *state)
+{
+  pinentry_t pe = state->pinentry;
+
+  state->ret = 0;
+  state->timeout_id = 0;
+  state->timed_out = 0;
+  state->prompt = create_prompt (pe, !(pe->pin));
+  if (!state->prompt)
+    {
+      pe->canceled = 1;
+      return -1;
+    }
+  if (pe->pin)
+    gcr_prompt_password_async (state->prompt, NULL,
+                               pe_gcr_prompt_password_done, state);
+  else
+    gcr_prompt_confirm_async (state->prompt, NULL,
+                              pe_gcr_prompt_confirm_done, state);
+
+  if (pe->timeout)
+    state->timeout_id = g_timeout_add_seconds (pe->timeout,
+                                               pe_gcr_timeout_done, state);
+  return 0;
+}
+
+static void
+pe_gnome3_run_cleanup (struct pe_gnome3_run_s *state)
+{
+  if (state->timeout_id && !state->timed_out)
+    g_source_destroy
+      (g_main_context_find_source_by_id (NULL, state->timeout_id));
+
+  g_clear_object (&state->prompt);
+}
+
+#ifdef ENABLE_MAINLOOP_SERVER
+/* Called by the prompt callbacks once a deferred request has its
+   result.  */
+static void
+pe_gnome3_run_done (struct pe_gnome3_run_s *state)
+{
+  pinentry_t pe = state->pinentry;
+  int ret = state->ret;
+
+  /* pinentry_command_done may already run the next request.  */
+  current_run = NULL;
+  pe_gnome3_run_cleanup (state);
+  g_free (state);
+
+  if (pinentry_command_done (pe, ret))
+    g_main_loop_quit (server_loop);
+}
+#endif /*ENABLE_MAINLOOP_SERVER*/
+
 static int
 gnome3_cmd_handler (pinentry_t pe)
 {
   struct pe_gnome3_run_s state;
 
+#ifdef ENABLE_MAINLOOP_SERVER
+  /* Under the server the prompt is left to the server loop and the
+     callbacks complete the request.  */
+  if (server_loop)
+    {
+      struct pe_gnome3_run_s *run = g_new0 (struct pe_gnome3_run_s, 1);
+
+      run->pinentry = pe;
+      if (pe_gnome3_run_start (run))
+        {
+          g_free (run);
+          return -1;
+        }
+      current_run = run;
+      return PINENTRY_DEFERRED;
+    }
+#endif
+
   state.main_loop = g_main_loop_new (NULL, FALSE);
   if (!state.main_loop)
     {
@@ -250,33 +339,14 @@ gnome3_cmd_handler (pinentry_t pe)
       return -1;
     }
   state.pinentry = pe;
-  state.ret = 0;
-  state.timeout_id = 0;
-  state.timed_out = 0;
-  state.prompt = create_prompt (pe, !(pe->pin));
-  if (!state.prompt)
+  if (pe_gnome3_run_start (&state))
     {
-      pe->canceled = 1;
+      g_main_loop_unref (state.main_loop);
       return -1;
     }
-  if (pe->pin)
-    gcr_prompt_password_async (state.prompt, NULL, pe_gcr_prompt_password_done,
-                               &state);
-  else
-    gcr_prompt_confirm_async (state.prompt, NULL, pe_gcr_prompt_confirm_done,
-                              &state);
-
-  if (pe->timeout)
-    state.timeout_id = g_timeout_add_seconds (pe->timeout,
-                                              pe_gcr_timeout_done, &state);
   g_main_loop_run (state.main_loop);
 
-  /* clean up state: */
-  if (state.timeout_id && !state.timed_out)
-    g_source_destroy
-      (g_main_context_find_source_by_id (NULL, state.timeout_id));
-
-  g_clear_object (&state.prompt);
+  pe_gnome3_run_cleanup (&state);
   g_main_loop_unref (state.main_loop);
   return state.ret;
 };
@@ -336,8 +406,16 @@ pe_gcr_prompt_password_done (GObject *source_object,
       state->ret = ret;
     }
 
-  if (state)
-    g_main_loop_quit (state->main_loop);
+  if (!state)
+    return;
+#ifdef ENABLE_MAINLOOP_SERVER
+  if (!state->main_loop)
+    {
+      pe_gnome3_run_done (state);
+      return;
+    }
+#endif
+  g_main_loop_quit (state->main_loop);
 }
 
 static void
@@ -389,8 +467,16 @@ pe_gcr_prompt_confirm_done (GObject *source_object, GAsyncResult *res,
       state->ret = ret;
     }
 
-  if (state)
-    g_main_loop_quit (state->main_loop);
+  if (!state)
+    return;
+#ifdef ENABLE_MAINLOOP_SERVER
+  if (!state->main_loop)
+    {
+      pe_gnome3_run_done (state);
+      return;
+    }
+#endif
+  g_main_loop_quit (state->main_loop);
 }
 
 static gboolean
@@ -409,73 +495,199 @@ pe_gcr_timeout_done (gpointer user_data)
 
 pinentry_cmd_handler_t pinentry_cmd_handler = gnome3_cmd_handler;
 
-/* Test whether there is a GNOME screensaver running that happens to
- * be locked.  Note that if there is no GNOME screensaver running at
- * all the answer is still FALSE.  */
+
+#ifdef ENABLE_MAINLOOP_SERVER
+/* Process the Assuan input.  */
 static gboolean
-pe_gnome_screen_locked (void)
+assuan_input_cb (GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+  (void)channel;
+  (void)condition;
+  (void)data;
+
+  if (!pinentry_server_process ())
+    return TRUE;
+
+  /* The connection has ended.  Closing an open prompt finishes its
+     request as canceled, and pe_gnome3_run_done then quits the
+     loop.  */
+  if (current_run)
+    gcr_prompt_close (current_run->prompt);
+  else
+    g_main_loop_quit (server_loop);
+  return FALSE;
+}
+
+
+/* Run the Assuan server from a GLib main loop so that an open prompt
+   is closed when the connection ends.  */
+static int
+run_server (void)
+{
+  GIOChannel *channel;
+  GSource *source;
+
+  if (pinentry_server_start (STDIN_FILENO, STDOUT_FILENO))
+    return -1;
+
+  server_loop = g_main_loop_new (NULL, FALSE);
+  channel = g_io_channel_unix_new (pinentry_server_fd ());
+  source = g_io_create_watch (channel, G_IO_IN | G_IO_HUP | G_IO_ERR);
+  g_source_set_callback (source, (GSourceFunc)assuan_input_cb, NULL, NULL);
+  g_source_attach (source, NULL);
+
+  g_main_loop_run (server_loop);
+
+  g_source_destroy (source);
+  g_source_unref (source);
+  g_io_channel_unref (channel);
+  g_main_loop_unref (server_loop);
+  server_loop = NULL;
+  pinentry_server_stop ();
+  return 0;
+}
+#endif /*ENABLE_MAINLOOP_SERVER*/
+
+/* The session bus connection shared by everything in this process.
+ * gcr gets its connection from the same g_bus_get singleton, so as
+ * long as we hold this reference the system prompts reuse it instead
+ * of connecting again for each request.  */
+static GDBusConnection *session_bus;
+static int session_bus_failed;
+
+/* How long we wait for org.gnome.ScreenSaver.GetActive.  The query
+ * runs in parallel to opening the Gcr test prompt, thus this is only
+ * an upper bound for a hanging screensaver.  */
+#define SCREENSAVER_TIMEOUT_MS 500
+
+struct pe_screen_lock_query_s {
+  int done;
+  gboolean locked;
+};
+
+
+/* Return the session bus connection, connecting on first use.  The
+ * returned object is owned by this module.  */
+static GDBusConnection *
+pe_gnome_session_bus (void)
 {
-  GDBusConnection *dbus;
   GError *error = NULL;
-  GVariant *reply, *reply_bool;
-  gboolean ret;
 
-  dbus = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+  if (session_bus || session_bus_failed)
+    return session_bus;
 
-  if (!dbus)
+  session_bus = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+  if (!session_bus)
     {
       fprintf (stderr, "failed to connect to user session D-Bus (%d): %s",
                error ? error->code : -1,
                error ? error->message : "<no GError>");
       if (error)
         g_error_free (error);
-      return FALSE;
+      session_bus_failed = 1;
     }
+  return session_bus;
+}
 
-  /* this is intended to be the equivalent of:
-   * dbus-send --print-reply=literal --session          \
-   *           --dest=org.gnome.ScreenSaver             \
-   *           /org/gnome/ScreenSaver                   \
-   *           org.gnome.ScreenSaver.GetActive
-   */
-  reply = g_dbus_connection_call_sync (dbus,
-                                       "org.gnome.ScreenSaver",
-                                       "/org/gnome/ScreenSaver",
-                                       "org.gnome.ScreenSaver",
-                                       "GetActive",
-                                       NULL,
-                                       ((const GVariantType *) "(b)"),
-                                       G_DBUS_CALL_FLAGS_NO_AUTO_START,
-                                       0,
-                                       NULL,
-                                       &error);
-  g_object_unref(dbus);
+
+static void
+pe_gnome_screen_locked_done (GObject *source_object,
+                             GAsyncResult *res, gpointer user_data)
+{
+  struct pe_screen_lock_query_s *query = user_data;
+  GError *error = NULL;
+  GVariant *reply, *reply_bool;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+                                         res, &error);
   if (!reply)
     {
-      /* G_IO_ERROR_TIMED_OUT is the expected response when there is
-       * no gnome screensaver at all, don't be noisy in that case: */
-      if (!(error && error->code == G_IO_ERROR_TIMED_OUT))
+      /* G_IO_ERROR_TIMED_OUT or an unknown service name are the
+       * expected responses when there is no gnome screensaver at
+       * all; don't be noisy in that case.  */
+      if (!error
+          || !(g_error_matches (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT)
+               || g_error_matches (error, G_DBUS_ERROR,
+                                   G_DBUS_ERROR_SERVICE_UNKNOWN)
+               || g_error_matches (error, G_DBUS_ERROR,
+                                   G_DBUS_ERROR_NAME_HAS_NO_OWNER)))
         fprintf (stderr, "Failed to get d-bus reply for org.gnome.ScreenSaver.GetActive (%d): %s\n",
                  error ? error->code : -1,
                  error ? error->message : "<no GError>");
       if (error)
         g_error_free (error);
-      return FALSE;
+      query->locked = FALSE;
+      query->done = 1;
+      return;
     }
+
   reply_bool = g_variant_get_child_value (reply, 0);
   if (!reply_bool)
     {
       fprintf (stderr, "Failed to get d-bus boolean from org.gnome.ScreenSaver.GetActive; assuming screensaver is not locked\n");
-      ret = FALSE;
+      query->locked = FALSE;
     }
   else
     {
-      ret = g_variant_get_boolean (reply_bool);
+      query->locked = g_variant_get_boolean (reply_bool);
       g_variant_unref (reply_bool);
     }
 
   g_variant_unref (reply);
-  return ret;
+  query->done = 1;
+}
+
+
+/* Start testing whether there is a GNOME screensaver running that
+ * happens to be locked.  The answer is collected with
+ * pe_gnome_screen_locked_end, which allows to do other D-Bus work in
+ * the meantime.  */
+static void
+pe_gnome_screen_locked_begin (struct pe_screen_lock_query_s *query)
+{
+  GDBusConnection *dbus;
+
+  query->done = 0;
+  query->locked = FALSE;
+
+  dbus = pe_gnome_session_bus ();
+  if (!dbus)
+    {
+      query->done = 1;
+      return;
+    }
+
+  /* this is intended to be the equivalent of:
+   * dbus-send --print-reply=literal --session          \
+   *           --dest=org.gnome.ScreenSaver             \
+   *           /org/gnome/ScreenSaver                   \
+   *           org.gnome.ScreenSaver.GetActive
+   */
+  g_dbus_connection_call (dbus,
+                          "org.gnome.ScreenSaver",
+                          "/org/gnome/ScreenSaver",
+                          "org.gnome.ScreenSaver",
+                          "GetActive",
+                          NULL,
+                          ((const GVariantType *) "(b)"),
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          SCREENSAVER_TIMEOUT_MS,
+                          NULL,
+                          pe_gnome_screen_locked_done,
+                          query);
+}
+
+
+/* Wait for the query started by pe_gnome_screen_locked_begin and
+ * return true if the screensaver is locked.  Note that if there is
+ * no GNOME screensaver running at all the answer is still FALSE.  */
+static gboolean
+pe_gnome_screen_locked_end (struct pe_screen_lock_query_s *query)
+{
+  while (!query->done)
+    g_main_context_iteration (NULL, TRUE);
+
+  return query->locked;
 }
 
 /* Test whether we can create a system prompt or not.  This briefly
@@ -515,6 +727,8 @@ pe_gcr_system_prompt_available (void)
 int
 main (int argc, char *argv[])
 {
+  int rc;
+
   pinentry_init (PGMNAME);
 
 #ifdef FALLBACK_CURSES
@@ -525,26 +739,52 @@ main (int argc, char *argv[])
       pinentry_cmd_handler = curses_cmd_handler;
       pinentry_set_flavor_flag ("curses");
     }
-  else if (!pe_gcr_system_prompt_available ())
-    {
-      fprintf (stderr, "No Gcr System Prompter available,"
-               " falling back to curses\n");
-      pinentry_cmd_handler = curses_cmd_handler;
-      pinentry_set_flavor_flag ("curses");
-    }
-  else if (pe_gnome_screen_locked ())
+  else
     {
-      fprintf (stderr, "GNOME screensaver is locked,"
-               " falling back to curses\n");
-      pinentry_cmd_handler = curses_cmd_handler;
-      pinentry_set_flavor_flag ("curses");
+      struct pe_screen_lock_query_s lock_query;
+      int prompt_available;
+      gboolean locked;
+
+      /* Ask the screensaver while gcr opens its test prompt, so that
+       * we don't wait for both D-Bus round trips one after the
+       * other.  */
+      pe_gnome_screen_locked_begin (&lock_query);
+      prompt_available = pe_gcr_system_prompt_available ();
+      locked = pe_gnome_screen_locked_end (&lock_query);
+
+      if (!prompt_available)
+        {
+          fprintf (stderr, "No Gcr System Prompter available,"
+                   " falling back to curses\n");
+          pinentry_cmd_handler = curses_cmd_handler;
+          pinentry_set_flavor_flag ("curses");
+        }
+      else if (locked)
+        {
+          fprintf (stderr, "GNOME screensaver is locked,"
+                   " falling back to curses\n");
+          pinentry_cmd_handler = curses_cmd_handler;
+          pinentry_set_flavor_flag ("curses");
+        }
     }
 #endif
+  pinentry_timing ("toolkit");
 
   pinentry_parse_opts (argc, argv);
 
-  if (pinentry_loop ())
+#ifdef ENABLE_MAINLOOP_SERVER
+# ifdef FALLBACK_CURSES
+  if (pinentry_cmd_handler == curses_cmd_handler)
+    rc = pinentry_loop ();
+  else
+# endif
+    rc = run_server ();
+#else
+  rc = pinentry_loop ();
+#endif
+  if (rc)
     return 1;
 
+  g_clear_object (&session_bus);
   return 0;
 }
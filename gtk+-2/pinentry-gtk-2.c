@@ -39,6 +39,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <gpg-error.h>
 
 #ifdef HAVE_GETOPT_H
@@ -77,6 +78,9 @@ static GtkTooltips *tooltips;
 static gboolean got_input;
 static guint timeout_source;
 static int confirm_mode;
+static int keybench_keys;
+static gboolean keybench_started;
+static gboolean keybench_typed;
 
 /* Gnome hig small and large space in pixels.  */
 #define HIG_TINY       2
@@ -419,6 +423,94 @@ changed_text_handler (GtkWidget *widget)
 }
 
 
+/* Keystroke latency measurement; see pinentry_keybench_keys.  The
+   synthetic keys go through the GDK event queue like real ones.  */
+static gboolean keybench_next (gpointer data);
+
+static void
+keybench_put_key (GtkWidget *widget, guint keyval, GdkEventType type)
+{
+  GdkEvent *event;
+  GdkKeymapKey *keys;
+  gint nkeys;
+
+  event = gdk_event_new (type);
+  event->key.window
+    = g_object_ref (gtk_widget_get_window (gtk_widget_get_toplevel (widget)));
+  event->key.send_event = TRUE;
+  event->key.time = GDK_CURRENT_TIME;
+  event->key.keyval = keyval;
+  if (gdk_keymap_get_entries_for_keyval (gdk_keymap_get_default (),
+                                         keyval, &keys, &nkeys))
+    {
+      event->key.hardware_keycode = keys[0].keycode;
+      event->key.group = keys[0].group;
+      g_free (keys);
+    }
+  gdk_event_put (event);
+  gdk_event_free (event);
+}
+
+
+/* Queue the next synthetic key or, after the last one, press Enter
+   the way a user would.  */
+static gboolean
+keybench_next (gpointer data)
+{
+  GtkWidget *widget = data;
+
+  if (!keybench_keys)
+    {
+      if (repeat_entry)
+        {
+          gtk_entry_set_text (GTK_ENTRY (repeat_entry),
+                              gtk_entry_get_text (GTK_ENTRY (widget)));
+          keybench_put_key (widget, GDK_KEY_Return, GDK_KEY_PRESS);
+        }
+      keybench_put_key (widget, GDK_KEY_Return, GDK_KEY_PRESS);
+      return FALSE;
+    }
+
+  keybench_keys--;
+  keybench_typed = FALSE;
+  pinentry_keybench_mark (PINENTRY_KEYBENCH_KEY);
+  keybench_put_key (widget, GDK_KEY_a, GDK_KEY_PRESS);
+  keybench_put_key (widget, GDK_KEY_a, GDK_KEY_RELEASE);
+  return FALSE;
+}
+
+
+static gboolean
+keybench_key_press (GtkWidget *widget, GdkEventKey *event, gpointer data)
+{
+  (void)widget;
+  (void)event;
+  (void)data;
+
+  keybench_typed = TRUE;
+  return FALSE;
+}
+
+
+/* Handler called after the entry has been drawn.  The first one
+   starts the measurement, later ones complete a keystroke.  */
+static gboolean
+keybench_expose (GtkWidget *widget, GdkEventExpose *event, gpointer data)
+{
+  (void)event;
+  (void)data;
+
+  if (!keybench_started)
+    {
+      keybench_started = TRUE;
+      g_idle_add (keybench_next, widget);
+    }
+  else if (keybench_typed && pinentry_keybench_mark (PINENTRY_KEYBENCH_PAINT))
+    g_idle_add (keybench_next, widget);
+  return FALSE;
+}
+
+
 #ifdef HAVE_LIBSECRET
 static void
 may_save_passphrase_toggled (GtkWidget *widget, gpointer data)
@@ -713,6 +805,15 @@ create_window (pinentry_t ctx)
       gtk_widget_set_size_request (entry, 200, -1);
       g_signal_connect (G_OBJECT (entry), "changed",
                         G_CALLBACK (changed_text_handler), entry);
+      keybench_keys = pinentry_keybench_keys ();
+      keybench_started = keybench_typed = FALSE;
+      if (keybench_keys)
+        {
+          g_signal_connect (G_OBJECT (entry), "key-press-event",
+                            G_CALLBACK (keybench_key_press), NULL);
+          g_signal_connect_after (G_OBJECT (entry), "expose-event",
+                                  G_CALLBACK (keybench_expose), NULL);
+        }
       hbox = gtk_hbox_new (FALSE, HIG_TINY);
       gtk_box_pack_start (GTK_BOX (hbox), entry, TRUE, TRUE, 0);
       /* There was a wish in issue #2139 that this button should not
@@ -891,6 +992,7 @@ create_window (pinentry_t ctx)
   gtk_window_set_keep_above (GTK_WINDOW (win), TRUE);
   gtk_widget_show_all (win);
   gtk_window_present (GTK_WINDOW (win));  /* Make sure it has the focus.  */
+  pinentry_timing ("dialog");
 
   if (pinentry->timeout > 0)
     timeout_source = g_timeout_add (pinentry->timeout*1000, timeout_cb, pinentry);
@@ -942,9 +1044,61 @@ gtk_cmd_handler (pinentry_t pe)
 pinentry_cmd_handler_t pinentry_cmd_handler = gtk_cmd_handler;
 
 
+#ifdef ENABLE_MAINLOOP_SERVER
+/* Process the Assuan input.  This also runs from the nested main
+   loop of an open dialog.  */
+static gboolean
+assuan_input_cb (GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+  (void)channel;
+  (void)condition;
+  (void)data;
+
+  if (!pinentry_server_process ())
+    return TRUE;
+
+  /* The connection has ended.  This first leaves the loop of an open
+     dialog, which is then canceled, and otherwise the loop of
+     run_server.  */
+  gtk_main_quit ();
+  return FALSE;
+}
+
+
+/* Run the Assuan server from the GTK+ main loop so that the dialogs
+   notice when the connection ends.  */
+static int
+run_server (void)
+{
+  GIOChannel *channel;
+  GSource *source;
+
+  if (pinentry_server_start (STDIN_FILENO, STDOUT_FILENO))
+    return -1;
+
+  channel = g_io_channel_unix_new (pinentry_server_fd ());
+  source = g_io_create_watch (channel, G_IO_IN | G_IO_HUP | G_IO_ERR);
+  g_source_set_callback (source, (GSourceFunc)assuan_input_cb, NULL, NULL);
+  /* gtk_cmd_handler runs from within the callback.  */
+  g_source_set_can_recurse (source, TRUE);
+  g_source_attach (source, NULL);
+
+  gtk_main ();
+
+  g_source_destroy (source);
+  g_source_unref (source);
+  g_io_channel_unref (channel);
+  pinentry_server_stop ();
+  return 0;
+}
+#endif /*ENABLE_MAINLOOP_SERVER*/
+
+
 int
 main (int argc, char *argv[])
 {
+  int rc;
+
   pinentry_init (PGMNAME);
 
 #ifdef FALLBACK_CURSES
@@ -964,10 +1118,21 @@ main (int argc, char *argv[])
 #else
   gtk_init (&argc, &argv);
 #endif
+  pinentry_timing ("toolkit");
 
   pinentry_parse_opts (argc, argv);
 
-  if (pinentry_loop ())
+#ifdef ENABLE_MAINLOOP_SERVER
+# ifdef FALLBACK_CURSES
+  if (pinentry_cmd_handler == curses_cmd_handler)
+    rc = pinentry_loop ();
+  else
+# endif
+    rc = run_server ();
+#else
+  rc = pinentry_loop ();
+#endif
+  if (rc)
     return 1;
 
   return 0;
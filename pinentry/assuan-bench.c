@@ -0,0 +1,699 @@
+/* assuan-bench.c - Measure the Assuan command dispatch of libpinentry
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of PINENTRY.
+ *
+ * PINENTRY is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PINENTRY is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* This program runs the pinentry server via pinentry_loop2 in a
+ * child process connected by a socketpair and plays the part of
+ * gpg-agent.  The frontend is a null command handler which answers
+ * each GETPIN immediately, optionally after running quality
+ * inquiries.  A session script is replayed several times and the
+ * latency of each command as well as the number of allocations done
+ * through the Assuan malloc hooks are reported per command.
+ *
+ * With --inproc the session is instead run in-process through
+ * pinentry_ctx_command, which shows the cost of the Assuan I/O.
+ *
+ * With --option-burst N each replay sends N OPTION lines, taken in
+ * turn from the OPTION lines of the session, followed by a RESET.
+ * This is what a long-lived pinentry sees when gpg-agent reconnects
+ * for every request.
+ *
+ * The exit status is 1 if any command other than an OPTION the
+ * pinentry does not know fails or if the server does not exit
+ * cleanly; "make check" runs a short session both ways.
+ *
+ * The session script has one Assuan command per line; empty lines
+ * and lines starting with a '#' are ignored.  Without a script a
+ * session modelled after what gpg-agent sends for a passphrase
+ * request is used.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <assuan.h>
+
+#include "memory.h"
+#include "pinentry.h"
+
+#define PGM "assuan-bench"
+
+#if defined(MAP_ANON) && !defined(MAP_ANONYMOUS)
+#  define MAP_ANONYMOUS MAP_ANON
+#endif
+
+
+static const char *default_session[] =
+  {
+    "OPTION ttyname=/dev/pts/1",
+    "OPTION ttytype=xterm-256color",
+    "OPTION lc-ctype=en_US.UTF-8",
+    "OPTION lc-messages=en_US.UTF-8",
+    "OPTION allow-external-password-cache",
+    "OPTION default-ok=_OK",
+    "OPTION default-cancel=_Cancel",
+    "OPTION default-yes=_Yes",
+    "OPTION default-no=_No",
+    "OPTION default-prompt=PIN:",
+    "OPTION default-pwmngr=_Save in password manager",
+    "OPTION default-cf-visi=Do you really want to make your passphrase"
+    " visible on the screen?",
+    "OPTION default-tt-visi=Make passphrase visible",
+    "OPTION default-tt-hide=Hide passphrase",
+    "OPTION touch-file=/run/user/1000/gnupg/S.gpg-agent",
+    "OPTION owner=4711/1000 localhost",
+    "GETINFO flavor",
+    "GETINFO version",
+    "GETINFO ttyinfo",
+    "GETINFO pid",
+    "SETKEYINFO n/0123456789ABCDEF0123456789ABCDEF01234567",
+    "SETDESC Please enter the passphrase to unlock the OpenPGP secret"
+    " key:%0A%22Alice <alice@example.org>%22%0A255-bit EDDSA key,"
+    " ID 0123456789ABCDEF,%0Acreated 2026-01-01.%0A",
+    "SETPROMPT Passphrase:",
+    "SETQUALITYBAR",
+    "SETQUALITYBAR_TT The quality of the text entered above.%0APlease"
+    " ask your administrator for details about the criteria.",
+    "GETPIN",
+    "SETERROR Bad Passphrase (try 2 of 3)",
+    "GETPIN",
+    "CONFIRM",
+    "RESET",
+    NULL
+  };
+
+static int verbose;
+
+/* The passphrase returned by the null frontend and the number of
+ * keystrokes it simulates with quality inquiries.  */
+static const char passphrase[] = "correct horse battery staple";
+static int keystrokes = 8;
+
+
+/* Counters updated by the server process and read by the client;
+ * they live in shared memory.  */
+static struct
+{
+  unsigned long allocs;
+  unsigned long bytes;
+} *counters;
+
+static void *
+counting_malloc (size_t n)
+{
+  counters->allocs++;
+  counters->bytes += n;
+  return secmem_malloc_in (SECMEM_POOL_IO, n);
+}
+
+static void *
+counting_realloc (void *p, size_t n)
+{
+  counters->allocs++;
+  counters->bytes += n;
+  return secmem_realloc_in (SECMEM_POOL_IO, p, n);
+}
+
+static struct assuan_malloc_hooks counting_hooks =
+  {
+    counting_malloc, counting_realloc, secmem_free
+  };
+
+
+/* The null frontend.  */
+static int
+bench_cmd_handler (pinentry_t pe)
+{
+  int i, len;
+
+  if (!pe->pin)
+    return 1;  /* Confirmed.  */
+
+  len = strlen (passphrase);
+  if (pe->quality_bar)
+    for (i = 1; i <= keystrokes; i++)
+      pinentry_inq_quality (pe, passphrase, i < len? i : len);
+
+  if (!pinentry_setbufferlen (pe, len + 1))
+    return -1;
+  strcpy (pe->pin, passphrase);
+  return len;
+}
+
+pinentry_cmd_handler_t pinentry_cmd_handler = bench_cmd_handler;
+
+
+/* The callbacks of the context used with --inproc.  */
+static int
+bench_status (void *opaque, const char *keyword, const char *args)
+{
+  (void)opaque;
+
+  if (verbose > 1)
+    fprintf (stderr, PGM ": <- S %s %s\n", keyword, args);
+  return 0;
+}
+
+static int
+bench_quality (void *opaque, const char *pass, size_t length)
+{
+  (void)opaque;
+  (void)pass;
+  (void)length;
+
+  return 50;
+}
+
+static struct pinentry_ctx_cbs bench_cbs =
+  {
+    NULL, bench_status, bench_quality
+  };
+
+
+
+/* Client side I/O.  */
+static char readbuf[4096];
+static size_t readlen;
+
+static void
+write_line (int fd, const char *line)
+{
+  size_t n = strlen (line);
+  ssize_t nw;
+
+  while (n)
+    {
+      nw = write (fd, line, n);
+      if (nw < 0 && errno == EINTR)
+        continue;
+      if (nw < 0)
+        {
+          fprintf (stderr, PGM ": write failed: %s\n", strerror (errno));
+          exit (1);
+        }
+      line += nw;
+      n -= nw;
+    }
+}
+
+
+/* Read one line from FD into LINE of SIZE bytes.  */
+static void
+read_line (int fd, char *line, size_t size)
+{
+  char *nl;
+  ssize_t nr;
+  size_t n;
+
+  while (!(nl = memchr (readbuf, '\n', readlen)))
+    {
+      if (readlen == sizeof readbuf)
+        {
+          fprintf (stderr, PGM ": line too long\n");
+          exit (1);
+        }
+      nr = read (fd, readbuf + readlen, sizeof readbuf - readlen);
+      if (nr < 0 && errno == EINTR)
+        continue;
+      if (nr <= 0)
+        {
+          fprintf (stderr, PGM ": server closed the connection\n");
+          exit (1);
+        }
+      readlen += nr;
+    }
+
+  n = nl - readbuf;
+  if (n >= size)
+    n = size - 1;
+  memcpy (line, readbuf, n);
+  line[n] = 0;
+  readlen -= nl + 1 - readbuf;
+  memmove (readbuf, nl + 1, readlen);
+}
+
+
+/* Run COMMAND and wait for its final OK or ERR.  Inquiries are
+ * answered the way gpg-agent does.  Return the error code of the ERR
+ * line or 0 for OK.  */
+static gpg_error_t
+transact (int fd, const char *command)
+{
+  char line[ASSUAN_LINELENGTH + 2];
+
+  write_line (fd, command);
+  write_line (fd, "\n");
+  for (;;)
+    {
+      read_line (fd, line, sizeof line);
+      if (verbose > 1)
+        fprintf (stderr, PGM ": <- %s\n", line);
+      if (!strncmp (line, "OK", 2) && (!line[2] || line[2] == ' '))
+        return 0;
+      if (!strncmp (line, "ERR", 3) && (!line[3] || line[3] == ' '))
+        return line[3]? strtoul (line + 4, NULL, 10) : GPG_ERR_GENERAL;
+      if (!strncmp (line, "INQUIRE QUALITY", 15))
+        write_line (fd, "D 50\nEND\n");
+      else if (!strncmp (line, "INQUIRE", 7))
+        write_line (fd, "CAN\n");
+    }
+}
+
+
+/* The number of commands which failed.  */
+static unsigned long nfailures;
+
+/* Account for the result RC of COMMAND.  Like gpg-agent we ignore
+ * options the pinentry does not know; any other error is a
+ * failure.  */
+static void
+check_result (const char *command, gpg_error_t rc)
+{
+  if (!rc)
+    return;
+  if (!strncmp (command, "OPTION ", 7)
+      && gpg_err_code (rc) == GPG_ERR_UNKNOWN_OPTION)
+    {
+      if (verbose)
+        fprintf (stderr, PGM ": %s: %s\n", command, gpg_strerror (rc));
+      return;
+    }
+  fprintf (stderr, PGM ": %s: ERR %u %s\n", command, rc, gpg_strerror (rc));
+  nfailures++;
+}
+
+
+
+/* Latency samples per command name.  */
+struct stats_s
+{
+  struct stats_s *next;
+  char name[32];
+  double *samples;  /* In microseconds.  */
+  size_t nsamples;
+  size_t nalloced;
+  unsigned long allocs;
+  unsigned long bytes;
+};
+
+static struct stats_s *stats;
+static struct stats_s **stats_tail = &stats;
+
+static struct stats_s *
+get_stats (const char *command)
+{
+  struct stats_s *st;
+  size_t n = strcspn (command, " ");
+
+  if (n >= sizeof st->name)
+    n = sizeof st->name - 1;
+  for (st = stats; st; st = st->next)
+    if (strlen (st->name) == n && !strncmp (st->name, command, n))
+      return st;
+
+  st = calloc (1, sizeof *st);
+  if (!st)
+    {
+      fprintf (stderr, PGM ": out of core\n");
+      exit (1);
+    }
+  memcpy (st->name, command, n);
+  *stats_tail = st;
+  stats_tail = &st->next;
+  return st;
+}
+
+static void
+add_sample (struct stats_s *st, double usec)
+{
+  if (st->nsamples == st->nalloced)
+    {
+      st->nalloced = st->nalloced? 2 * st->nalloced : 256;
+      st->samples = realloc (st->samples, st->nalloced * sizeof *st->samples);
+      if (!st->samples)
+        {
+          fprintf (stderr, PGM ": out of core\n");
+          exit (1);
+        }
+    }
+  st->samples[st->nsamples++] = usec;
+}
+
+static int
+cmp_double (const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return x < y? -1 : x > y;
+}
+
+static double
+percentile (struct stats_s *st, int p)
+{
+  size_t idx = (st->nsamples * p) / 100;
+
+  if (idx >= st->nsamples)
+    idx = st->nsamples - 1;
+  return st->samples[idx];
+}
+
+static double
+now_usec (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+
+
+/* Read the session script FNAME into a NULL terminated array.  */
+static const char **
+read_session (const char *fname)
+{
+  FILE *fp;
+  char line[ASSUAN_LINELENGTH + 2];
+  const char **session = NULL;
+  size_t n = 0;
+  char *p;
+
+  fp = fopen (fname, "r");
+  if (!fp)
+    {
+      fprintf (stderr, PGM ": can't open '%s': %s\n", fname, strerror (errno));
+      exit (1);
+    }
+  while (fgets (line, sizeof line, fp))
+    {
+      line[strcspn (line, "\r\n")] = 0;
+      if (!*line || *line == '#')
+        continue;
+      session = realloc (session, (n + 2) * sizeof *session);
+      p = strdup (line);
+      if (!session || !p)
+        {
+          fprintf (stderr, PGM ": out of core\n");
+          exit (1);
+        }
+      session[n++] = p;
+      session[n] = NULL;
+    }
+  fclose (fp);
+  if (!session)
+    {
+      fprintf (stderr, PGM ": '%s' has no commands\n", fname);
+      exit (1);
+    }
+  return session;
+}
+
+
+/* Return a session of N OPTION lines taken in turn from the OPTION
+ * lines of SESSION and a final RESET.  */
+static const char **
+make_option_burst (const char **session, int n)
+{
+  const char **burst;
+  const char **cmd;
+  int i;
+
+  for (cmd = session; *cmd; cmd++)
+    if (!strncmp (*cmd, "OPTION ", 7))
+      break;
+  if (!*cmd)
+    {
+      fprintf (stderr, PGM ": the session has no OPTION lines\n");
+      exit (1);
+    }
+
+  burst = calloc (n + 2, sizeof *burst);
+  if (!burst)
+    {
+      fprintf (stderr, PGM ": out of core\n");
+      exit (1);
+    }
+  for (i = 0; i < n; i++)
+    {
+      burst[i] = *cmd;
+      do
+        if (!*++cmd)
+          cmd = session;
+      while (strncmp (*cmd, "OPTION ", 7));
+    }
+  burst[n] = "RESET";
+  return burst;
+}
+
+
+static void
+run_server (int fd)
+{
+  assuan_set_malloc_hooks (&counting_hooks);
+  exit (pinentry_loop2 (fd, fd)? 1 : 0);
+}
+
+
+/* Fork the server process and return the descriptor connected to it
+ * after the greeting.  Its pid is stored at R_PID.  */
+static int
+start_server (pid_t *r_pid)
+{
+  char line[ASSUAN_LINELENGTH + 2];
+  int sv[2];
+  pid_t pid;
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv))
+    {
+      fprintf (stderr, PGM ": socketpair failed: %s\n", strerror (errno));
+      exit (1);
+    }
+
+  pid = fork ();
+  if (pid == (pid_t)-1)
+    {
+      fprintf (stderr, PGM ": fork failed: %s\n", strerror (errno));
+      exit (1);
+    }
+  if (!pid)
+    {
+      close (sv[0]);
+      run_server (sv[1]);
+    }
+  close (sv[1]);
+
+  /* The greeting.  */
+  read_line (sv[0], line, sizeof line);
+  if (strncmp (line, "OK", 2))
+    {
+      fprintf (stderr, PGM ": unexpected greeting '%s'\n", line);
+      exit (1);
+    }
+
+  *r_pid = pid;
+  return sv[0];
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  int iterations = 1000;
+  const char **session = default_session;
+  const char **cmd;
+  int inproc = 0;
+  int burst = 0;
+  pinentry_ctx_t ctx = NULL;
+  gpg_error_t rc;
+  int status;
+  struct stats_s *st;
+  unsigned long allocs, bytes, ncommands = 0;
+  double t0, t1, tstart;
+  int fd = -1;
+  pid_t pid = 0;
+  int i;
+
+  if (argc)
+    { argc--; argv++; }
+  while (argc && last_argc != argc)
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--"))
+        {
+          argc--; argv++;
+          break;
+        }
+      else if (!strcmp (*argv, "--help"))
+        {
+          fputs ("usage: " PGM " [options] [SESSIONFILE]\n"
+                 "Options:\n"
+                 "  --iterations N  replay the session N times"
+                 " [1000]\n"
+                 "  --keystrokes N  quality inquiries per GETPIN [8]\n"
+                 "  --inproc        run the session in-process\n"
+                 "  --option-burst N  replay N OPTION lines and a RESET"
+                 " instead\n"
+                 "  --verbose       also print unknown options\n"
+                 "  --debug         also print all received lines\n",
+                 stdout);
+          exit (0);
+        }
+      else if (!strcmp (*argv, "--verbose"))
+        {
+          verbose = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--inproc"))
+        {
+          inproc = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--debug"))
+        {
+          verbose = 2;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--iterations") && argc > 1)
+        {
+          iterations = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--option-burst") && argc > 1)
+        {
+          burst = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--keystrokes") && argc > 1)
+        {
+          keystrokes = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strncmp (*argv, "--", 2))
+        {
+          fprintf (stderr, PGM ": unknown option '%s'\n", *argv);
+          exit (1);
+        }
+    }
+  if (argc > 1)
+    {
+      fprintf (stderr, "usage: " PGM " [options] [SESSIONFILE]\n");
+      exit (1);
+    }
+  if (argc)
+    session = read_session (*argv);
+  if (burst > 0)
+    session = make_option_burst (session, burst);
+  if (iterations < 1)
+    iterations = 1;
+
+  pinentry_init (PGM);
+
+  counters = mmap (NULL, sizeof *counters, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (counters == MAP_FAILED)
+    {
+      fprintf (stderr, PGM ": mmap failed: %s\n", strerror (errno));
+      exit (1);
+    }
+
+  if (inproc)
+    {
+      ctx = pinentry_ctx_new (bench_cmd_handler, &bench_cbs, NULL);
+      if (!ctx)
+        {
+          fprintf (stderr, PGM ": can't create context: %s\n",
+                   strerror (errno));
+          exit (1);
+        }
+    }
+  else
+    fd = start_server (&pid);
+
+  tstart = now_usec ();
+  for (i = 0; i < iterations; i++)
+    for (cmd = session; *cmd; cmd++)
+      {
+        st = get_stats (*cmd);
+        allocs = counters->allocs;
+        bytes = counters->bytes;
+        t0 = now_usec ();
+        if (ctx)
+          rc = pinentry_ctx_command (ctx, *cmd);
+        else
+          rc = transact (fd, *cmd);
+        t1 = now_usec ();
+        check_result (*cmd, rc);
+        add_sample (st, t1 - t0);
+        st->allocs += counters->allocs - allocs;
+        st->bytes += counters->bytes - bytes;
+        ncommands++;
+      }
+  t1 = now_usec ();
+
+  if (ctx)
+    pinentry_ctx_release (ctx);
+  else
+    {
+      check_result ("BYE", transact (fd, "BYE"));
+      close (fd);
+      if (waitpid (pid, &status, 0) == (pid_t)-1
+          || !WIFEXITED (status) || WEXITSTATUS (status))
+        {
+          fprintf (stderr, PGM ": the server failed\n");
+          nfailures++;
+        }
+    }
+
+  printf ("%-18s %7s %9s %9s %9s %9s %8s %9s\n",
+          "command", "count", "p50[us]", "p90[us]", "p99[us]", "max[us]",
+          "allocs", "bytes");
+  for (st = stats; st; st = st->next)
+    {
+      qsort (st->samples, st->nsamples, sizeof *st->samples, cmp_double);
+      printf ("%-18s %7lu %9.1f %9.1f %9.1f %9.1f %8.1f %9.1f\n",
+              st->name, (unsigned long)st->nsamples,
+              percentile (st, 50), percentile (st, 90), percentile (st, 99),
+              st->samples[st->nsamples - 1],
+              (double)st->allocs / st->nsamples,
+              (double)st->bytes / st->nsamples);
+    }
+  printf ("%lu commands in %.3f s (%.0f commands/s)\n",
+          ncommands, (t1 - tstart) / 1e6,
+          ncommands / ((t1 - tstart) / 1e6));
+
+  if (nfailures)
+    {
+      fprintf (stderr, PGM ": %lu commands failed\n", nfailures);
+      return 1;
+    }
+  return 0;
+}
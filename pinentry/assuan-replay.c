@@ -0,0 +1,613 @@
+/* assuan-replay.c - Play back a recorded pinentry session
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of PINENTRY.
+ *
+ * PINENTRY is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PINENTRY is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* This program replays a session written by a pinentry run with the
+ * envvar PINENTRY_RECORD.  As in assuan-bench the server runs via
+ * pinentry_loop2 in a child process connected by a socketpair while
+ * the parent plays the part of gpg-agent.
+ *
+ * The client sends the recorded input lines, each after it has seen
+ * the response the original client waited for and after the same
+ * think time.  The frontend takes its answers from the record: for
+ * each GETPIN, CONFIRM or MESSAGE it runs the recorded quality
+ * inquiries and returns the recorded result at the recorded offsets.
+ * Redacted data is replaced by as many '0's as it had bytes.  With
+ * --speed all delays are divided by the given factor; 0 replays
+ * without any delays.
+ *
+ * The recorded and the replayed latency of each command are reported
+ * per command.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <assuan.h>
+
+#include "memory.h"
+#include "pinentry.h"
+
+#define PGM "assuan-replay"
+
+static int verbose;
+static double speed = 1.0;
+
+
+/* The recorded events.  T is in milliseconds.  */
+struct event_s
+{
+  double t;
+  int out;     /* Output of the pinentry.  */
+  char *line;
+};
+
+static struct event_s *events;
+static size_t nevents;
+
+
+/* Return true if LINE starts with the word WORD.  */
+static int
+has_word (const char *line, const char *word)
+{
+  size_t n = strlen (word);
+
+  return !strncmp (line, word, n) && (!line[n] || line[n] == ' ');
+}
+
+/* Return true if LINE ends a command.  */
+static int
+is_final (const char *line)
+{
+  return has_word (line, "OK") || has_word (line, "ERR");
+}
+
+/* Return true if the client waits for LINE before it sends again.  */
+static int
+is_response (const char *line)
+{
+  return is_final (line) || has_word (line, "INQUIRE");
+}
+
+/* Return true if the input LINE is a command and not inquiry data.  */
+static int
+is_command (const char *line)
+{
+  return !has_word (line, "D") && !has_word (line, "END")
+    && !has_word (line, "CAN");
+}
+
+/* Return true if the input LINE runs the frontend.  */
+static int
+is_interactive (const char *line)
+{
+  return has_word (line, "GETPIN") || has_word (line, "CONFIRM")
+    || has_word (line, "MESSAGE");
+}
+
+/* Return the length of a redacted item "[N]" in LINE after PREFIX or
+ * -1 if LINE does not start with PREFIX.  */
+static int
+redacted_length (const char *line, const char *prefix)
+{
+  size_t n = strlen (prefix);
+
+  if (strncmp (line, prefix, n))
+    return -1;
+  if (line[n] != '[')
+    return 0;
+  return atoi (line + n + 1);
+}
+
+
+/* Read session number SESSION from the record FNAME.  */
+static void
+read_record (const char *fname, int session)
+{
+  FILE *fp;
+  char line[ASSUAN_LINELENGTH + 100];
+  int cur = 0;
+  double t;
+  char dir;
+  int n;
+
+  fp = fopen (fname, "r");
+  if (!fp)
+    {
+      fprintf (stderr, PGM ": can't open '%s': %s\n", fname, strerror (errno));
+      exit (1);
+    }
+  while (fgets (line, sizeof line, fp))
+    {
+      line[strcspn (line, "\r\n")] = 0;
+      if (!strncmp (line, "# pinentry-record ", 18))
+        {
+          cur++;
+          continue;
+        }
+      if (!*line || *line == '#')
+        continue;
+      if (!cur)
+        cur = 1;  /* A record without header.  */
+      if (cur != session)
+        continue;
+
+      if (sscanf (line, "%lf %c %n", &t, &dir, &n) < 2
+          || (dir != '<' && dir != '>'))
+        {
+          fprintf (stderr, PGM ": invalid line '%s'\n", line);
+          exit (1);
+        }
+      events = realloc (events, (nevents + 1) * sizeof *events);
+      if (!events || !(events[nevents].line = strdup (line + n)))
+        {
+          fprintf (stderr, PGM ": out of core\n");
+          exit (1);
+        }
+      events[nevents].t = t;
+      events[nevents].out = dir == '>';
+      nevents++;
+    }
+  fclose (fp);
+  if (!nevents)
+    {
+      fprintf (stderr, PGM ": '%s' has no session %d\n", fname, session);
+      exit (1);
+    }
+}
+
+
+static double
+now_msec (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* Sleep until DELAY recorded milliseconds after BASE.  */
+static void
+sleep_after (double base, double delay)
+{
+  struct timespec ts;
+  double left;
+
+  if (!speed)
+    return;
+  left = base + delay / speed - now_msec ();
+  if (left <= 0)
+    return;
+  ts.tv_sec = left / 1e3;
+  ts.tv_nsec = (left - ts.tv_sec * 1e3) * 1e6;
+  while (nanosleep (&ts, &ts) && errno == EINTR)
+    ;
+}
+
+
+
+/* The frontend.  The Nth call handles the Nth interactive command of
+ * the record.  */
+static int
+replay_cmd_handler (pinentry_t pe)
+{
+  static size_t next;
+  static int nrequests;
+  char buffer[301];
+  struct event_s *req;
+  double base;
+  size_t i;
+  int n, pinlen = 0;
+  gpg_err_code_t ec;
+
+  for (; next < nevents; next++)
+    if (!events[next].out && is_interactive (events[next].line))
+      break;
+  if (next == nevents)
+    {
+      fprintf (stderr, PGM ": more requests than recorded\n");
+      pe->canceled = 1;
+      return -1;
+    }
+  req = events + next++;
+  nrequests++;
+
+  base = now_msec ();
+  for (i = next; i < nevents; i++)
+    {
+      if (!events[i].out)
+        continue;
+      if (is_final (events[i].line))
+        break;
+      if ((n = redacted_length (events[i].line, "INQUIRE QUALITY ")) >= 0)
+        {
+          if (n > (int)sizeof buffer - 1)
+            n = sizeof buffer - 1;
+          memset (buffer, 'x', n);
+          buffer[n] = 0;
+          sleep_after (base, events[i].t - req->t);
+          pinentry_inq_quality (pe, buffer, n);
+        }
+      else if ((n = redacted_length (events[i].line, "D ")) >= 0)
+        pinlen = n;
+    }
+  if (i == nevents)
+    {
+      pe->canceled = 1;
+      return -1;
+    }
+  sleep_after (base, events[i].t - req->t);
+  if (verbose)
+    fprintf (stderr, PGM ": request %d: %s\n", nrequests, events[i].line);
+
+  if (has_word (events[i].line, "ERR"))
+    {
+      ec = gpg_err_code (strtoul (events[i].line + 4, NULL, 10));
+      if (ec == GPG_ERR_CANCELED)
+        pe->canceled = 1;
+      else if (pe->pin || ec != GPG_ERR_NOT_CONFIRMED)
+        pe->specific_err = gpg_error (ec);
+      return pe->pin? -1 : 0;
+    }
+
+  if (!pe->pin)
+    return 1;  /* Confirmed.  */
+  if (!pinentry_setbufferlen (pe, pinlen + 1))
+    return -1;
+  memset (pe->pin, 'x', pinlen);
+  pe->pin[pinlen] = 0;
+  return pinlen;
+}
+
+pinentry_cmd_handler_t pinentry_cmd_handler = replay_cmd_handler;
+
+
+
+/* Client side I/O.  */
+static char readbuf[4096];
+static size_t readlen;
+
+static void
+write_line (int fd, const char *line)
+{
+  size_t n = strlen (line);
+  ssize_t nw;
+
+  while (n)
+    {
+      nw = write (fd, line, n);
+      if (nw < 0 && errno == EINTR)
+        continue;
+      if (nw < 0)
+        {
+          fprintf (stderr, PGM ": write failed: %s\n", strerror (errno));
+          exit (1);
+        }
+      line += nw;
+      n -= nw;
+    }
+}
+
+
+/* Read one line from FD into LINE of SIZE bytes.  */
+static void
+read_line (int fd, char *line, size_t size)
+{
+  char *nl;
+  ssize_t nr;
+  size_t n;
+
+  while (!(nl = memchr (readbuf, '\n', readlen)))
+    {
+      if (readlen == sizeof readbuf)
+        {
+          fprintf (stderr, PGM ": line too long\n");
+          exit (1);
+        }
+      nr = read (fd, readbuf + readlen, sizeof readbuf - readlen);
+      if (nr < 0 && errno == EINTR)
+        continue;
+      if (nr <= 0)
+        {
+          fprintf (stderr, PGM ": server closed the connection\n");
+          exit (1);
+        }
+      readlen += nr;
+    }
+
+  n = nl - readbuf;
+  if (n >= size)
+    n = size - 1;
+  memcpy (line, readbuf, n);
+  line[n] = 0;
+  readlen -= nl + 1 - readbuf;
+  memmove (readbuf, nl + 1, readlen);
+}
+
+
+
+/* Latencies per command name in milliseconds.  */
+struct stats_s
+{
+  struct stats_s *next;
+  char name[32];
+  unsigned long count;
+  double recorded;
+  double recorded_max;
+  double replayed;
+  double replayed_max;
+};
+
+static struct stats_s *stats;
+static struct stats_s **stats_tail = &stats;
+
+static struct stats_s *
+get_stats (const char *command)
+{
+  struct stats_s *st;
+  size_t n = strcspn (command, " ");
+
+  if (n >= sizeof st->name)
+    n = sizeof st->name - 1;
+  for (st = stats; st; st = st->next)
+    if (strlen (st->name) == n && !strncmp (st->name, command, n))
+      return st;
+
+  st = calloc (1, sizeof *st);
+  if (!st)
+    {
+      fprintf (stderr, PGM ": out of core\n");
+      exit (1);
+    }
+  memcpy (st->name, command, n);
+  *stats_tail = st;
+  stats_tail = &st->next;
+  return st;
+}
+
+static void
+add_sample (struct stats_s *st, double recorded, double replayed)
+{
+  st->count++;
+  st->recorded += recorded;
+  if (recorded > st->recorded_max)
+    st->recorded_max = recorded;
+  st->replayed += replayed;
+  if (replayed > st->replayed_max)
+    st->replayed_max = replayed;
+}
+
+
+/* The command which awaits its final response.  */
+static struct
+{
+  struct event_s *ev;
+  double sent;
+} pending;
+
+/* Read from FD until the response number WANT has arrived.  Returns
+ * the time the last response was read.  */
+static double
+read_responses (int fd, unsigned int want)
+{
+  static unsigned int seen;
+  static double last;
+  static size_t final;
+  char line[ASSUAN_LINELENGTH + 2];
+
+  while (seen < want)
+    {
+      read_line (fd, line, sizeof line);
+      if (verbose > 1)
+        fprintf (stderr, PGM ": <- %s\n", line);
+      if (!is_response (line))
+        continue;
+      seen++;
+      last = now_msec ();
+      if (!is_final (line) || !pending.ev)
+        continue;
+
+      /* Find the recorded final response of the pending command.  */
+      if (final < (size_t)(pending.ev - events))
+        final = pending.ev - events;
+      for (; final < nevents; final++)
+        if (events[final].out && is_final (events[final].line))
+          break;
+      if (final < nevents)
+        add_sample (get_stats (pending.ev->line),
+                    events[final].t - pending.ev->t, last - pending.sent);
+      final++;
+      pending.ev = NULL;
+    }
+  return last;
+}
+
+
+static void
+run_server (int fd)
+{
+  exit (pinentry_loop2 (fd, fd)? 1 : 0);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  int session = 1;
+  char line[ASSUAN_LINELENGTH + 2];
+  struct event_s *ev, *prev;
+  struct stats_s *st;
+  unsigned int responses = 0;
+  double base, tstart, trec;
+  int sv[2];
+  pid_t pid;
+  size_t i;
+  int n;
+
+  if (argc)
+    { argc--; argv++; }
+  while (argc && last_argc != argc)
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--"))
+        {
+          argc--; argv++;
+          break;
+        }
+      else if (!strcmp (*argv, "--help"))
+        {
+          fputs ("usage: " PGM " [options] RECORDFILE\n"
+                 "Options:\n"
+                 "  --speed F       divide all delays by F; 0 for none"
+                 " [1]\n"
+                 "  --session N     replay the Nth session of the file"
+                 " [1]\n"
+                 "  --verbose       print the result of each request\n"
+                 "  --debug         also print all received lines\n",
+                 stdout);
+          exit (0);
+        }
+      else if (!strcmp (*argv, "--verbose"))
+        {
+          verbose = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--debug"))
+        {
+          verbose = 2;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--speed") && argc > 1)
+        {
+          speed = atof (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--session") && argc > 1)
+        {
+          session = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strncmp (*argv, "--", 2))
+        {
+          fprintf (stderr, PGM ": unknown option '%s'\n", *argv);
+          exit (1);
+        }
+    }
+  if (argc != 1 || speed < 0)
+    {
+      fprintf (stderr, "usage: " PGM " [options] RECORDFILE\n");
+      exit (1);
+    }
+  read_record (*argv, session);
+
+  pinentry_init (PGM);
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv))
+    {
+      fprintf (stderr, PGM ": socketpair failed: %s\n", strerror (errno));
+      exit (1);
+    }
+
+  pid = fork ();
+  if (pid == (pid_t)-1)
+    {
+      fprintf (stderr, PGM ": fork failed: %s\n", strerror (errno));
+      exit (1);
+    }
+  if (!pid)
+    {
+      close (sv[0]);
+      run_server (sv[1]);
+    }
+  close (sv[1]);
+
+  /* Send each input line after the responses the original client had
+   * seen and the same think time.  */
+  tstart = base = now_msec ();
+  prev = NULL;
+  for (i = 0; i < nevents; i++)
+    {
+      ev = events + i;
+      if (ev->out)
+        {
+          if (is_response (ev->line))
+            {
+              responses++;
+              prev = ev;
+            }
+          continue;
+        }
+
+      if (responses)
+        base = read_responses (sv[0], responses);
+      sleep_after (base, ev->t - (prev? prev->t : 0));
+
+      if ((n = redacted_length (ev->line, "D ")) >= 0)
+        {
+          if (n > ASSUAN_LINELENGTH - 4)
+            n = ASSUAN_LINELENGTH - 4;
+          strcpy (line, "D ");
+          memset (line + 2, '0', n);
+          line[n + 2] = 0;
+        }
+      else if (has_word (ev->line, "OPTION")
+               && strstr (ev->line, "allow-external-password-cache"))
+        strcpy (line, "NOP");  /* Don't use the real password cache.  */
+      else
+        snprintf (line, sizeof line, "%s", ev->line);
+      if (verbose > 1)
+        fprintf (stderr, PGM ": -> %s\n", line);
+
+      if (is_command (line))
+        {
+          pending.ev = ev;
+          pending.sent = now_msec ();
+        }
+      write_line (sv[0], line);
+      write_line (sv[0], "\n");
+    }
+  read_responses (sv[0], responses);
+  close (sv[0]);
+  waitpid (pid, NULL, 0);
+
+  printf ("%-18s %7s %12s %12s %12s %12s\n",
+          "command", "count", "rec-avg[ms]", "rec-max[ms]",
+          "play-avg[ms]", "play-max[ms]");
+  for (st = stats; st; st = st->next)
+    printf ("%-18s %7lu %12.3f %12.3f %12.3f %12.3f\n",
+            st->name, st->count,
+            st->recorded / st->count, st->recorded_max,
+            st->replayed / st->count, st->replayed_max);
+  trec = events[nevents - 1].t - events[0].t;
+  printf ("session of %.3f s replayed in %.3f s\n",
+          trec / 1e3, (now_msec () - tstart) / 1e3);
+
+  return 0;
+}
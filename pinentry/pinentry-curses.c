@@ -944,6 +944,8 @@ dialog_run (pinentry_t pinentry, const char *tty_name, const char *tty_type)
       return -2;
     }
   dialog_switch_pos (&diag, confirm_mode? DIALOG_POS_OK : DIALOG_POS_PIN);
+  refresh ();
+  pinentry_timing ("dialog");
 
 #ifndef HAVE_DOSISH_SYSTEM
   wtimeout (stdscr, 70);
@@ -25,12 +25,20 @@
 #ifndef HAVE_W32CE_SYSTEM
 # include <errno.h>
 #endif
+#include <stddef.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <time.h>
 #ifndef HAVE_W32_SYSTEM
 # include <sys/utsname.h>
+# include <sys/socket.h>
+# include <sys/un.h>
+# include <netdb.h>
+# include <poll.h>
+# include <fcntl.h>
 #endif
 #ifndef HAVE_W32CE_SYSTEM
 # include <locale.h>
@@ -42,6 +50,10 @@
 #ifdef HAVE_W32CE_SYSTEM
 # include <windows.h>
 #endif
+#if defined(HAVE_PTHREAD) && defined(__GNUC__)
+# define PINENTRY_THREADS 1
+# include <pthread.h>
+#endif
 
 #undef WITH_UTF8_CONVERSION
 #if defined FALLBACK_CURSES || defined PINENTRY_CURSES || defined PINENTRY_GTK
@@ -68,12 +80,13 @@
 #define getpid() GetCurrentProcessId ()
 #endif
 
+#ifndef DIM
+# define DIM(v) (sizeof(v)/sizeof((v)[0]))
+#endif
+
 /* Keep the name of our program here. */
 static char this_pgmname[50];
 
-struct pinentry pinentry;
-
-
 static const char *flavor_flag;
 
 /* Because gtk_init removes the --display arg from the command lines
@@ -90,148 +103,444 @@ static int lc_ctype_unknown_warning;
 #endif
 
 
+/* The strings of the pinentry structure are not malloced one by one
+   but carved from the arenas of its context, so that a RESET can
+   release all of them at once.  Secrets are never stored here.  */
+struct string_arena_chunk_s
+{
+  struct string_arena_chunk_s *next;
+  size_t size;  /* Allocated size of DATA.  */
+  size_t used;  /* Number of bytes used in DATA.  */
+  char data[1];
+};
+typedef struct string_arena_chunk_s *string_arena_t;
+
+#define STRING_ARENA_CHUNKSIZE 1024
+
+
+/* Return LEN bytes from ARENA or NULL with ERRNO set on error.  */
+static char *
+arena_alloc (string_arena_t *arena, size_t len)
+{
+  struct string_arena_chunk_s *chunk = *arena;
+  char *p;
+
+  if (!chunk || chunk->size - chunk->used < len)
+    {
+      size_t size = len > STRING_ARENA_CHUNKSIZE? len : STRING_ARENA_CHUNKSIZE;
+
+      chunk = malloc (sizeof *chunk + size);
+      if (!chunk)
+        return NULL;
+      chunk->size = size;
+      chunk->used = 0;
+      chunk->next = *arena;
+      *arena = chunk;
+    }
+
+  p = chunk->data + chunk->used;
+  chunk->used += len;
+  return p;
+}
+
+
+/* Return a copy of the string S allocated from ARENA.  */
+static char *
+arena_strdup (string_arena_t *arena, const char *s)
+{
+  size_t n = strlen (s) + 1;
+  char *p;
+
+  p = arena_alloc (arena, n);
+  if (p)
+    memcpy (p, s, n);
+  return p;
+}
+
+
+/* Release all strings of ARENA.  If KEEP is set one chunk of the
+   standard size is kept for reuse.  */
+static void
+arena_release (string_arena_t *arena, int keep)
+{
+  struct string_arena_chunk_s *chunk, *next;
+  struct string_arena_chunk_s *spare = NULL;
+
+  for (chunk = *arena; chunk; chunk = next)
+    {
+      next = chunk->next;
+      if (keep && !spare && chunk->size == STRING_ARENA_CHUNKSIZE)
+        spare = chunk;
+      else
+        free (chunk);
+    }
+
+  if (spare)
+    {
+      spare->next = NULL;
+      spare->used = 0;
+    }
+  *arena = spare;
+}
+
+
+/* Runtime statistics reported by GETINFO stats.  */
+#define STATS_MAX_COMMANDS 32
+
+/* The upper bounds in milliseconds of the buckets of the GETPIN
+   latency histogram.  An extra bucket takes the rest.  */
+static const unsigned int getpin_buckets[] =
+  { 100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000 };
+
+struct stats_s
+{
+  struct
+  {
+    char name[16];
+    unsigned long count;
+  } commands[STATS_MAX_COMMANDS];
+  int ncommands;
+  unsigned long other_commands;  /* Commands not fitting the table.  */
+
+  double dialog_shown;    /* When the current dialog was shown or 0.  */
+  unsigned long getpins;  /* GETPINs which ran the dialog.  */
+  unsigned long getpin_hist[DIM (getpin_buckets) + 1];
+  double getpin_sum;      /* All times are in microseconds.  */
+
+  unsigned long quality;
+  unsigned long quality_errors;
+  double quality_sum;
+  double quality_max;
+
+  unsigned long cache_hits;
+  unsigned long cache_misses;
+  unsigned long cache_errors;
+};
+
+
+/* The time taken by the parts of an interactive request.  */
+struct request_timing_s
+{
+  double cache;                /* Password cache lookup.  */
+  double start;                /* Start of the handler or 0.  */
+  unsigned long quality;       /* STATS.QUALITY at START.  */
+  double quality_sum;          /* STATS.QUALITY_SUM at START.  */
+};
+
+
+/* The GETPIN, CONFIRM or MESSAGE request being processed.  */
+struct request_s
+{
+  struct request_timing_s timing;
+  int set_prompt;         /* GETPIN set the default prompt.  */
+  int getpin;             /* The handler of GETPIN is running.  */
+
+  /* Set while the command handler has deferred its result; see
+     pinentry_command_done.  */
+  gpg_error_t (*done) (pinentry_ctx_t ctx, int result);
+};
+
+
+/* Keystroke latency measurement.  A frontend asked for it by
+   pinentry_keybench_keys types synthetic keys into its entry and
+   marks when each key was queued and when the entry was repainted.
+   The quality inquiry is timed by pinentry_inq_quality.  The samples
+   are sent as KEYBENCH status lines at the end of GETPIN.  */
+#define KEYBENCH_MAX 256
+
+struct keybench_s
+{
+  double key;      /* All times are in microseconds.  */
+  double inquire;
+  double reply;
+  double paint;
+};
+
+
+#ifndef HAVE_W32_SYSTEM
+/* Information about the owner process which we gather once when the
+ * owner is set and keep until it changes.  */
+struct owner_info_s
+{
+  unsigned long pid;
+  int uid;
+  char *host;   /* Malloced copy of the owner's host or NULL.  */
+  char *title;  /* Malloced title derived from the above or NULL.  */
+};
+#endif /*!HAVE_W32_SYSTEM*/
+
+
+typedef gpg_error_t (*command_handler_t) (pinentry_ctx_t ctx, char *line);
+
+static command_handler_t find_command (const char *name);
+#ifndef NDEBUG
+static int option_table_sorted (void);
+#endif
+
+
+/* The state of a session.  The Assuan server works on DEFAULT_CTX;
+   a program embedding the library creates its own contexts with
+   pinentry_ctx_new.  */
+struct pinentry_ctx_s
+{
+  /* The request seen by the command handler.  This must be the first
+     member so that ctx_of can find the context from it.  */
+  struct pinentry pe;
+
+  /* The command handler or NULL to use PINENTRY_CMD_HANDLER.  */
+  pinentry_cmd_handler_t handler;
+
+  /* Where the output goes if there is no Assuan connection.  */
+  struct pinentry_ctx_cbs cbs;
+  void *opaque;
+
+  /* The Assuan connection of the server or NULL.  */
+  assuan_context_t assuan;
+
+  /* Strings set by OPTION or the command line which are kept across a
+     RESET.  SESSION_USED counts the bytes stored there by
+     session_strndup and SESSION_DEAD those of the values which have
+     since been replaced.  */
+  string_arena_t session_strings;
+  size_t session_used;
+  size_t session_dead;
+
+  /* Strings set by the SETxxx commands which are released by a RESET
+     and at the end of a connection.  */
+  string_arena_t request_strings;
+
+  struct stats_s stats;
+  struct request_s request;
+
+  /* The handler of the command being dispatched.  */
+  command_handler_t current_command;
+
+#ifndef HAVE_W32_SYSTEM
+  struct owner_info_s owner_info;
+#endif
+
+  /* The keystroke samples of the current GETPIN.  */
+  struct keybench_s keybench[KEYBENCH_MAX];
+  int keybench_count;
+};
+
+static struct pinentry_ctx_s default_ctx;
+
+/* The context whose command handler is running in this thread.
+   pinentry_timing marks the dialog as shown in it.  Each thread may
+   run the requests of its own contexts.  */
+#ifdef PINENTRY_THREADS
+static __thread pinentry_ctx_t running_ctx;
+#else
+static pinentry_ctx_t running_ctx;
+#endif
+
+
+/* Return the context of the pinentry PIN.  */
+static pinentry_ctx_t
+ctx_of (pinentry_t pin)
+{
+  return (pinentry_ctx_t)pin;
+}
+
+
+/* Store a copy of the first LEN bytes of S, which may not be shorter,
+   from the session arena of CTX at *FIELD.  Returns the copy or NULL
+   with ERRNO set on error.  */
+static char *
+session_strndup (pinentry_ctx_t ctx, char **field, const char *s, size_t len)
+{
+  char *p;
+
+  p = arena_alloc (&ctx->session_strings, len + 1);
+  if (!p)
+    return NULL;
+  memcpy (p, s, len);
+  p[len] = 0;
+
+  if (*field)
+    ctx->session_dead += strlen (*field) + 1;
+  ctx->session_used += len + 1;
+  *field = p;
+  return p;
+}
+
+
+static char *
+session_strdup (pinentry_ctx_t ctx, char **field, const char *s)
+{
+  return session_strndup (ctx, field, s, strlen (s));
+}
+
+
+/* Copy the session strings still referenced by the pinentry of CTX to
+   a fresh arena and release the old one once the values replaced by
+   later OPTIONs take up more room than the live ones.  This keeps the
+   arena from growing over the life of the process while a RESET
+   usually does not copy anything.  On error the old arena is
+   kept.  */
+static void
+compact_session_strings (pinentry_ctx_t ctx)
+{
+  pinentry_t pe = &ctx->pe;
+  char **fields[] =
+    {
+      &pe->display, &pe->ttyname, &pe->ttytype, &pe->ttyalert,
+      &pe->lc_ctype, &pe->lc_messages, &pe->touch_file, &pe->owner_host,
+      &pe->default_ok, &pe->default_cancel, &pe->default_prompt,
+      &pe->default_pwmngr, &pe->default_cf_visi, &pe->default_tt_visi,
+      &pe->default_tt_hide, &pe->invisible_char
+    };
+  char *copies[DIM (fields)];
+  string_arena_t fresh = NULL;
+  size_t live = ctx->session_used - ctx->session_dead;
+  unsigned int i;
+
+  if (ctx->session_dead < STRING_ARENA_CHUNKSIZE || ctx->session_dead <= live)
+    return;
+
+  for (i = 0; i < DIM (fields); i++)
+    {
+      copies[i] = *fields[i]? arena_strdup (&fresh, *fields[i]) : NULL;
+      if (*fields[i] && !copies[i])
+        {
+          arena_release (&fresh, 0);
+          return;
+        }
+    }
+
+  for (i = 0; i < DIM (fields); i++)
+    *fields[i] = copies[i];
+  arena_release (&ctx->session_strings, 0);
+  ctx->session_strings = fresh;
+  ctx->session_used = live;
+  ctx->session_dead = 0;
+}
+
+
 static void
-pinentry_reset (int use_defaults)
+pinentry_reset (pinentry_ctx_t ctx, int use_defaults)
 {
+  pinentry_t pe = &ctx->pe;
+
   /* GPG Agent sets these options once when it starts the pinentry.
      Don't reset them.  */
-  int grab = pinentry.grab;
-  char *ttyname = pinentry.ttyname;
-  char *ttytype = pinentry.ttytype;
-  char *ttyalert = pinentry.ttyalert;
-  char *lc_ctype = pinentry.lc_ctype;
-  char *lc_messages = pinentry.lc_messages;
-  int allow_external_password_cache = pinentry.allow_external_password_cache;
-  char *default_ok = pinentry.default_ok;
-  char *default_cancel = pinentry.default_cancel;
-  char *default_prompt = pinentry.default_prompt;
-  char *default_pwmngr = pinentry.default_pwmngr;
-  char *default_cf_visi = pinentry.default_cf_visi;
-  char *default_tt_visi = pinentry.default_tt_visi;
-  char *default_tt_hide = pinentry.default_tt_hide;
-  char *touch_file = pinentry.touch_file;
-  unsigned long owner_pid = pinentry.owner_pid;
-  int owner_uid = pinentry.owner_uid;
-  char *owner_host = pinentry.owner_host;
+  int grab = pe->grab;
+  int timing_status = pe->timing_status;
+  char *ttyname = pe->ttyname;
+  char *ttytype = pe->ttytype;
+  char *ttyalert = pe->ttyalert;
+  char *lc_ctype = pe->lc_ctype;
+  char *lc_messages = pe->lc_messages;
+  int allow_external_password_cache = pe->allow_external_password_cache;
+  char *default_ok = pe->default_ok;
+  char *default_cancel = pe->default_cancel;
+  char *default_prompt = pe->default_prompt;
+  char *default_pwmngr = pe->default_pwmngr;
+  char *default_cf_visi = pe->default_cf_visi;
+  char *default_tt_visi = pe->default_tt_visi;
+  char *default_tt_hide = pe->default_tt_hide;
+  char *touch_file = pe->touch_file;
+  unsigned long owner_pid = pe->owner_pid;
+  int owner_uid = pe->owner_uid;
+  char *owner_host = pe->owner_host;
 
   /* These options are set from the command line.  Don't reset
      them.  */
-  int debug = pinentry.debug;
-  char *display = pinentry.display;
-  int parent_wid = pinentry.parent_wid;
+  int debug = pe->debug;
+  char *display = pe->display;
+  unsigned long parent_wid = pe->parent_wid;
 
-  pinentry_color_t color_fg = pinentry.color_fg;
-  int color_fg_bright = pinentry.color_fg_bright;
-  pinentry_color_t color_bg = pinentry.color_bg;
-  pinentry_color_t color_so = pinentry.color_so;
-  int color_so_bright = pinentry.color_so_bright;
+  pinentry_color_t color_fg = pe->color_fg;
+  int color_fg_bright = pe->color_fg_bright;
+  pinentry_color_t color_bg = pe->color_bg;
+  pinentry_color_t color_so = pe->color_so;
+  int color_so_bright = pe->color_so_bright;
 
-  int timeout = pinentry.timeout;
+  int timeout = pe->timeout;
 
-  char *invisible_char = pinentry.invisible_char;
+  char *invisible_char = pe->invisible_char;
 
 
   /* Free any allocated memory.  */
   if (use_defaults)
     {
-      free (pinentry.ttyname);
-      free (pinentry.ttytype);
-      free (pinentry.ttyalert);
-      free (pinentry.lc_ctype);
-      free (pinentry.lc_messages);
-      free (pinentry.default_ok);
-      free (pinentry.default_cancel);
-      free (pinentry.default_prompt);
-      free (pinentry.default_pwmngr);
-      free (pinentry.default_cf_visi);
-      free (pinentry.default_tt_visi);
-      free (pinentry.default_tt_hide);
-      free (pinentry.touch_file);
-      free (pinentry.owner_host);
-      free (pinentry.display);
-    }
-
-  free (pinentry.title);
-  free (pinentry.description);
-  free (pinentry.error);
-  free (pinentry.prompt);
-  free (pinentry.ok);
-  free (pinentry.notok);
-  free (pinentry.cancel);
-  secmem_free (pinentry.pin);
-  free (pinentry.repeat_passphrase);
-  free (pinentry.repeat_error_string);
-  free (pinentry.quality_bar);
-  free (pinentry.quality_bar_tt);
-  free (pinentry.keyinfo);
-  free (pinentry.specific_err_info);
+      arena_release (&ctx->session_strings, 1);
+      ctx->session_used = ctx->session_dead = 0;
+      invisible_char = NULL;
+    }
+  arena_release (&ctx->request_strings, 1);
+  secmem_free (pe->pin);
+  free (pe->specific_err_info);
 
   /* Reset the pinentry structure.  */
-  memset (&pinentry, 0, sizeof (pinentry));
+  memset (pe, 0, sizeof *pe);
 
   /* Restore options without a default we want to preserve.  */
-  pinentry.invisible_char = invisible_char;
+  pe->invisible_char = invisible_char;
 
   /* Restore other options or set defaults.  */
 
   if (use_defaults)
     {
       /* Pinentry timeout in seconds.  */
-      pinentry.timeout = 60;
+      pe->timeout = 60;
 
       /* Global grab.  */
-      pinentry.grab = 1;
+      pe->grab = 1;
 
-      pinentry.color_fg = PINENTRY_COLOR_DEFAULT;
-      pinentry.color_fg_bright = 0;
-      pinentry.color_bg = PINENTRY_COLOR_DEFAULT;
-      pinentry.color_so = PINENTRY_COLOR_DEFAULT;
-      pinentry.color_so_bright = 0;
+      pe->color_fg = PINENTRY_COLOR_DEFAULT;
+      pe->color_fg_bright = 0;
+      pe->color_bg = PINENTRY_COLOR_DEFAULT;
+      pe->color_so = PINENTRY_COLOR_DEFAULT;
+      pe->color_so_bright = 0;
 
-      pinentry.owner_uid = -1;
+      pe->owner_uid = -1;
     }
   else /* Restore the options.  */
     {
-      pinentry.grab = grab;
-      pinentry.ttyname = ttyname;
-      pinentry.ttytype = ttytype;
-      pinentry.ttyalert = ttyalert;
-      pinentry.lc_ctype = lc_ctype;
-      pinentry.lc_messages = lc_messages;
-      pinentry.allow_external_password_cache = allow_external_password_cache;
-      pinentry.default_ok = default_ok;
-      pinentry.default_cancel = default_cancel;
-      pinentry.default_prompt = default_prompt;
-      pinentry.default_pwmngr = default_pwmngr;
-      pinentry.default_cf_visi = default_cf_visi;
-      pinentry.default_tt_visi = default_tt_visi;
-      pinentry.default_tt_hide = default_tt_hide;
-      pinentry.touch_file = touch_file;
-      pinentry.owner_pid = owner_pid;
-      pinentry.owner_uid = owner_uid;
-      pinentry.owner_host = owner_host;
-
-      pinentry.debug = debug;
-      pinentry.display = display;
-      pinentry.parent_wid = parent_wid;
-
-      pinentry.color_fg = color_fg;
-      pinentry.color_fg_bright = color_fg_bright;
-      pinentry.color_bg = color_bg;
-      pinentry.color_so = color_so;
-      pinentry.color_so_bright = color_so_bright;
-
-      pinentry.timeout = timeout;
+      pe->grab = grab;
+      pe->timing_status = timing_status;
+      pe->ttyname = ttyname;
+      pe->ttytype = ttytype;
+      pe->ttyalert = ttyalert;
+      pe->lc_ctype = lc_ctype;
+      pe->lc_messages = lc_messages;
+      pe->allow_external_password_cache = allow_external_password_cache;
+      pe->default_ok = default_ok;
+      pe->default_cancel = default_cancel;
+      pe->default_prompt = default_prompt;
+      pe->default_pwmngr = default_pwmngr;
+      pe->default_cf_visi = default_cf_visi;
+      pe->default_tt_visi = default_tt_visi;
+      pe->default_tt_hide = default_tt_hide;
+      pe->touch_file = touch_file;
+      pe->owner_pid = owner_pid;
+      pe->owner_uid = owner_uid;
+      pe->owner_host = owner_host;
+
+      pe->debug = debug;
+      pe->display = display;
+      pe->parent_wid = parent_wid;
+
+      pe->color_fg = color_fg;
+      pe->color_fg_bright = color_fg_bright;
+      pe->color_bg = color_bg;
+      pe->color_so = color_so;
+      pe->color_so_bright = color_so_bright;
+
+      pe->timeout = timeout;
+
+      compact_session_strings (ctx);
     }
 }
 
 static gpg_error_t
 pinentry_assuan_reset_handler (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
   (void)line;
 
-  pinentry_reset (0);
+  pinentry_reset (assuan_get_pointer (ctx), 0);
 
   return 0;
 }
@@ -410,93 +719,165 @@ copy_and_escape (char *buffer, const void *text, size_t textlen)
 
 
 
-/* Return a malloced copy of the commandline for PID.  If this is not
- * possible NULL is returned.  */
 #ifndef HAVE_W32_SYSTEM
+/* Read the file NAME relative to the directory DIRFD into BUFFER of
+ * SIZE bytes using a single read.  The result is always Nul
+ * terminated.  Returns the number of bytes read or -1 on error.  */
+static ssize_t
+read_proc_file (int dirfd, const char *name, char *buffer, size_t size)
+{
+  ssize_t n;
+  int fd;
+
+  fd = openat (dirfd, name, O_RDONLY);
+  if (fd == -1)
+    return -1;
+  do
+    n = read (fd, buffer, size - 1);
+  while (n == -1 && errno == EINTR);
+  close (fd);
+  if (n < 0)
+    return -1;
+  buffer[n] = 0;
+  return n;
+}
+
+
+/* Return a malloced copy of the commandline of the process with the
+ * /proc directory DIRFD.  If this is not possible NULL is
+ * returned.  */
 static char *
-get_cmdline (unsigned long pid)
+get_cmdline (int dirfd)
 {
   char buffer[200];
-  FILE *fp;
-  size_t i, n;
-
-  snprintf (buffer, sizeof buffer, "/proc/%lu/cmdline", pid);
-  buffer[sizeof buffer - 1] = 0;
+  ssize_t i, n;
 
-  fp = fopen (buffer, "rb");
-  if (!fp)
-    return NULL;
-  n = fread (buffer, 1, sizeof buffer - 1, fp);
-  if (n < sizeof buffer -1 && ferror (fp))
-    {
-      /* Some error occurred.  */
-      fclose (fp);
-      return NULL;
-    }
-  fclose (fp);
-  if (n == 0)
+  n = read_proc_file (dirfd, "cmdline", buffer, sizeof buffer);
+  if (n <= 0)
     return NULL;
   /* Arguments are delimited by Nuls.  We should do proper quoting but
    * that can be a bit complicated, thus we simply replace the Nuls by
    * spaces.  */
-  for (i=0; i < n; i++)
-    if (!buffer[i] && i < n-1)
+  for (i=0; i < n-1; i++)
+    if (!buffer[i])
       buffer[i] = ' ';
-  buffer[i] = 0; /* Make sure the last byte is the string terminator.  */
 
   return strdup (buffer);
 }
-#endif /*!HAVE_W32_SYSTEM*/
 
 
-/* Atomically ask the kernel for information about process PID.
- * Return a malloc'ed copy of the process name as long as the process
- * uid matches UID.  If it cannot determine that the process has uid
- * UID, it returns NULL.
+/* Ask the kernel for information about the process with the /proc
+ * directory DIRFD.  Return a malloc'ed copy of the process name as
+ * long as the process uid matches UID.  If it cannot determine that
+ * the process has uid UID, it returns NULL.
  *
  * This is not as informative as get_cmdline, but it verifies that the
  * process does belong to the user in question.
  */
-#ifndef HAVE_W32_SYSTEM
 static char *
-get_pid_name_for_uid (unsigned long pid, int uid)
+get_pid_name_for_uid (int dirfd, int uid)
 {
-  char buffer[400];
-  FILE *fp;
-  size_t end, n;
-  char *uidstr;
+  char buffer[2048];
+  char *line, *next, *name = NULL;
+  int gotuid = 0;
 
-  snprintf (buffer, sizeof buffer, "/proc/%lu/status", pid);
-  buffer[sizeof buffer - 1] = 0;
-
-  fp = fopen (buffer, "rb");
-  if (!fp)
+  if (read_proc_file (dirfd, "status", buffer, sizeof buffer) <= 0)
     return NULL;
-  n = fread (buffer, 1, sizeof buffer - 1, fp);
-  if (n < sizeof buffer -1 && ferror (fp))
+
+  /* The file consists of "Key:\tValue" lines.  */
+  for (line = buffer; line && *line && !(name && gotuid); line = next)
     {
-      /* Some error occurred.  */
-      fclose (fp);
-      return NULL;
+      next = strchr (line, '\n');
+      if (next)
+        *next++ = 0;
+
+      if (!strncmp (line, "Name:\t", 6))
+        name = line + 6;
+      else if (!strncmp (line, "Uid:\t", 5))
+        {
+          if (atoi (line + 5) != uid)
+            return NULL;
+          gotuid = 1;
+        }
     }
-  fclose (fp);
-  if (n == 0)
+  if (!name || !gotuid)
     return NULL;
-  /* Fixme: Is it specified that "Name" is always the first line?  For
-   * robustness I would prefer to have a real parser here. -wk  */
-  if (strncmp (buffer, "Name:\t", 6))
-    return NULL;
-  end = strcspn (buffer + 6, "\n") + 6;
-  buffer[end] = 0;
 
-  /* check that uid matches what we expect */
-  uidstr = strstr (buffer + end + 1, "\nUid:\t");
-  if (!uidstr)
-    return NULL;
-  if (atoi (uidstr + 6) != uid)
-    return NULL;
+  return strdup (name);
+}
+
+
+/* Build the title for the owner described by PE and store it in the
+ * OWNER_INFO of its context.  Both files of the process are read via the same
+ * directory descriptor so that they describe the same process even
+ * if the PID is reused in between.  */
+static void
+update_owner_info (pinentry_t pe)
+{
+  char buf[200];
+  struct utsname utsbuf;
+  char *pidname = NULL;
+  char *cmdline = NULL;
+  int dirfd;
+  struct owner_info_s *oi = &ctx_of (pe)->owner_info;
+
+  free (oi->host);
+  free (oi->title);
+  oi->pid = pe->owner_pid;
+  oi->uid = pe->owner_uid;
+  oi->host = pe->owner_host? strdup (pe->owner_host) : NULL;
+  oi->title = NULL;
+
+  if (!pe->owner_pid)
+    return;
+
+  if (pe->owner_host &&
+      !uname (&utsbuf) &&
+      !strcmp (utsbuf.nodename, pe->owner_host))
+    {
+      snprintf (buf, sizeof buf, "/proc/%lu", pe->owner_pid);
+      buf[sizeof buf - 1] = 0;
+      dirfd = open (buf, O_RDONLY | O_DIRECTORY);
+      if (dirfd != -1)
+        {
+          pidname = get_pid_name_for_uid (dirfd, pe->owner_uid);
+          if (pidname)
+            cmdline = get_cmdline (dirfd);
+          close (dirfd);
+        }
+    }
+
+  if (pe->owner_host && (cmdline || pidname))
+    snprintf (buf, sizeof buf, "[%lu]@%s (%s)",
+              pe->owner_pid, pe->owner_host, cmdline ? cmdline : pidname);
+  else if (pe->owner_host)
+    snprintf (buf, sizeof buf, "[%lu]@%s",
+              pe->owner_pid, pe->owner_host);
+  else
+    snprintf (buf, sizeof buf, "[%lu] <unknown host>",
+              pe->owner_pid);
+  buf[sizeof buf - 1] = 0;
+  free (pidname);
+  free (cmdline);
+  oi->title = strdup (buf);
+}
 
-  return strdup (buffer + 6);
+
+/* Return the cached owner title for PE; refresh it if the owner
+ * changed since it was computed.  */
+static const char *
+get_owner_title (pinentry_t pe)
+{
+  struct owner_info_s *oi = &ctx_of (pe)->owner_info;
+
+  if (oi->pid != pe->owner_pid
+      || oi->uid != pe->owner_uid
+      || !oi->host != !pe->owner_host
+      || (pe->owner_host && strcmp (oi->host, pe->owner_host))
+      || !oi->title)
+    update_owner_info (pe);
+
+  return oi->title;
 }
 #endif /*!HAVE_W32_SYSTEM*/
 
@@ -514,33 +895,9 @@ pinentry_get_title (pinentry_t pe)
 #ifndef HAVE_W32_SYSTEM
   else if (pe->owner_pid)
     {
-      char buf[200];
-      struct utsname utsbuf;
-      char *pidname = NULL;
-      char *cmdline = NULL;
-
-      if (pe->owner_host &&
-          !uname (&utsbuf) && utsbuf.nodename &&
-          !strcmp (utsbuf.nodename, pe->owner_host))
-        {
-          pidname = get_pid_name_for_uid (pe->owner_pid, pe->owner_uid);
-          if (pidname)
-            cmdline = get_cmdline (pe->owner_pid);
-        }
+      const char *s = get_owner_title (pe);
 
-      if (pe->owner_host && (cmdline || pidname))
-        snprintf (buf, sizeof buf, "[%lu]@%s (%s)",
-                  pe->owner_pid, pe->owner_host, cmdline ? cmdline : pidname);
-      else if (pe->owner_host)
-        snprintf (buf, sizeof buf, "[%lu]@%s",
-                  pe->owner_pid, pe->owner_host);
-      else
-        snprintf (buf, sizeof buf, "[%lu] <unknown host>",
-                  pe->owner_pid);
-      buf[sizeof buf - 1] = 0;
-      free (pidname);
-      free (cmdline);
-      title = strdup (buf);
+      title = s? strdup (s) : NULL;
     }
 #endif /*!HAVE_W32_SYSTEM*/
   else
@@ -550,96 +907,552 @@ pinentry_get_title (pinentry_t pe)
 }
 
 
-/* Run a quality inquiry for PASSPHRASE of LENGTH.  (We need LENGTH
-   because not all backends might be able to return a proper
-   C-string.).  Returns: A value between -100 and 100 to give an
-   estimate of the passphrase's quality.  Negative values are use if
-   the caller won't even accept that passphrase.  Note that we expect
-   just one data line which should not be escaped in any represent a
-   numeric signed decimal value.  Extra data is currently ignored but
-   should not be send at all.  */
-int
-pinentry_inq_quality (pinentry_t pin, const char *passphrase, size_t length)
+/* Return a timestamp in microseconds.  On W32 this is the time since
+   the start of the process, elsewhere the time since boot, which is
+   what the start time in /proc/self/stat is measured against.  */
+static double
+get_usec_time (void)
 {
-  assuan_context_t ctx = pin->ctx_assuan;
-  const char prefix[] = "INQUIRE QUALITY ";
-  char *command;
-  char *line;
-  size_t linelen;
-  int gotvalue = 0;
-  int value = 0;
-  int rc;
+#ifdef HAVE_W32_SYSTEM
+  return (double)clock () * 1e6 / CLOCKS_PER_SEC;
+#else
+  struct timespec ts;
+
+# ifdef CLOCK_BOOTTIME
+  if (!clock_gettime (CLOCK_BOOTTIME, &ts))
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+# endif
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+#endif
+}
 
-  if (!ctx)
-    return 0; /* Can't run the callback.  */
 
-  if (length > 300)
-    length = 300;  /* Limit so that it definitely fits into an Assuan
-                      line.  */
+int
+pinentry_keybench_keys (void)
+{
+  const char *s = getenv ("PINENTRY_KEYBENCH");
+  int n;
+
+  n = s? atoi (s) : 0;
+  if (n < 0)
+    n = 0;
+  else if (n > KEYBENCH_MAX)
+    n = KEYBENCH_MAX;
+  return n;
+}
 
-  command = secmem_malloc (strlen (prefix) + 3*length + 1);
-  if (!command)
-    return 0;
-  strcpy (command, prefix);
-  copy_and_escape (command + strlen(command), passphrase, length);
-  rc = assuan_write_line (ctx, command);
-  secmem_free (command);
-  if (rc)
-    {
-      fprintf (stderr, "ASSUAN WRITE LINE failed: rc=%d\n", rc);
-      return 0;
-    }
 
-  for (;;)
-    {
-      do
-        {
-          rc = assuan_read_line (ctx, &line, &linelen);
-          if (rc)
-            {
-              fprintf (stderr, "ASSUAN READ LINE failed: rc=%d\n", rc);
-              return 0;
-            }
-        }
-      while (*line == '#' || !linelen);
-      if (line[0] == 'E' && line[1] == 'N' && line[2] == 'D'
-          && (!line[3] || line[3] == ' '))
-        break; /* END command received*/
-      if (line[0] == 'C' && line[1] == 'A' && line[2] == 'N'
-          && (!line[3] || line[3] == ' '))
-        break; /* CAN command received*/
-      if (line[0] == 'E' && line[1] == 'R' && line[2] == 'R'
-          && (!line[3] || line[3] == ' '))
-        break; /* ERR command received*/
-      if (line[0] != 'D' || line[1] != ' ' || linelen < 3 || gotvalue)
-        continue;
-      gotvalue = 1;
-      value = atoi (line+2);
+int
+pinentry_keybench_mark (pinentry_keybench_t what)
+{
+  pinentry_ctx_t ctx = running_ctx? running_ctx : &default_ctx;
+  struct keybench_s *kb;
+
+  switch (what)
+    {
+    case PINENTRY_KEYBENCH_KEY:
+      if (ctx->keybench_count == KEYBENCH_MAX)
+        return 0;
+      kb = ctx->keybench + ctx->keybench_count++;
+      memset (kb, 0, sizeof *kb);
+      kb->key = get_usec_time ();
+      return 1;
+
+    case PINENTRY_KEYBENCH_PAINT:
+      if (!ctx->keybench_count)
+        return 0;
+      kb = ctx->keybench + ctx->keybench_count - 1;
+      if (kb->paint)
+        return 0;
+      kb->paint = get_usec_time ();
+      return 1;
     }
-  if (value < -100)
-    value = -100;
-  else if (value > 100)
-    value = 100;
-
-  return value;
+  return 0;
 }
 
 
+/* Send LENGTH bytes at BUFFER as data to the client of CTX.  With
+   BUFFER NULL the data sent so far is flushed.  */
+static gpg_error_t
+ctx_send_data (pinentry_ctx_t ctx, const void *buffer, size_t length)
+{
+  if (ctx->assuan)
+    return assuan_send_data (ctx->assuan, buffer, length);
+  if (ctx->cbs.data && buffer)
+    return ctx->cbs.data (ctx->opaque, buffer, length);
+  return 0;
+}
+
 
-/* Try to make room for at least LEN bytes in the pinentry.  Returns
-   new buffer on success and 0 on failure or when the old buffer is
-   sufficient.  */
-char *
-pinentry_setbufferlen (pinentry_t pin, int len)
+/* Send the status line KEYWORD ARGS to the client of CTX.  */
+static gpg_error_t
+ctx_write_status (pinentry_ctx_t ctx, const char *keyword, const char *args)
 {
-  char *newp;
+  if (ctx->assuan)
+    return assuan_write_status (ctx->assuan, keyword, args);
+  if (ctx->cbs.status)
+    return ctx->cbs.status (ctx->opaque, keyword, args);
+  return 0;
+}
 
-  if (pin->pin_len)
-    assert (pin->pin);
-  else
-    assert (!pin->pin);
 
-  if (len < 2048)
+/* Send the keystroke samples as status lines with the key number and
+   the delays in microseconds from the key to the inquiry, its reply
+   and the repaint.  A delay is -1 if the event did not happen.  */
+static void
+keybench_report (pinentry_ctx_t ctx)
+{
+  struct keybench_s *kb;
+  char buffer[100];
+  int i;
+
+  for (i = 0; i < ctx->keybench_count; i++)
+    {
+      kb = ctx->keybench + i;
+      snprintf (buffer, sizeof buffer, "%d %.0f %.0f %.0f", i + 1,
+                kb->inquire? kb->inquire - kb->key : -1,
+                kb->reply? kb->reply - kb->key : -1,
+                kb->paint? kb->paint - kb->key : -1);
+      ctx_write_status (ctx, "KEYBENCH", buffer);
+    }
+  ctx->keybench_count = 0;
+}
+
+
+static void
+stats_count_command (pinentry_ctx_t ctx, const char *command)
+{
+  int i;
+
+  for (i = 0; i < ctx->stats.ncommands; i++)
+    if (!strcmp (ctx->stats.commands[i].name, command))
+      {
+        ctx->stats.commands[i].count++;
+        return;
+      }
+
+  if (ctx->stats.ncommands == STATS_MAX_COMMANDS
+      || strlen (command) >= sizeof ctx->stats.commands[0].name)
+    {
+      ctx->stats.other_commands++;
+      return;
+    }
+  strcpy (ctx->stats.commands[i].name, command);
+  ctx->stats.commands[i].count = 1;
+  ctx->stats.ncommands++;
+}
+
+
+/* Account for a GETPIN dialog which started at START.  The latency is
+   taken from when the dialog was shown if the frontend marked that.  */
+static void
+stats_count_getpin (pinentry_ctx_t ctx, double start)
+{
+  double latency;
+  unsigned int i;
+
+  if (ctx->stats.dialog_shown)
+    start = ctx->stats.dialog_shown;
+  latency = get_usec_time () - start;
+
+  for (i = 0; i < DIM (getpin_buckets); i++)
+    if (latency < getpin_buckets[i] * 1e3)
+      break;
+  ctx->stats.getpin_hist[i]++;
+  ctx->stats.getpins++;
+  ctx->stats.getpin_sum += latency;
+}
+
+
+/* Start-up timing.  If the envvar PINENTRY_TIMING is set, each phase
+   marked with pinentry_timing is printed with the time since the
+   start of the process: to stderr if the value is "1" and appended to
+   the file it names otherwise.  The output is for the whole process
+   and shared by all threads.  */
+#define TIMING_MAX 32
+
+static FILE *timing_fp;
+static double timing_start;
+static const char *timing_seen[TIMING_MAX];
+static int timing_nseen;
+
+#ifdef PINENTRY_THREADS
+static pthread_mutex_t timing_lock = PTHREAD_MUTEX_INITIALIZER;
+# define LOCK_TIMING()   pthread_mutex_lock (&timing_lock)
+# define UNLOCK_TIMING() pthread_mutex_unlock (&timing_lock)
+#else
+# define LOCK_TIMING()   do { } while (0)
+# define UNLOCK_TIMING() do { } while (0)
+#endif
+
+
+/* Return the start time of the process on the scale of
+   get_usec_time.  If that is not known, return the current time.  */
+static double
+timing_process_start (void)
+{
+#ifdef __linux__
+  char buffer[1024];
+  unsigned long long starttime;
+  char *p;
+  long ticks;
+  int i;
+
+  /* The start time is the 22nd field; the second field, the command
+     name in parentheses, may contain spaces.  */
+  if (read_proc_file (AT_FDCWD, "/proc/self/stat", buffer, sizeof buffer) > 0
+      && (p = strrchr (buffer, ')'))
+      && (ticks = sysconf (_SC_CLK_TCK)) > 0)
+    {
+      for (i = 2; i < 22 && p; i++)
+        p = strchr (p + 1, ' ');
+      if (p && sscanf (p, "%llu", &starttime) == 1)
+        return starttime * 1e6 / ticks;
+    }
+#endif /*__linux__*/
+  return get_usec_time ();
+}
+
+
+static void
+timing_init (void)
+{
+  const char *s = getenv ("PINENTRY_TIMING");
+
+  if (!s || !*s)
+    return;
+
+  if (!strcmp (s, "1"))
+    timing_fp = stderr;
+  else
+    {
+      timing_fp = fopen (s, "a");
+      if (!timing_fp)
+        {
+#ifndef HAVE_W32CE_SYSTEM
+          fprintf (stderr, "%s: can't open `%s': %s\n",
+                   this_pgmname, s, strerror (errno));
+#endif
+          return;
+        }
+    }
+  timing_start = timing_process_start ();
+}
+
+
+void
+pinentry_timing (const char *phase)
+{
+  pinentry_ctx_t ctx = running_ctx? running_ctx : &default_ctx;
+  double now;
+  int i;
+
+  if (!ctx->stats.dialog_shown && !strcmp (phase, "dialog"))
+    ctx->stats.dialog_shown = get_usec_time ();
+
+  if (!timing_fp)
+    return;
+
+  now = get_usec_time ();
+  LOCK_TIMING ();
+  for (i = 0; i < timing_nseen; i++)
+    if (timing_seen[i] == phase || !strcmp (timing_seen[i], phase))
+      break;
+  if (i == timing_nseen && timing_nseen < TIMING_MAX)
+    {
+      timing_seen[timing_nseen++] = phase;
+      fprintf (timing_fp, "%s[%d]: timing: %-14s %10.3f ms\n", this_pgmname,
+               (int)getpid (), phase, (now - timing_start) / 1e3);
+      fflush (timing_fp);
+    }
+  UNLOCK_TIMING ();
+}
+
+
+
+/* Session recording.  If the envvar PINENTRY_RECORD is set, each
+   Assuan line is appended to the file it names, with a "%p" replaced
+   by the process id.  A line starts with the time in milliseconds
+   since the connection was set up and a '<' for input or '>' for
+   output.  The payload of data lines and the passphrase sent with
+   INQUIRE QUALITY are replaced by their length in brackets so that
+   the record does not expose any secrets.  assuan-replay plays such
+   a record back.  Only the connection of the Assuan server is
+   recorded; the contexts of pinentry_ctx_new are not.  */
+static FILE *record_fp;
+static double record_start;
+
+
+static void
+record_init (void)
+{
+  const char *s = getenv ("PINENTRY_RECORD");
+  char fname[1024];
+  size_t n;
+
+  if (!s || !*s)
+    return;
+
+  for (n = 0; *s && n < sizeof fname - 20; s++)
+    {
+      if (s[0] == '%' && s[1] == 'p')
+        {
+          n += snprintf (fname + n, sizeof fname - n, "%lu",
+                         (unsigned long)getpid ());
+          s++;
+        }
+      else
+        fname[n++] = *s;
+    }
+  fname[n] = 0;
+
+  record_fp = fopen (fname, "a");
+  if (!record_fp)
+    {
+#ifndef HAVE_W32CE_SYSTEM
+      fprintf (stderr, "%s: can't open `%s': %s\n",
+               this_pgmname, fname, strerror (errno));
+#endif
+      return;
+    }
+  fprintf (record_fp, "# pinentry-record %s %lu %s\n",
+           this_pgmname, (unsigned long)getpid (), VERSION);
+  fflush (record_fp);
+  record_start = get_usec_time ();
+}
+
+
+/* Assuan I/O monitor writing the session record.  */
+static unsigned int
+record_io_monitor (assuan_context_t ctx, void *hook, int direction,
+                   const char *line, size_t linelen)
+{
+  (void)ctx;
+  (void)hook;
+
+  if (linelen && line[linelen - 1] == '\n')
+    linelen--;
+
+  fprintf (record_fp, "%.3f %c ", (get_usec_time () - record_start) / 1e3,
+           direction? '>' : '<');
+  if (linelen && line[0] == 'D' && (linelen == 1 || line[1] == ' '))
+    fprintf (record_fp, "D [%u]\n",
+             (unsigned int)(linelen > 2? linelen - 2 : 0));
+  else if (linelen >= 16 && !strncmp (line, "INQUIRE QUALITY ", 16))
+    fprintf (record_fp, "INQUIRE QUALITY [%u]\n",
+             (unsigned int)(linelen - 16));
+  else
+    fprintf (record_fp, "%.*s\n", (int)linelen, line);
+  fflush (record_fp);
+  return 0;
+}
+
+
+/* Note that the handler for the request RT is about to run.  */
+static void
+request_timing_start (pinentry_ctx_t ctx, struct request_timing_s *rt)
+{
+  ctx->stats.dialog_shown = 0;
+  rt->start = get_usec_time ();
+  rt->quality = ctx->stats.quality;
+  rt->quality_sum = ctx->stats.quality_sum;
+}
+
+
+/* Send the TIMING status line for the request RT of type COMMAND if
+   the client asked for it.  The fields are the times in milliseconds
+   for the cache lookup, until the dialog was shown and from then on
+   until it was answered, followed by the number of quality inquiries
+   and their total time.  The dialog time is -1 if the frontend does
+   not tell when the dialog was shown.  */
+static void
+write_timing_status (pinentry_ctx_t ctx, const char *command,
+                     struct request_timing_s *rt)
+{
+  char buffer[200];
+  double now, shown;
+
+  if (!ctx->pe.timing_status)
+    return;
+
+  now = get_usec_time ();
+  if (!rt->start)
+    now = shown = 0;
+  else if (ctx->stats.dialog_shown)
+    shown = ctx->stats.dialog_shown;
+  else
+    shown = rt->start;
+
+  snprintf (buffer, sizeof buffer,
+            "%s cache=%.3f dialog=%.3f user=%.3f quality=%lu"
+            " quality-time=%.3f",
+            command, rt->cache / 1e3,
+            ctx->stats.dialog_shown && rt->start?
+            (ctx->stats.dialog_shown - rt->start) / 1e3 : -1.0,
+            (now - shown) / 1e3,
+            rt->start? ctx->stats.quality - rt->quality : 0,
+            rt->start? (ctx->stats.quality_sum - rt->quality_sum) / 1e3 : 0.0);
+  ctx_write_status (ctx, "TIMING", buffer);
+}
+
+
+/* The server started by pinentry_server_start.  */
+static struct
+{
+  assuan_context_t ctx;
+  int depth;              /* Nesting of pinentry_server_process.  */
+  int gone;               /* The connection has ended.  */
+  int stop;               /* Release CTX once DEPTH drops to 0.  */
+} server;
+
+
+/* Assuan pre-command hook.  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *command)
+{
+  pinentry_ctx_t pctx = assuan_get_pointer (ctx);
+
+  pinentry_timing ("first-command");
+  stats_count_command (pctx, command);
+  pctx->current_command = find_command (command);
+  return 0;
+}
+
+
+/* Send the quality inquiry for PASSPHRASE of LENGTH over the Assuan
+   connection CTX and store the value returned at R_VALUE.  Note that
+   we expect just one data line which should not be escaped in any
+   represent a numeric signed decimal value.  Extra data is currently
+   ignored but should not be send at all.  */
+static gpg_error_t
+inquire_quality (assuan_context_t ctx, const char *passphrase, size_t length,
+                 int *r_value)
+{
+  const char prefix[] = "INQUIRE QUALITY ";
+  char *command;
+  char *line;
+  size_t linelen;
+  int gotvalue = 0;
+  gpg_error_t rc;
+
+  command = secmem_malloc (strlen (prefix) + 3*length + 1);
+  if (!command)
+    return gpg_error_from_syserror ();
+  strcpy (command, prefix);
+  copy_and_escape (command + strlen(command), passphrase, length);
+  rc = assuan_write_line (ctx, command);
+  secmem_free (command);
+  if (rc)
+    {
+      fprintf (stderr, "ASSUAN WRITE LINE failed: rc=%d\n", rc);
+      return rc;
+    }
+
+  for (;;)
+    {
+      do
+        {
+          rc = assuan_read_line (ctx, &line, &linelen);
+          if (rc)
+            {
+              fprintf (stderr, "ASSUAN READ LINE failed: rc=%d\n", rc);
+              return rc;
+            }
+        }
+      while (*line == '#' || !linelen);
+      if (line[0] == 'E' && line[1] == 'N' && line[2] == 'D'
+          && (!line[3] || line[3] == ' '))
+        break; /* END command received*/
+      if (line[0] == 'C' && line[1] == 'A' && line[2] == 'N'
+          && (!line[3] || line[3] == ' '))
+        break; /* CAN command received*/
+      if (line[0] == 'E' && line[1] == 'R' && line[2] == 'R'
+          && (!line[3] || line[3] == ' '))
+        break; /* ERR command received*/
+      if (line[0] != 'D' || line[1] != ' ' || linelen < 3 || gotvalue)
+        continue;
+      gotvalue = 1;
+      *r_value = atoi (line+2);
+    }
+  return 0;
+}
+
+
+/* Run a quality inquiry for PASSPHRASE of LENGTH.  (We need LENGTH
+   because not all backends might be able to return a proper
+   C-string.).  Returns: A value between -100 and 100 to give an
+   estimate of the passphrase's quality.  Negative values are use if
+   the caller won't even accept that passphrase.  Without an Assuan
+   connection the quality callback of the context is asked.  */
+int
+pinentry_inq_quality (pinentry_t pin, const char *passphrase, size_t length)
+{
+  pinentry_ctx_t ctx = ctx_of (pin);
+  int value = 0;
+  gpg_error_t rc;
+  struct keybench_s *kb = NULL;
+  double start, now;
+
+  if (!ctx->request.getpin || (!ctx->assuan && !ctx->cbs.quality))
+    return 0; /* Can't run the callback.  */
+
+  start = get_usec_time ();
+  if (ctx->keybench_count && !ctx->keybench[ctx->keybench_count - 1].inquire)
+    {
+      kb = ctx->keybench + ctx->keybench_count - 1;
+      kb->inquire = start;
+    }
+
+  if (length > 300)
+    length = 300;  /* Limit so that it definitely fits into an Assuan
+                      line.  */
+
+  if (ctx->assuan)
+    rc = inquire_quality (ctx->assuan, passphrase, length, &value);
+  else
+    {
+      value = ctx->cbs.quality (ctx->opaque, passphrase, length);
+      rc = 0;
+    }
+  if (rc)
+    {
+      ctx->stats.quality_errors++;
+      return 0;
+    }
+
+  now = get_usec_time ();
+  if (kb)
+    kb->reply = now;
+  ctx->stats.quality++;
+  ctx->stats.quality_sum += now - start;
+  if (now - start > ctx->stats.quality_max)
+    ctx->stats.quality_max = now - start;
+
+  if (value < -100)
+    value = -100;
+  else if (value > 100)
+    value = 100;
+
+  return value;
+}
+
+
+
+/* Try to make room for at least LEN bytes in the pinentry.  Returns
+   new buffer on success and 0 on failure or when the old buffer is
+   sufficient.  */
+char *
+pinentry_setbufferlen (pinentry_t pin, int len)
+{
+  char *newp;
+
+  if (pin->pin_len)
+    assert (pin->pin);
+  else
+    assert (!pin->pin);
+
+  if (len < 2048)
     len = 2048;
 
   if (len <= pin->pin_len)
@@ -705,8 +1518,22 @@ pinentry_setbuffer_use (pinentry_t pin, char *passphrase, int len)
   pin->pin_len = len;
 }
 
+/* Libassuan's line and data buffers are allocated from their own
+   pool so that they do not compete with the passphrases.  */
+static void *
+assuan_secmem_malloc (size_t size)
+{
+  return secmem_malloc_in (SECMEM_POOL_IO, size);
+}
+
+static void *
+assuan_secmem_realloc (void *p, size_t size)
+{
+  return secmem_realloc_in (SECMEM_POOL_IO, p, size);
+}
+
 static struct assuan_malloc_hooks assuan_malloc_hooks = {
-  secmem_malloc, secmem_realloc, secmem_free
+  assuan_secmem_malloc, assuan_secmem_realloc, secmem_free
 };
 
 /* Initialize the secure memory subsystem, drop privileges and return.
@@ -719,6 +1546,12 @@ pinentry_init (const char *pgmname)
     abort ();
   strcpy (this_pgmname, pgmname);
 
+  timing_init ();
+  pinentry_timing ("init");
+
+  /* pinentry_ctx_option relies on this.  */
+  assert (option_table_sorted ());
+
   gpgrt_check_version (NULL);
 
   /* Initialize secure memory.  1 is too small, so the default size
@@ -726,6 +1559,7 @@ pinentry_init (const char *pgmname)
   secmem_init (1);
   secmem_set_flags (SECMEM_WARN);
   drop_privs ();
+  pinentry_timing ("secmem");
 
   if (atexit (secmem_term))
     {
@@ -735,9 +1569,276 @@ pinentry_init (const char *pgmname)
   assuan_set_malloc_hooks (&assuan_malloc_hooks);
 }
 
+#ifndef HAVE_W32_SYSTEM
+/* The number of milliseconds we wait for a display server to accept
+   our probe connection.  */
+#define DISPLAY_PROBE_TIMEOUT 1000
+
+/* Try to connect the socket FD to ADDR without blocking for more than
+   DISPLAY_PROBE_TIMEOUT milliseconds.  FD is closed in any case.
+   Returns 1 if the connection succeeded, 0 if there is definitely
+   nobody listening and -1 if we can't tell.  */
+static int
+probe_connect (int fd, const struct sockaddr *addr, socklen_t addrlen)
+{
+  struct pollfd pfd;
+  socklen_t errlen;
+  int flags, rc, err;
+
+  flags = fcntl (fd, F_GETFL, 0);
+  if (flags == -1 || fcntl (fd, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+      close (fd);
+      return -1;
+    }
+
+  rc = connect (fd, addr, addrlen);
+  err = rc? errno : 0;
+  if (err == EINPROGRESS)
+    {
+      pfd.fd = fd;
+      pfd.events = POLLOUT;
+      do
+        rc = poll (&pfd, 1, DISPLAY_PROBE_TIMEOUT);
+      while (rc == -1 && errno == EINTR);
+
+      if (!rc)
+        err = ETIMEDOUT;
+      else if (rc < 0)
+        err = EINVAL;  /* Whatever it is, we can't tell.  */
+      else
+        {
+          errlen = sizeof err;
+          if (getsockopt (fd, SOL_SOCKET, SO_ERROR, &err, &errlen))
+            err = EINVAL;
+        }
+    }
+  close (fd);
+
+  switch (err)
+    {
+    case 0:
+      return 1;
+    case ENOENT:
+    case ECONNREFUSED:
+    case EHOSTUNREACH:
+    case ENETUNREACH:
+      return 0;
+    default:
+      /* This includes ETIMEDOUT: a slow network or a busy server is
+         no reason to give up on the display.  */
+      return -1;
+    }
+}
+
+
+/* Probe the Unix domain socket at PATH.  If ABSTRACT is set, PATH is
+   looked up in the Linux abstract namespace.  */
+static int
+probe_unix_socket (const char *path, int abstract)
+{
+  struct sockaddr_un addr;
+  size_t len = strlen (path);
+  socklen_t addrlen;
+  int fd;
+
+  if (len + 1 >= sizeof addr.sun_path)
+    return -1;
+
+  memset (&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  if (abstract)
+    {
+      memcpy (addr.sun_path + 1, path, len);
+      addrlen = offsetof (struct sockaddr_un, sun_path) + 1 + len;
+    }
+  else
+    {
+      strcpy (addr.sun_path, path);
+      addrlen = sizeof addr;
+    }
+
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1)
+    return -1;
+  return probe_connect (fd, (struct sockaddr *)&addr, addrlen);
+}
+
+
+/* Probe the TCP port PORT at the numeric address HOST.  */
+static int
+probe_tcp (const char *host, const char *port)
+{
+  struct addrinfo hints, *ai, *ai_list;
+  int rc, any_unknown;
+
+  memset (&hints, 0, sizeof hints);
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+  if (getaddrinfo (host, port, &hints, &ai_list))
+    return -1;
+
+  any_unknown = 0;
+  rc = 0;
+  for (ai = ai_list; ai && rc != 1; ai = ai->ai_next)
+    {
+      int fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (fd == -1)
+        {
+          /* Nobody listens on an address family the system does not
+             support.  */
+          if (errno != EAFNOSUPPORT)
+            any_unknown = 1;
+          continue;
+        }
+      rc = probe_connect (fd, ai->ai_addr, ai->ai_addrlen);
+      if (rc == -1)
+        {
+          any_unknown = 1;
+          rc = 0;
+        }
+    }
+  freeaddrinfo (ai_list);
+
+  if (rc != 1 && any_unknown)
+    rc = -1;
+  return rc;
+}
+
+
+/* Probe the X11 display NAME, which has the usual form
+   "[HOST]:NUMBER[.SCREEN]".  Returns 1 if an X server accepts
+   connections, 0 if definitely not and -1 if we can't tell.  A HOST
+   is only probed if it is "localhost" or a numeric address; looking
+   up other names could take longer than the toolkit takes to find
+   out by itself.  */
+static int
+probe_x11_display (const char *name)
+{
+  const char *colon;
+  char *host, *endp;
+  char buf[100];
+  long number;
+  int rc, rc2;
+
+  colon = strrchr (name, ':');
+  if (!colon || colon == name + strlen (name) - 1)
+    return -1;
+
+  /* A launchd display (macOS) is the path of the socket itself.  */
+  if (*name == '/')
+    return probe_unix_socket (name, 0);
+
+  errno = 0;
+  number = strtol (colon + 1, &endp, 10);
+  if (errno || number < 0 || number > 59535
+      || (*endp && *endp != '.'))
+    return -1;
+
+  host = strndup (name, colon - name);
+  if (!host)
+    return -1;
+
+  if (!*host || !strcmp (host, "unix"))
+    {
+      free (host);
+      snprintf (buf, sizeof buf, "/tmp/.X11-unix/X%ld", number);
+      buf[sizeof buf - 1] = 0;
+      rc = probe_unix_socket (buf, 0);
+#ifdef __linux__
+      /* Xorg also listens in the abstract namespace.  */
+      if (rc != 1)
+        rc = probe_unix_socket (buf, 1) == 1? 1 : rc;
+#endif
+      return rc;
+    }
+
+  if (host[strlen (host) - 1] == ':')
+    {
+      /* DECnet.  */
+      free (host);
+      return -1;
+    }
+
+  snprintf (buf, sizeof buf, "%ld", 6000 + number);
+  buf[sizeof buf - 1] = 0;
+  if (!strcmp (host, "localhost"))
+    {
+      /* This is what SSH uses for a forwarded display, which may
+         have gone away with the connection.  The forwarding listens
+         on either or both loopback addresses.  */
+      rc = probe_tcp ("127.0.0.1", buf);
+      if (rc != 1)
+        {
+          rc2 = probe_tcp ("::1", buf);
+          rc = rc2 == 1 || rc == 0? rc2 : rc;
+        }
+    }
+  else
+    rc = probe_tcp (host, buf);
+  free (host);
+  return rc;
+}
+
+
+/* Probe the Wayland display NAME.  */
+static int
+probe_wayland_display (const char *name)
+{
+  const char *dir;
+  char *path;
+  int rc;
+
+  if (*name == '/')
+    return probe_unix_socket (name, 0);
+
+  dir = getenv ("XDG_RUNTIME_DIR");
+  if (!dir || !*dir)
+    return -1;
+
+  path = malloc (strlen (dir) + 1 + strlen (name) + 1);
+  if (!path)
+    return -1;
+  sprintf (path, "%s/%s", dir, name);
+  rc = probe_unix_socket (path, 0);
+  free (path);
+  return rc;
+}
+
+
+/* Return false if the display we are going to use is definitely not
+   reachable.  This is the case for a stale DISPLAY left over from a
+   dropped SSH X forwarding, where the toolkit would otherwise run
+   into a long connection timeout before we can fall back to curses.
+   In case of doubt true is returned and the toolkit has to find
+   out.  */
+static int
+display_reachable (void)
+{
+  const char *x11 = remember_display? remember_display : getenv ("DISPLAY");
+  const char *wayland = getenv ("WAYLAND_DISPLAY");
+
+  if (x11 && *x11 && probe_x11_display (x11))
+    return 1;
+  if (wayland && *wayland && probe_wayland_display (wayland))
+    return 1;
+
+  if (x11 && *x11)
+    fprintf (stderr, "%s: display %s is not reachable\n", this_pgmname, x11);
+  else if (wayland && *wayland)
+    fprintf (stderr, "%s: display %s is not reachable\n",
+             this_pgmname, wayland);
+  else
+    fprintf (stderr, "%s: no display given\n", this_pgmname);
+  return 0;
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+
 /* Simple test to check whether DISPLAY is set or the option --display
-   was given.  Used to decide whether the GUI or curses should be
-   initialized.  */
+   was given and whether the display can actually be connected to.
+   Used to decide whether the GUI or curses should be initialized.  */
 int
 pinentry_have_display (int argc, char **argv)
 {
@@ -788,6 +1889,11 @@ pinentry_have_display (int argc, char **argv)
   }
 #endif
 
+#ifndef HAVE_W32_SYSTEM
+  if (found && !display_reachable ())
+    found = 0;
+#endif
+
   return found;
 }
 
@@ -911,27 +2017,27 @@ pinentry_parse_opts (int argc, char *argv[])
     ARGPARSE_end()
   };
   ARGPARSE_ARGS pargs = { &argc, &argv, 0 };
+  pinentry_t pe = &default_ctx.pe;
 
   set_strusage (my_strusage);
 
-  pinentry_reset (1);
+  pinentry_reset (&default_ctx, 1);
 
   while (arg_parse  (&pargs, opts))
     {
       switch (pargs.r_opt)
         {
         case 'd':
-          pinentry.debug = 1;
+          pe->debug = 1;
           break;
         case 'g':
-          pinentry.grab = 0;
+          pe->grab = 0;
           break;
 
 	case 'D':
           /* Note, this is currently not used because the GUI engine
              has already been initialized when parsing these options. */
-	  pinentry.display = strdup (pargs.r.ret_str);
-	  if (!pinentry.display)
+	  if (!session_strdup (&default_ctx, &pe->display, pargs.r.ret_str))
 	    {
 #ifndef HAVE_W32CE_SYSTEM
 	      fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
@@ -940,8 +2046,7 @@ pinentry_parse_opts (int argc, char *argv[])
 	    }
 	  break;
 	case 'T':
-	  pinentry.ttyname = strdup (pargs.r.ret_str);
-	  if (!pinentry.ttyname)
+	  if (!session_strdup (&default_ctx, &pe->ttyname, pargs.r.ret_str))
 	    {
 #ifndef HAVE_W32CE_SYSTEM
 	      fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
@@ -950,8 +2055,7 @@ pinentry_parse_opts (int argc, char *argv[])
 	    }
 	  break;
 	case 'N':
-	  pinentry.ttytype = strdup (pargs.r.ret_str);
-	  if (!pinentry.ttytype)
+	  if (!session_strdup (&default_ctx, &pe->ttytype, pargs.r.ret_str))
 	    {
 #ifndef HAVE_W32CE_SYSTEM
 	      fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
@@ -960,8 +2064,7 @@ pinentry_parse_opts (int argc, char *argv[])
 	    }
 	  break;
 	case 'C':
-	  pinentry.lc_ctype = strdup (pargs.r.ret_str);
-	  if (!pinentry.lc_ctype)
+	  if (!session_strdup (&default_ctx, &pe->lc_ctype, pargs.r.ret_str))
 	    {
 #ifndef HAVE_W32CE_SYSTEM
 	      fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
@@ -970,8 +2073,7 @@ pinentry_parse_opts (int argc, char *argv[])
 	    }
 	  break;
 	case 'M':
-	  pinentry.lc_messages = strdup (pargs.r.ret_str);
-	  if (!pinentry.lc_messages)
+	  if (!session_strdup (&default_ctx, &pe->lc_messages, pargs.r.ret_str))
 	    {
 #ifndef HAVE_W32CE_SYSTEM
 	      fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
@@ -980,28 +2082,27 @@ pinentry_parse_opts (int argc, char *argv[])
 	    }
 	  break;
 	case 'W':
-	  pinentry.parent_wid = pargs.r.ret_ulong;
+	  pe->parent_wid = pargs.r.ret_ulong;
 	  break;
 
 	case 'c':
           {
             char *tmpstr = pargs.r.ret_str;
 
-            tmpstr = parse_color (tmpstr, &pinentry.color_fg,
-                                  &pinentry.color_fg_bright);
-            tmpstr = parse_color (tmpstr, &pinentry.color_bg, NULL);
-            tmpstr = parse_color (tmpstr, &pinentry.color_so,
-                                  &pinentry.color_so_bright);
+            tmpstr = parse_color (tmpstr, &pe->color_fg,
+                                  &pe->color_fg_bright);
+            tmpstr = parse_color (tmpstr, &pe->color_bg, NULL);
+            tmpstr = parse_color (tmpstr, &pe->color_so,
+                                  &pe->color_so_bright);
           }
 	  break;
 
 	case 'o':
-	  pinentry.timeout = pargs.r.ret_int;
+	  pe->timeout = pargs.r.ret_int;
 	  break;
 
 	case 'a':
-	  pinentry.ttyalert = strdup (pargs.r.ret_str);
-	  if (!pinentry.ttyalert)
+	  if (!session_strdup (&default_ctx, &pe->ttyalert, pargs.r.ret_str))
 	    {
 #ifndef HAVE_W32CE_SYSTEM
 	      fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
@@ -1016,9 +2117,16 @@ pinentry_parse_opts (int argc, char *argv[])
         }
     }
 
-  if (!pinentry.display && remember_display)
+  if (!pe->display && remember_display)
     {
-      pinentry.display = remember_display;
+      if (!session_strdup (&default_ctx, &pe->display, remember_display))
+	{
+#ifndef HAVE_W32CE_SYSTEM
+	  fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
+#endif
+	  exit (EXIT_FAILURE);
+	}
+      free (remember_display);
       remember_display = NULL;
     }
 }
@@ -1034,192 +2142,224 @@ pinentry_set_flavor_flag (const char *string)
 
 
 
+/* OPTION debug-wait [SECONDS] */
 static gpg_error_t
-option_handler (assuan_context_t ctx, const char *key, const char *value)
+option_debug_wait (pinentry_ctx_t ctx, const char *value)
 {
   (void)ctx;
 
-  if (!strcmp (key, "no-grab") && !*value)
-    pinentry.grab = 0;
-  else if (!strcmp (key, "grab") && !*value)
-    pinentry.grab = 1;
-  else if (!strcmp (key, "debug-wait"))
-    {
 #ifndef HAVE_W32_SYSTEM
-      fprintf (stderr, "%s: waiting for debugger - my pid is %u ...\n",
-	       this_pgmname, (unsigned int) getpid());
-      sleep (*value?atoi (value):5);
-      fprintf (stderr, "%s: ... okay\n", this_pgmname);
+  fprintf (stderr, "%s: waiting for debugger - my pid is %u ...\n",
+           this_pgmname, (unsigned int) getpid());
+  sleep (*value?atoi (value):5);
+  fprintf (stderr, "%s: ... okay\n", this_pgmname);
+#else
+  (void)value;
 #endif
-    }
-  else if (!strcmp (key, "display"))
-    {
-      if (pinentry.display)
-	free (pinentry.display);
-      pinentry.display = strdup (value);
-      if (!pinentry.display)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "ttyname"))
-    {
-      if (pinentry.ttyname)
-	free (pinentry.ttyname);
-      pinentry.ttyname = strdup (value);
-      if (!pinentry.ttyname)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "ttytype"))
-    {
-      if (pinentry.ttytype)
-	free (pinentry.ttytype);
-      pinentry.ttytype = strdup (value);
-      if (!pinentry.ttytype)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "ttyalert"))
-    {
-      if (pinentry.ttyalert)
-	free (pinentry.ttyalert);
-      pinentry.ttyalert = strdup (value);
-      if (!pinentry.ttyalert)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "lc-ctype"))
-    {
-      if (pinentry.lc_ctype)
-	free (pinentry.lc_ctype);
-      pinentry.lc_ctype = strdup (value);
-      if (!pinentry.lc_ctype)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "lc-messages"))
-    {
-      if (pinentry.lc_messages)
-	free (pinentry.lc_messages);
-      pinentry.lc_messages = strdup (value);
-      if (!pinentry.lc_messages)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "owner"))
-    {
-      long along;
-      char *endp;
+  return 0;
+}
+
 
-      free (pinentry.owner_host);
-      pinentry.owner_host = NULL;
-      pinentry.owner_uid = -1;
-      pinentry.owner_pid = 0;
+/* OPTION owner PID[/UID] [HOSTNAME] */
+static gpg_error_t
+option_owner (pinentry_ctx_t ctx, const char *value)
+{
+  long along;
+  char *endp;
 
-      errno = 0;
-      along = strtol (value, &endp, 10);
-      if (along && !errno)
+  if (ctx->pe.owner_host)
+    ctx->session_dead += strlen (ctx->pe.owner_host) + 1;
+  ctx->pe.owner_host = NULL;
+  ctx->pe.owner_uid = -1;
+  ctx->pe.owner_pid = 0;
+
+  errno = 0;
+  along = strtol (value, &endp, 10);
+  if (along && !errno)
+    {
+      ctx->pe.owner_pid = (unsigned long)along;
+      if (*endp)
         {
-          pinentry.owner_pid = (unsigned long)along;
-          if (*endp)
+          errno = 0;
+          if (*endp == '/') { /* we have a uid */
+            endp++;
+            along = strtol (endp, &endp, 10);
+            if (along >= 0 && !errno)
+              ctx->pe.owner_uid = (int)along;
+          }
+          if (endp)
             {
-              errno = 0;
-              if (*endp == '/') { /* we have a uid */
+              while (*endp == ' ')
                 endp++;
-                along = strtol (endp, &endp, 10);
-                if (along >= 0 && !errno)
-                  pinentry.owner_uid = (int)along;
-              }
-              if (endp)
-                {
-                  while (*endp == ' ')
-                    endp++;
-                  if (*endp)
-                    {
-                      pinentry.owner_host = strdup (endp);
-                      for (endp=pinentry.owner_host;
-                           *endp && *endp != ' '; endp++)
-                        ;
-                      *endp = 0;
-                    }
-                }
+              if (*endp)
+                session_strndup (ctx, &ctx->pe.owner_host,
+                                 endp, strcspn (endp, " "));
             }
         }
     }
-  else if (!strcmp (key, "parent-wid"))
-    {
-      pinentry.parent_wid = atoi (value);
-      /* FIXME: Use strtol and add some error handling.  */
-    }
-  else if (!strcmp (key, "touch-file"))
-    {
-      if (pinentry.touch_file)
-        free (pinentry.touch_file);
-      pinentry.touch_file = strdup (value);
-      if (!pinentry.touch_file)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "default-ok"))
-    {
-      pinentry.default_ok = strdup (value);
-      if (!pinentry.default_ok)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "default-cancel"))
-    {
-      pinentry.default_cancel = strdup (value);
-      if (!pinentry.default_cancel)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "default-prompt"))
-    {
-      pinentry.default_prompt = strdup (value);
-      if (!pinentry.default_prompt)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "default-pwmngr"))
-    {
-      pinentry.default_pwmngr = strdup (value);
-      if (!pinentry.default_pwmngr)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "default-cf-visi"))
-    {
-      pinentry.default_cf_visi = strdup (value);
-      if (!pinentry.default_cf_visi)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "default-tt-visi"))
-    {
-      pinentry.default_tt_visi = strdup (value);
-      if (!pinentry.default_tt_visi)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "default-tt-hide"))
-    {
-      pinentry.default_tt_hide = strdup (value);
-      if (!pinentry.default_tt_hide)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "allow-external-password-cache") && !*value)
-    {
-      pinentry.allow_external_password_cache = 1;
-      pinentry.tried_password_cache = 0;
-    }
-  else if (!strcmp (key, "allow-emacs-prompt") && !*value)
-    {
+
+#ifndef HAVE_W32_SYSTEM
+  /* Look at the process now and not each time a title is needed.  */
+  update_owner_info (&ctx->pe);
+#endif
+  return 0;
+}
+
+
+/* OPTION allow-external-password-cache */
+static gpg_error_t
+option_allow_external_password_cache (pinentry_ctx_t ctx, const char *value)
+{
+  (void)value;
+
+  ctx->pe.allow_external_password_cache = 1;
+  ctx->pe.tried_password_cache = 0;
+  return 0;
+}
+
+
+/* OPTION allow-emacs-prompt */
+static gpg_error_t
+option_allow_emacs_prompt (pinentry_ctx_t ctx, const char *value)
+{
+  (void)ctx;
+  (void)value;
+
 #ifdef INSIDE_EMACS
-      pinentry_enable_emacs_cmd_handler ();
+  pinentry_enable_emacs_cmd_handler ();
 #endif
+  return 0;
+}
+
+
+/* How the value of an option is stored.  */
+typedef enum
+  {
+    OPT_STRING,     /* Copy the value to the char * field at OFFSET.  */
+    OPT_ULONG,      /* Store the decimal value at the unsigned long at
+                       OFFSET.  Like the atoi used before, this never
+                       fails.  */
+    OPT_FLAG,       /* Store VALUE at the int at OFFSET; no argument.  */
+    OPT_FUNC,       /* Call FUNC with the value.  */
+    OPT_FUNC_NOARG  /* Call FUNC; no argument allowed.  */
+  } option_type_t;
+
+#define OPT_FIELD(name) offsetof (struct pinentry, name)
+
+/* The options we understand.  This table must be sorted by NAME so
+   that pinentry_ctx_option can do a binary search.  */
+static const struct
+{
+  const char *name;
+  option_type_t type;
+  size_t offset;
+  int value;
+  gpg_error_t (*func) (pinentry_ctx_t ctx, const char *value);
+} option_table[] =
+  {
+    { "allow-emacs-prompt", OPT_FUNC_NOARG, 0, 0, option_allow_emacs_prompt },
+    { "allow-external-password-cache", OPT_FUNC_NOARG, 0, 0,
+      option_allow_external_password_cache },
+    { "debug-wait",      OPT_FUNC, 0, 0, option_debug_wait },
+    { "default-cancel",  OPT_STRING, OPT_FIELD (default_cancel) },
+    { "default-cf-visi", OPT_STRING, OPT_FIELD (default_cf_visi) },
+    { "default-ok",      OPT_STRING, OPT_FIELD (default_ok) },
+    { "default-prompt",  OPT_STRING, OPT_FIELD (default_prompt) },
+    { "default-pwmngr",  OPT_STRING, OPT_FIELD (default_pwmngr) },
+    { "default-tt-hide", OPT_STRING, OPT_FIELD (default_tt_hide) },
+    { "default-tt-visi", OPT_STRING, OPT_FIELD (default_tt_visi) },
+    { "display",         OPT_STRING, OPT_FIELD (display) },
+    { "grab",            OPT_FLAG,   OPT_FIELD (grab), 1 },
+    { "invisible-char",  OPT_STRING, OPT_FIELD (invisible_char) },
+    { "lc-ctype",        OPT_STRING, OPT_FIELD (lc_ctype) },
+    { "lc-messages",     OPT_STRING, OPT_FIELD (lc_messages) },
+    { "no-grab",         OPT_FLAG,   OPT_FIELD (grab), 0 },
+    { "owner",           OPT_FUNC, 0, 0, option_owner },
+    { "parent-wid",      OPT_ULONG,  OPT_FIELD (parent_wid) },
+    { "timing-status",   OPT_FLAG,   OPT_FIELD (timing_status), 1 },
+    { "touch-file",      OPT_STRING, OPT_FIELD (touch_file) },
+    { "ttyalert",        OPT_STRING, OPT_FIELD (ttyalert) },
+    { "ttyname",         OPT_STRING, OPT_FIELD (ttyname) },
+    { "ttytype",         OPT_STRING, OPT_FIELD (ttytype) }
+  };
+
+
+#ifndef NDEBUG
+/* Return true if OPTION_TABLE is sorted by NAME.  */
+static int
+option_table_sorted (void)
+{
+  int i;
+
+  for (i = 1; i < DIM (option_table); i++)
+    if (strcmp (option_table[i - 1].name, option_table[i].name) >= 0)
+      return 0;
+  return 1;
+}
+#endif /*!NDEBUG*/
+
+
+int
+pinentry_ctx_option (pinentry_ctx_t ctx, const char *key, const char *value)
+{
+  void *field;
+  int lo, hi, mid, cmp;
+
+  /* Binary search in OPTION_TABLE.  */
+  lo = 0;
+  hi = DIM (option_table) - 1;
+  for (;;)
+    {
+      if (lo > hi)
+        return gpg_error (GPG_ERR_UNKNOWN_OPTION);
+      mid = (lo + hi) / 2;
+      cmp = strcmp (key, option_table[mid].name);
+      if (!cmp)
+        break;
+      if (cmp < 0)
+        hi = mid - 1;
+      else
+        lo = mid + 1;
     }
-  else if (!strcmp (key, "invisible-char"))
+
+  field = (char *)&ctx->pe + option_table[mid].offset;
+  switch (option_table[mid].type)
     {
-      if (pinentry.invisible_char)
-        free (pinentry.invisible_char);
-      pinentry.invisible_char = strdup (value);
-      if (!pinentry.invisible_char)
-	return gpg_error_from_syserror ();
+    case OPT_STRING:
+      if (!session_strdup (ctx, field, value))
+        return gpg_error_from_syserror ();
+      break;
+
+    case OPT_ULONG:
+      /* Window IDs and HWNDs may not fit into an int.  */
+      *(unsigned long *)field = strtoul (value, NULL, 10);
+      break;
+
+    case OPT_FLAG:
+      if (*value)
+        return gpg_error (GPG_ERR_UNKNOWN_OPTION);
+      *(int *)field = option_table[mid].value;
+      break;
+
+    case OPT_FUNC_NOARG:
+      if (*value)
+        return gpg_error (GPG_ERR_UNKNOWN_OPTION);
+      /* fall through */
+    case OPT_FUNC:
+      return option_table[mid].func (ctx, value);
     }
-  else
-    return gpg_error (GPG_ERR_UNKNOWN_OPTION);
+
   return 0;
 }
 
 
+static gpg_error_t
+option_handler (assuan_context_t ctx, const char *key, const char *value)
+{
+  return pinentry_ctx_option (assuan_get_pointer (ctx), key, value);
+}
+
+
 /* Note, that it is sufficient to allocate the target string D as
    long as the source string S, i.e.: strlen(s)+1; */
 static void
@@ -1240,9 +2380,23 @@ strcpy_escaped (char *d, const char *s)
 }
 
 
+/* Return an unescaped copy of LINE allocated from ARENA.  */
+static char *
+arena_strdup_escaped (string_arena_t *arena, const char *line)
+{
+  char *p;
+
+  p = arena_alloc (arena, strlen (line) + 1);
+  if (p)
+    strcpy_escaped (p, line);
+  return p;
+}
+
+
 static void
-write_status_error (assuan_context_t ctx, pinentry_t pe)
+write_status_error (pinentry_ctx_t ctx)
 {
+  pinentry_t pe = &ctx->pe;
   char buf[500];
   const char *pgm;
 
@@ -1258,44 +2412,32 @@ write_status_error (assuan_context_t ctx, pinentry_t pe)
             pe->specific_err,
             pe->specific_err_info? pe->specific_err_info : "");
   buf[sizeof buf -1] = 0;
-  assuan_write_status (ctx, "ERROR", buf);
+  ctx_write_status (ctx, "ERROR", buf);
 }
 
 
 static gpg_error_t
-cmd_setdesc (assuan_context_t ctx, char *line)
+cmd_setdesc (pinentry_ctx_t ctx, char *line)
 {
   char *newd;
 
-  (void)ctx;
-
-  newd = malloc (strlen (line) + 1);
+  newd = arena_strdup_escaped (&ctx->request_strings, line);
   if (!newd)
     return gpg_error_from_syserror ();
-
-  strcpy_escaped (newd, line);
-  if (pinentry.description)
-    free (pinentry.description);
-  pinentry.description = newd;
+  ctx->pe.description = newd;
   return 0;
 }
 
 
 static gpg_error_t
-cmd_setprompt (assuan_context_t ctx, char *line)
+cmd_setprompt (pinentry_ctx_t ctx, char *line)
 {
   char *newp;
 
-  (void)ctx;
-
-  newp = malloc (strlen (line) + 1);
+  newp = arena_strdup_escaped (&ctx->request_strings, line);
   if (!newp)
     return gpg_error_from_syserror ();
-
-  strcpy_escaped (newp, line);
-  if (pinentry.prompt)
-    free (pinentry.prompt);
-  pinentry.prompt = newp;
+  ctx->pe.prompt = newp;
   return 0;
 }
 
@@ -1305,343 +2447,394 @@ cmd_setprompt (assuan_context_t ctx, char *line)
    string and --clear mean that the key does not have a stable
    identifier.  */
 static gpg_error_t
-cmd_setkeyinfo (assuan_context_t ctx, char *line)
+cmd_setkeyinfo (pinentry_ctx_t ctx, char *line)
 {
-  (void)ctx;
-
-  if (pinentry.keyinfo)
-    free (pinentry.keyinfo);
-
   if (*line && strcmp(line, "--clear") != 0)
-    pinentry.keyinfo = strdup (line);
+    {
+      ctx->pe.keyinfo = arena_strdup (&ctx->request_strings, line);
+      if (!ctx->pe.keyinfo)
+        return gpg_error_from_syserror ();
+    }
   else
-    pinentry.keyinfo = NULL;
+    ctx->pe.keyinfo = NULL;
 
   return 0;
 }
 
 
 static gpg_error_t
-cmd_setrepeat (assuan_context_t ctx, char *line)
+cmd_setrepeat (pinentry_ctx_t ctx, char *line)
 {
   char *p;
 
-  (void)ctx;
-
-  p = malloc (strlen (line) + 1);
+  p = arena_strdup_escaped (&ctx->request_strings, line);
   if (!p)
     return gpg_error_from_syserror ();
-
-  strcpy_escaped (p, line);
-  free (pinentry.repeat_passphrase);
-  pinentry.repeat_passphrase = p;
+  ctx->pe.repeat_passphrase = p;
   return 0;
 }
 
 
 static gpg_error_t
-cmd_setrepeaterror (assuan_context_t ctx, char *line)
+cmd_setrepeaterror (pinentry_ctx_t ctx, char *line)
 {
   char *p;
 
-  (void)ctx;
-
-  p = malloc (strlen (line) + 1);
+  p = arena_strdup_escaped (&ctx->request_strings, line);
   if (!p)
     return gpg_error_from_syserror ();
-
-  strcpy_escaped (p, line);
-  free (pinentry.repeat_error_string);
-  pinentry.repeat_error_string = p;
+  ctx->pe.repeat_error_string = p;
   return 0;
 }
 
 
 static gpg_error_t
-cmd_seterror (assuan_context_t ctx, char *line)
+cmd_seterror (pinentry_ctx_t ctx, char *line)
 {
   char *newe;
 
-  (void)ctx;
-
-  newe = malloc (strlen (line) + 1);
+  newe = arena_strdup_escaped (&ctx->request_strings, line);
   if (!newe)
     return gpg_error_from_syserror ();
-
-  strcpy_escaped (newe, line);
-  if (pinentry.error)
-    free (pinentry.error);
-  pinentry.error = newe;
+  ctx->pe.error = newe;
   return 0;
 }
 
 
 static gpg_error_t
-cmd_setok (assuan_context_t ctx, char *line)
+cmd_setok (pinentry_ctx_t ctx, char *line)
 {
   char *newo;
 
-  (void)ctx;
-
-  newo = malloc (strlen (line) + 1);
+  newo = arena_strdup_escaped (&ctx->request_strings, line);
   if (!newo)
     return gpg_error_from_syserror ();
-
-  strcpy_escaped (newo, line);
-  if (pinentry.ok)
-    free (pinentry.ok);
-  pinentry.ok = newo;
+  ctx->pe.ok = newo;
   return 0;
 }
 
 
 static gpg_error_t
-cmd_setnotok (assuan_context_t ctx, char *line)
+cmd_setnotok (pinentry_ctx_t ctx, char *line)
 {
   char *newo;
 
-  (void)ctx;
-
-  newo = malloc (strlen (line) + 1);
+  newo = arena_strdup_escaped (&ctx->request_strings, line);
   if (!newo)
     return gpg_error_from_syserror ();
-
-  strcpy_escaped (newo, line);
-  if (pinentry.notok)
-    free (pinentry.notok);
-  pinentry.notok = newo;
+  ctx->pe.notok = newo;
   return 0;
 }
 
 
 static gpg_error_t
-cmd_setcancel (assuan_context_t ctx, char *line)
+cmd_setcancel (pinentry_ctx_t ctx, char *line)
 {
   char *newc;
 
-  (void)ctx;
-
-  newc = malloc (strlen (line) + 1);
+  newc = arena_strdup_escaped (&ctx->request_strings, line);
   if (!newc)
     return gpg_error_from_syserror ();
-
-  strcpy_escaped (newc, line);
-  if (pinentry.cancel)
-    free (pinentry.cancel);
-  pinentry.cancel = newc;
+  ctx->pe.cancel = newc;
   return 0;
 }
 
 
 static gpg_error_t
-cmd_settimeout (assuan_context_t ctx, char *line)
+cmd_settimeout (pinentry_ctx_t ctx, char *line)
 {
-  (void)ctx;
-
   if (line && *line)
-    pinentry.timeout = atoi (line);
+    ctx->pe.timeout = atoi (line);
 
   return 0;
 }
 
 static gpg_error_t
-cmd_settitle (assuan_context_t ctx, char *line)
+cmd_settitle (pinentry_ctx_t ctx, char *line)
 {
   char *newt;
 
-  (void)ctx;
-
-  newt = malloc (strlen (line) + 1);
+  newt = arena_strdup_escaped (&ctx->request_strings, line);
   if (!newt)
     return gpg_error_from_syserror ();
+  ctx->pe.title = newt;
+  return 0;
+}
+
+static gpg_error_t
+cmd_setqualitybar (pinentry_ctx_t ctx, char *line)
+{
+  char *newval;
+
+  if (!*line)
+    line = "Quality:";
+
+  newval = arena_strdup_escaped (&ctx->request_strings, line);
+  if (!newval)
+    return gpg_error_from_syserror ();
+  ctx->pe.quality_bar = newval;
+  return 0;
+}
+
+/* Set the tooltip to be used for a quality bar.  */
+static gpg_error_t
+cmd_setqualitybar_tt (pinentry_ctx_t ctx, char *line)
+{
+  char *newval;
+
+  if (*line)
+    {
+      newval = arena_strdup_escaped (&ctx->request_strings, line);
+      if (!newval)
+        return gpg_error_from_syserror ();
+    }
+  else
+    newval = NULL;
+  ctx->pe.quality_bar_tt = newval;
+  return 0;
+}
+
+
+/* Send the passphrase of length RESULT for GETPIN unless RESULT is 0.
+   FROM_CACHE tells whether it has just been read from the password
+   cache.  */
+static gpg_error_t
+getpin_reply (pinentry_ctx_t ctx, int result, int from_cache)
+{
+  if (result)
+    {
+      if (ctx->pe.repeat_okay)
+        ctx_write_status (ctx, "PIN_REPEATED", "");
+      result = ctx_send_data (ctx, ctx->pe.pin, strlen(ctx->pe.pin));
+      if (!result)
+	result = ctx_send_data (ctx, NULL, 0);
+
+      if (/* GPG Agent says it's okay.  */
+	  ctx->pe.allow_external_password_cache && ctx->pe.keyinfo
+	  /* We didn't just read it from the cache.  */
+	  && ! from_cache
+	  /* And the user said it's okay.  */
+	  && ctx->pe.may_cache_password)
+	/* Cache the password.  */
+	password_cache_save (ctx->pe.keyinfo, ctx->pe.pin);
+    }
 
-  strcpy_escaped (newt, line);
-  if (pinentry.title)
-    free (pinentry.title);
-  pinentry.title = newt;
-  return 0;
+  pinentry_setbuffer_clear (&ctx->pe);
+
+  return result;
 }
 
+
+/* Finish GETPIN with the RESULT of the command handler.  */
 static gpg_error_t
-cmd_setqualitybar (assuan_context_t ctx, char *line)
+getpin_done (pinentry_ctx_t ctx, int result)
 {
-  char *newval;
+  ctx->pe.ctx_assuan = NULL;
+  ctx->request.getpin = 0;
+  stats_count_getpin (ctx, ctx->request.timing.start);
+  write_timing_status (ctx, "getpin", &ctx->request.timing);
+  pinentry_timing ("getpin-reply");
+  if (ctx->keybench_count)
+    keybench_report (ctx);
+  ctx->pe.error = NULL;
+  ctx->pe.repeat_passphrase = NULL;
+  if (ctx->request.set_prompt)
+    ctx->pe.prompt = NULL;
+
+  ctx->pe.quality_bar = 0;  /* Reset it after the command.  */
+
+  if (ctx->pe.close_button)
+    ctx_write_status (ctx, "BUTTON_INFO", "close");
 
-  (void)ctx;
+  if (result < 0)
+    {
+      pinentry_setbuffer_clear (&ctx->pe);
+      if (ctx->pe.specific_err)
+        {
+          write_status_error (ctx);
+          return ctx->pe.specific_err;
+        }
+      return (ctx->pe.locale_err
+	      ? gpg_error (GPG_ERR_LOCALE_PROBLEM)
+	      : gpg_error (GPG_ERR_CANCELED));
+    }
 
-  if (!*line)
-    line = "Quality:";
+  return getpin_reply (ctx, result, 0);
+}
 
-  newval = malloc (strlen (line) + 1);
-  if (!newval)
-    return gpg_error_from_syserror ();
 
-  strcpy_escaped (newval, line);
-  if (pinentry.quality_bar)
-    free (pinentry.quality_bar);
-  pinentry.quality_bar = newval;
-  return 0;
+/* Run the command handler of CTX for the current request and return
+   its result.  */
+static int
+run_cmd_handler (pinentry_ctx_t ctx)
+{
+  pinentry_cmd_handler_t handler = ctx->handler;
+  pinentry_ctx_t saved = running_ctx;
+  int result;
+
+  if (!handler)
+    handler = pinentry_cmd_handler;
+  if (!handler)
+    {
+      ctx->pe.specific_err = gpg_error (GPG_ERR_NOT_IMPLEMENTED);
+      ctx->pe.specific_err_loc = "handler";
+      return -1;
+    }
+
+  running_ctx = ctx;
+  result = handler (&ctx->pe);
+  running_ctx = saved;
+  return result;
 }
 
-/* Set the tooltip to be used for a quality bar.  */
+
+/* Finish the current request with the RESULT of the command handler
+   by calling DONE, or leave that to pinentry_command_done if the
+   handler deferred the result.  */
 static gpg_error_t
-cmd_setqualitybar_tt (assuan_context_t ctx, char *line)
+request_result (pinentry_ctx_t ctx, int result,
+                gpg_error_t (*done) (pinentry_ctx_t, int))
 {
-  char *newval;
-
-  (void)ctx;
+  if (result != PINENTRY_DEFERRED)
+    return done (ctx, result);
 
-  if (*line)
+  if (!server.ctx || ctx->assuan != server.ctx)
     {
-      newval = malloc (strlen (line) + 1);
-      if (!newval)
-        return gpg_error_from_syserror ();
-
-      strcpy_escaped (newval, line);
+      /* pinentry_loop and pinentry_ctx_command have no way to
+         complete it later.  */
+      ctx->pe.specific_err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      ctx->pe.specific_err_loc = "deferred";
+      return done (ctx, -1);
     }
-  else
-    newval = NULL;
-  if (pinentry.quality_bar_tt)
-    free (pinentry.quality_bar_tt);
-  pinentry.quality_bar_tt = newval;
+
+  ctx->request.done = done;
   return 0;
 }
 
 
 static gpg_error_t
-cmd_getpin (assuan_context_t ctx, char *line)
+cmd_getpin (pinentry_ctx_t ctx, char *line)
 {
   int result;
-  int set_prompt = 0;
-  int just_read_password_from_cache = 0;
+  struct request_timing_s *timing = &ctx->request.timing;
 
   (void)line;
 
-  pinentry_setbuffer_init (&pinentry);
-  if (!pinentry.pin)
+  memset (&ctx->request, 0, sizeof ctx->request);
+
+  pinentry_setbuffer_init (&ctx->pe);
+  if (!ctx->pe.pin)
     return gpg_error (GPG_ERR_ENOMEM);
 
   /* Try reading from the password cache.  */
   if (/* If repeat passphrase is set, then we don't want to read from
 	 the cache.  */
-      ! pinentry.repeat_passphrase
+      ! ctx->pe.repeat_passphrase
       /* Are we allowed to read from the cache?  */
-      && pinentry.allow_external_password_cache
-      && pinentry.keyinfo
+      && ctx->pe.allow_external_password_cache
+      && ctx->pe.keyinfo
       /* Only read from the cache if we haven't already tried it.  */
-      && ! pinentry.tried_password_cache
+      && ! ctx->pe.tried_password_cache
       /* If the last read resulted in an error, then don't read from
 	 the cache.  */
-      && ! pinentry.error)
+      && ! ctx->pe.error)
     {
       char *password;
       int give_up_on_password_store = 0;
 
-      pinentry.tried_password_cache = 1;
+      ctx->pe.tried_password_cache = 1;
 
-      password = password_cache_lookup (pinentry.keyinfo, &give_up_on_password_store);
+      timing->cache = get_usec_time ();
+      password = password_cache_lookup (ctx->pe.keyinfo, &give_up_on_password_store);
+      timing->cache = get_usec_time () - timing->cache;
       if (give_up_on_password_store)
-	pinentry.allow_external_password_cache = 0;
+	ctx->pe.allow_external_password_cache = 0;
+
+      if (password)
+        ctx->stats.cache_hits++;
+      else if (give_up_on_password_store)
+        ctx->stats.cache_errors++;
+      else
+        ctx->stats.cache_misses++;
 
       if (password)
 	/* There is a cached password.  Try it.  */
 	{
 	  int len = strlen(password) + 1;
-	  if (len > pinentry.pin_len)
-	    len = pinentry.pin_len;
+	  if (len > ctx->pe.pin_len)
+	    len = ctx->pe.pin_len;
 
-	  memcpy (pinentry.pin, password, len);
-	  pinentry.pin[len] = '\0';
+	  memcpy (ctx->pe.pin, password, len);
+	  ctx->pe.pin[len] = '\0';
 
 	  secmem_free (password);
 
-	  pinentry.pin_from_cache = 1;
+	  ctx->pe.pin_from_cache = 1;
+
+	  ctx_write_status (ctx, "PASSWORD_FROM_CACHE", "");
 
-	  assuan_write_status (ctx, "PASSWORD_FROM_CACHE", "");
+	  write_timing_status (ctx, "getpin", timing);
 
 	  /* Result is the length of the password not including the
 	     NUL terminator.  */
-	  result = len - 1;
-
-	  just_read_password_from_cache = 1;
-
-	  goto out;
+	  return getpin_reply (ctx, len - 1, 1);
 	}
     }
 
   /* The password was not cached (or we are not allowed to / cannot
      use the cache).  Prompt the user.  */
-  pinentry.pin_from_cache = 0;
+  ctx->pe.pin_from_cache = 0;
+
+  if (!ctx->pe.prompt)
+    {
+      ctx->pe.prompt = ctx->pe.default_prompt?ctx->pe.default_prompt:"PIN:";
+      ctx->request.set_prompt = 1;
+    }
+  ctx->pe.locale_err = 0;
+  ctx->pe.specific_err = 0;
+  ctx->pe.specific_err_loc = NULL;
+  free (ctx->pe.specific_err_info);
+  ctx->pe.specific_err_info = NULL;
+  ctx->pe.close_button = 0;
+  ctx->pe.repeat_okay = 0;
+  ctx->pe.one_button = 0;
+  ctx->pe.ctx_assuan = ctx->assuan;
+  ctx->request.getpin = 1;
+  request_timing_start (ctx, timing);
+  result = run_cmd_handler (ctx);
+  return request_result (ctx, result, getpin_done);
+}
 
-  if (!pinentry.prompt)
-    {
-      pinentry.prompt = pinentry.default_prompt?pinentry.default_prompt:"PIN:";
-      set_prompt = 1;
-    }
-  pinentry.locale_err = 0;
-  pinentry.specific_err = 0;
-  pinentry.specific_err_loc = NULL;
-  free (pinentry.specific_err_info);
-  pinentry.specific_err_info = NULL;
-  pinentry.close_button = 0;
-  pinentry.repeat_okay = 0;
-  pinentry.one_button = 0;
-  pinentry.ctx_assuan = ctx;
-  result = (*pinentry_cmd_handler) (&pinentry);
-  pinentry.ctx_assuan = NULL;
-  if (pinentry.error)
-    {
-      free (pinentry.error);
-      pinentry.error = NULL;
-    }
-  if (pinentry.repeat_passphrase)
-    {
-      free (pinentry.repeat_passphrase);
-      pinentry.repeat_passphrase = NULL;
-    }
-  if (set_prompt)
-    pinentry.prompt = NULL;
 
-  pinentry.quality_bar = 0;  /* Reset it after the command.  */
+/* Finish CONFIRM or MESSAGE with the RESULT of the command handler.  */
+static gpg_error_t
+confirm_done (pinentry_ctx_t ctx, int result)
+{
+  write_timing_status (ctx, ctx->pe.one_button? "message" : "confirm",
+                       &ctx->request.timing);
+  ctx->pe.error = NULL;
 
-  if (pinentry.close_button)
-    assuan_write_status (ctx, "BUTTON_INFO", "close");
+  if (ctx->pe.close_button)
+    ctx_write_status (ctx, "BUTTON_INFO", "close");
 
-  if (result < 0)
-    {
-      pinentry_setbuffer_clear (&pinentry);
-      if (pinentry.specific_err)
-        {
-          write_status_error (ctx, &pinentry);
-          return pinentry.specific_err;
-        }
-      return (pinentry.locale_err
-	      ? gpg_error (GPG_ERR_LOCALE_PROBLEM)
-	      : gpg_error (GPG_ERR_CANCELED));
-    }
+  if (result > 0)
+    return 0; /* OK */
 
- out:
-  if (result)
+  if (ctx->pe.specific_err)
     {
-      if (pinentry.repeat_okay)
-        assuan_write_status (ctx, "PIN_REPEATED", "");
-      result = assuan_send_data (ctx, pinentry.pin, strlen(pinentry.pin));
-      if (!result)
-	result = assuan_send_data (ctx, NULL, 0);
-
-      if (/* GPG Agent says it's okay.  */
-	  pinentry.allow_external_password_cache && pinentry.keyinfo
-	  /* We didn't just read it from the cache.  */
-	  && ! just_read_password_from_cache
-	  /* And the user said it's okay.  */
-	  && pinentry.may_cache_password)
-	/* Cache the password.  */
-	password_cache_save (pinentry.keyinfo, pinentry.pin);
+      write_status_error (ctx);
+      return ctx->pe.specific_err;
     }
 
-  pinentry_setbuffer_clear (&pinentry);
+  if (ctx->pe.locale_err)
+    return gpg_error (GPG_ERR_LOCALE_PROBLEM);
+
+  if (ctx->pe.one_button)
+    return 0; /* OK */
 
-  return result;
+  if (ctx->pe.canceled)
+    return gpg_error (GPG_ERR_CANCELED);
+  return gpg_error (GPG_ERR_NOT_CONFIRMED);
 }
 
 
@@ -1653,59 +2846,109 @@ cmd_getpin (assuan_context_t ctx, char *line)
    command.  New applications which are free to require an updated
    pinentry should use MESSAGE instead. */
 static gpg_error_t
-cmd_confirm (assuan_context_t ctx, char *line)
+cmd_confirm (pinentry_ctx_t ctx, char *line)
 {
   int result;
 
-  pinentry.one_button = !!strstr (line, "--one-button");
-  pinentry.quality_bar = 0;
-  pinentry.close_button = 0;
-  pinentry.locale_err = 0;
-  pinentry.specific_err = 0;
-  pinentry.specific_err_loc = NULL;
-  free (pinentry.specific_err_info);
-  pinentry.specific_err_info = NULL;
-  pinentry.canceled = 0;
-  pinentry_setbuffer_clear (&pinentry);
-  result = (*pinentry_cmd_handler) (&pinentry);
-  if (pinentry.error)
-    {
-      free (pinentry.error);
-      pinentry.error = NULL;
-    }
+  memset (&ctx->request, 0, sizeof ctx->request);
+  ctx->pe.one_button = !!strstr (line, "--one-button");
+  ctx->pe.quality_bar = 0;
+  ctx->pe.close_button = 0;
+  ctx->pe.locale_err = 0;
+  ctx->pe.specific_err = 0;
+  ctx->pe.specific_err_loc = NULL;
+  free (ctx->pe.specific_err_info);
+  ctx->pe.specific_err_info = NULL;
+  ctx->pe.canceled = 0;
+  pinentry_setbuffer_clear (&ctx->pe);
+  request_timing_start (ctx, &ctx->request.timing);
+  result = run_cmd_handler (ctx);
+  return request_result (ctx, result, confirm_done);
+}
 
-  if (pinentry.close_button)
-    assuan_write_status (ctx, "BUTTON_INFO", "close");
 
-  if (result > 0)
-    return 0; /* OK */
+static gpg_error_t
+cmd_message (pinentry_ctx_t ctx, char *line)
+{
+  (void)line;
 
-  if (pinentry.specific_err)
-    {
-      write_status_error (ctx, &pinentry);
-      return pinentry.specific_err;
-    }
+  return cmd_confirm (ctx, "--one-button");
+}
 
-  if (pinentry.locale_err)
-    return gpg_error (GPG_ERR_LOCALE_PROBLEM);
 
-  if (pinentry.one_button)
-    return 0; /* OK */
+/* Send a line for GETINFO stats unless *RC already has an error.  */
+static void
+stats_printf (pinentry_ctx_t ctx, gpg_error_t *rc, const char *format, ...)
+{
+  va_list arg_ptr;
+  char buffer[100];
 
-  if (pinentry.canceled)
-    return gpg_error (GPG_ERR_CANCELED);
-  return gpg_error (GPG_ERR_NOT_CONFIRMED);
+  if (*rc)
+    return;
+
+  va_start (arg_ptr, format);
+  vsnprintf (buffer, sizeof buffer - 1, format, arg_ptr);
+  va_end (arg_ptr);
+  buffer[sizeof buffer - 2] = 0;
+  strcat (buffer, "\n");
+  *rc = ctx_send_data (ctx, buffer, strlen (buffer));
 }
 
 
+/* Send the lines of GETINFO stats.  */
 static gpg_error_t
-cmd_message (assuan_context_t ctx, char *line)
+send_stats (pinentry_ctx_t ctx)
 {
-  (void)line;
+  struct secmem_stats sm;
+  gpg_error_t rc = 0;
+  unsigned int i;
+
+  for (i = 0; i < ctx->stats.ncommands; i++)
+    stats_printf (ctx, &rc, "command %s %lu",
+                  ctx->stats.commands[i].name, ctx->stats.commands[i].count);
+  stats_printf (ctx, &rc, "command-other %lu", ctx->stats.other_commands);
+
+  stats_printf (ctx, &rc, "getpin-count %lu", ctx->stats.getpins);
+  stats_printf (ctx, &rc, "getpin-sum %.3f", ctx->stats.getpin_sum / 1e3);
+  for (i = 0; i < DIM (getpin_buckets); i++)
+    stats_printf (ctx, &rc, "getpin-bucket %u %lu",
+                  getpin_buckets[i], ctx->stats.getpin_hist[i]);
+  stats_printf (ctx, &rc, "getpin-bucket inf %lu", ctx->stats.getpin_hist[i]);
+
+  stats_printf (ctx, &rc, "quality-count %lu", ctx->stats.quality);
+  stats_printf (ctx, &rc, "quality-errors %lu", ctx->stats.quality_errors);
+  stats_printf (ctx, &rc, "quality-sum %.3f", ctx->stats.quality_sum / 1e3);
+  stats_printf (ctx, &rc, "quality-max %.3f", ctx->stats.quality_max / 1e3);
+
+  stats_printf (ctx, &rc, "cache-hits %lu", ctx->stats.cache_hits);
+  stats_printf (ctx, &rc, "cache-misses %lu", ctx->stats.cache_misses);
+  stats_printf (ctx, &rc, "cache-errors %lu", ctx->stats.cache_errors);
+
+  secmem_get_stats (&sm);
+  stats_printf (ctx, &rc, "secmem-poolsize %lu", (unsigned long)sm.poolsize);
+  stats_printf (ctx, &rc, "secmem-cur %lu", (unsigned long)sm.cur_alloced);
+  stats_printf (ctx, &rc, "secmem-peak %lu", (unsigned long)sm.max_alloced);
+  stats_printf (ctx, &rc, "secmem-blocks %u", sm.cur_blocks);
+  stats_printf (ctx, &rc, "secmem-peak-blocks %u", sm.max_blocks);
+  if (sm.backend)
+    stats_printf (ctx, &rc, "secmem-backend %s", sm.backend);
+  stats_printf (ctx, &rc, "secmem-setup %.3f", sm.setup_ms);
+
+  secmem_get_pool_stats (SECMEM_POOL_IO, &sm);
+  stats_printf (ctx, &rc, "secmem-io-poolsize %lu",
+                (unsigned long)sm.poolsize);
+  stats_printf (ctx, &rc, "secmem-io-cur %lu", (unsigned long)sm.cur_alloced);
+  stats_printf (ctx, &rc, "secmem-io-peak %lu", (unsigned long)sm.max_alloced);
+  stats_printf (ctx, &rc, "secmem-io-blocks %u", sm.cur_blocks);
+  stats_printf (ctx, &rc, "secmem-io-peak-blocks %u", sm.max_blocks);
+  if (sm.backend)
+    stats_printf (ctx, &rc, "secmem-io-backend %s", sm.backend);
+  stats_printf (ctx, &rc, "secmem-io-setup %.3f", sm.setup_ms);
 
-  return cmd_confirm (ctx, "--one-button");
+  return rc;
 }
 
+
 /* GETINFO <what>
 
    Multipurpose function to return a variety of information.
@@ -1715,9 +2958,11 @@ cmd_message (assuan_context_t ctx, char *line)
      pid         - Return the process id of the server.
      flavor      - Return information about the used pinentry flavor
      ttyinfo     - Return DISPLAY and ttyinfo.
+     stats       - Return runtime statistics as lines of the form
+                   "NAME VALUE..." with times in milliseconds.
  */
 static gpg_error_t
-cmd_getinfo (assuan_context_t ctx, char *line)
+cmd_getinfo (pinentry_ctx_t ctx, char *line)
 {
   int rc;
   const char *s;
@@ -1726,14 +2971,14 @@ cmd_getinfo (assuan_context_t ctx, char *line)
   if (!strcmp (line, "version"))
     {
       s = VERSION;
-      rc = assuan_send_data (ctx, s, strlen (s));
+      rc = ctx_send_data (ctx, s, strlen (s));
     }
   else if (!strcmp (line, "pid"))
     {
 
       snprintf (buffer, sizeof buffer, "%lu", (unsigned long)getpid ());
       buffer[sizeof buffer -1] = 0;
-      rc = assuan_send_data (ctx, buffer, strlen (buffer));
+      rc = ctx_send_data (ctx, buffer, strlen (buffer));
     }
   else if (!strcmp (line, "flavor"))
     {
@@ -1747,19 +2992,21 @@ cmd_getinfo (assuan_context_t ctx, char *line)
                 flavor_flag? ":":"",
                 flavor_flag? flavor_flag : "");
       buffer[sizeof buffer -1] = 0;
-      rc = assuan_send_data (ctx, buffer, strlen (buffer));
+      rc = ctx_send_data (ctx, buffer, strlen (buffer));
       /* if (!rc) */
-      /*   rc = assuan_write_status (ctx, "FEATURES", "tabbing foo bar"); */
+      /*   rc = ctx_write_status (ctx, "FEATURES", "tabbing foo bar"); */
     }
   else if (!strcmp (line, "ttyinfo"))
     {
       snprintf (buffer, sizeof buffer, "%s %s %s",
-                pinentry.ttyname? pinentry.ttyname : "-",
-                pinentry.ttytype? pinentry.ttytype : "-",
-                pinentry.display? pinentry.display : "-" );
+                ctx->pe.ttyname? ctx->pe.ttyname : "-",
+                ctx->pe.ttytype? ctx->pe.ttytype : "-",
+                ctx->pe.display? ctx->pe.display : "-" );
       buffer[sizeof buffer -1] = 0;
-      rc = assuan_send_data (ctx, buffer, strlen (buffer));
+      rc = ctx_send_data (ctx, buffer, strlen (buffer));
     }
+  else if (!strcmp (line, "stats"))
+    rc = send_stats (ctx);
   else
     rc = gpg_error (GPG_ERR_ASS_PARAMETER);
   return rc;
@@ -1771,7 +3018,7 @@ cmd_getinfo (assuan_context_t ctx, char *line)
    cacheid.
  */
 static gpg_error_t
-cmd_clear_passphrase (assuan_context_t ctx, char *line)
+cmd_clear_passphrase (pinentry_ctx_t ctx, char *line)
 {
   (void)ctx;
 
@@ -1792,42 +3039,81 @@ cmd_clear_passphrase (assuan_context_t ctx, char *line)
     }
 }
 
+/* Our commands.  */
+static const struct
+{
+  const char *name;
+  command_handler_t handler;
+} command_table[] =
+  {
+    { "SETDESC",    cmd_setdesc },
+    { "SETPROMPT",  cmd_setprompt },
+    { "SETKEYINFO", cmd_setkeyinfo },
+    { "SETREPEAT",  cmd_setrepeat },
+    { "SETREPEATERROR", cmd_setrepeaterror },
+    { "SETERROR",   cmd_seterror },
+    { "SETOK",      cmd_setok },
+    { "SETNOTOK",   cmd_setnotok },
+    { "SETCANCEL",  cmd_setcancel },
+    { "GETPIN",     cmd_getpin },
+    { "CONFIRM",    cmd_confirm },
+    { "MESSAGE",    cmd_message },
+    { "SETQUALITYBAR", cmd_setqualitybar },
+    { "SETQUALITYBAR_TT", cmd_setqualitybar_tt },
+    { "GETINFO",    cmd_getinfo },
+    { "SETTITLE",   cmd_settitle },
+    { "SETTIMEOUT", cmd_settimeout },
+    { "CLEARPASSPHRASE", cmd_clear_passphrase },
+    { NULL }
+  };
+
+
+/* Return the handler of the command NAME or NULL if it is not one of
+   ours.  */
+static command_handler_t
+find_command (const char *name)
+{
+  int i;
+
+  for (i = 0; command_table[i].name; i++)
+    if (!strcmp (command_table[i].name, name))
+      return command_table[i].handler;
+  return NULL;
+}
+
+
+/* The Assuan handler of all our commands.  Under assuan_process_next,
+   which pinentry_server_process uses, libassuan leaves it to the
+   handler to finish the command with assuan_process_done.  */
+static gpg_error_t
+dispatch_command (assuan_context_t ctx, char *line)
+{
+  pinentry_ctx_t pctx = assuan_get_pointer (ctx);
+  gpg_error_t rc;
+
+  if (pctx->current_command)
+    rc = pctx->current_command (pctx, line);
+  else
+    rc = gpg_error (GPG_ERR_ASS_UNKNOWN_CMD);
+  pctx->current_command = NULL;
+
+  if (!server.ctx || pctx->request.done)
+    return rc;
+  return assuan_process_done (ctx, rc);
+}
+
+
 /* Tell the assuan library about our commands.  */
 static gpg_error_t
 register_commands (assuan_context_t ctx)
 {
-  static struct
-  {
-    const char *name;
-    gpg_error_t (*handler) (assuan_context_t, char *line);
-  } table[] =
-    {
-      { "SETDESC",    cmd_setdesc },
-      { "SETPROMPT",  cmd_setprompt },
-      { "SETKEYINFO", cmd_setkeyinfo },
-      { "SETREPEAT",  cmd_setrepeat },
-      { "SETREPEATERROR", cmd_setrepeaterror },
-      { "SETERROR",   cmd_seterror },
-      { "SETOK",      cmd_setok },
-      { "SETNOTOK",   cmd_setnotok },
-      { "SETCANCEL",  cmd_setcancel },
-      { "GETPIN",     cmd_getpin },
-      { "CONFIRM",    cmd_confirm },
-      { "MESSAGE",    cmd_message },
-      { "SETQUALITYBAR", cmd_setqualitybar },
-      { "SETQUALITYBAR_TT", cmd_setqualitybar_tt },
-      { "GETINFO",    cmd_getinfo },
-      { "SETTITLE",   cmd_settitle },
-      { "SETTIMEOUT", cmd_settimeout },
-      { "CLEARPASSPHRASE", cmd_clear_passphrase },
-      { NULL }
-    };
-  int i, j;
+  int i;
   gpg_error_t rc;
 
-  for (i = j = 0; table[i].name; i++)
+  for (i = 0; command_table[i].name; i++)
     {
-      rc = assuan_register_command (ctx, table[i].name, table[i].handler, NULL);
+      rc = assuan_register_command (ctx, command_table[i].name,
+                                    dispatch_command, NULL);
       if (rc)
         return rc;
     }
@@ -1835,8 +3121,9 @@ register_commands (assuan_context_t ctx)
 }
 
 
-int
-pinentry_loop2 (int infd, int outfd)
+/* Create an Assuan server on INFD and OUTFD.  Returns NULL on error.  */
+static assuan_context_t
+server_new (int infd, int outfd)
 {
   gpg_error_t rc;
   assuan_fd_t filedes[2];
@@ -1853,7 +3140,7 @@ pinentry_loop2 (int infd, int outfd)
     {
       fprintf (stderr, "server context creation failed: %s\n",
 	       gpg_strerror (rc));
-      return -1;
+      return NULL;
     }
 
   /* For now we use a simple pipe based server so that we can work
@@ -1866,24 +3153,64 @@ pinentry_loop2 (int infd, int outfd)
     {
       fprintf (stderr, "%s: failed to initialize the server: %s\n",
                this_pgmname, gpg_strerror (rc));
-      return -1;
+      assuan_release (ctx);
+      return NULL;
     }
   rc = register_commands (ctx);
   if (rc)
     {
       fprintf (stderr, "%s: failed to the register commands with Assuan: %s\n",
                this_pgmname, gpg_strerror (rc));
-      return -1;
+      assuan_release (ctx);
+      return NULL;
     }
 
+  assuan_set_pointer (ctx, &default_ctx);
+  default_ctx.assuan = ctx;
   assuan_register_option_handler (ctx, option_handler);
 #if 0
   assuan_set_log_stream (ctx, stderr);
 #endif
+  record_init ();
+  if (record_fp)
+    assuan_set_io_monitor (ctx, record_io_monitor, NULL);
   assuan_register_reset_notify (ctx, pinentry_assuan_reset_handler);
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
+
+  return ctx;
+}
+
+
+/* Release the server CTX after the connection has ended.  */
+static void
+server_release (assuan_context_t ctx)
+{
+  assuan_release (ctx);
+  default_ctx.assuan = NULL;
+  if (record_fp)
+    {
+      fclose (record_fp);
+      record_fp = NULL;
+    }
+
+  /* The connection is gone; release the prompt strings.  */
+  pinentry_reset (&default_ctx, 0);
+}
+
+
+int
+pinentry_loop2 (int infd, int outfd)
+{
+  gpg_error_t rc;
+  assuan_context_t ctx;
+
+  ctx = server_new (infd, outfd);
+  if (!ctx)
+    return -1;
 
   for (;;)
     {
+      pinentry_timing ("ready");
       rc = assuan_accept (ctx);
       if (rc == -1)
           break;
@@ -1903,7 +3230,7 @@ pinentry_loop2 (int infd, int outfd)
         }
     }
 
-  assuan_release (ctx);
+  server_release (ctx);
   return 0;
 }
 
@@ -1916,3 +3243,259 @@ pinentry_loop (void)
 {
   return pinentry_loop2 (STDIN_FILENO, STDOUT_FILENO);
 }
+
+
+int
+pinentry_server_start (int infd, int outfd)
+{
+  gpg_error_t rc;
+
+  if (server.ctx)
+    return -1;
+
+  server.ctx = server_new (infd, outfd);
+  if (!server.ctx)
+    return -1;
+
+  pinentry_timing ("ready");
+  rc = assuan_accept (server.ctx);
+  if (rc)
+    {
+      fprintf (stderr, "%s: Assuan accept problem: %s\n",
+               this_pgmname, gpg_strerror (rc));
+      server_release (server.ctx);
+      memset (&server, 0, sizeof server);
+      return -1;
+    }
+  return 0;
+}
+
+
+int
+pinentry_server_fd (void)
+{
+#ifdef HAVE_W32_SYSTEM
+  return -1;
+#else
+  assuan_fd_t fds[1];
+
+  if (!server.ctx
+      || assuan_get_active_fds (server.ctx, 0, fds, DIM (fds)) < 1)
+    return -1;
+  return fds[0];
+#endif
+}
+
+
+int
+pinentry_server_process (void)
+{
+  gpg_error_t rc;
+  int done = 0;
+
+  if (!server.ctx)
+    return -1;
+  if (server.gone)
+    return 1;
+
+  /* A command handler running a dialog may get here again from its
+     own main loop.  libassuan then reads the line but does not
+     dispatch it, so that only the end of the connection is seen.  */
+  server.depth++;
+  rc = assuan_process_next (server.ctx, &done);
+  server.depth--;
+
+  if (rc && rc != -1 && gpg_err_code (rc) != GPG_ERR_EOF)
+    fprintf (stderr, "%s: Assuan processing failed: %s\n",
+             this_pgmname, gpg_strerror (rc));
+  else if (rc || done)
+    server.gone = 1;
+
+  if (server.stop && !server.depth)
+    {
+      pinentry_server_stop ();
+      return 1;
+    }
+  return server.gone;
+}
+
+
+int
+pinentry_command_done (pinentry_t pin, int result)
+{
+  pinentry_ctx_t ctx = &default_ctx;
+  gpg_error_t (*done) (pinentry_ctx_t, int) = ctx->request.done;
+
+  if (!server.ctx || pin != &ctx->pe || !done)
+    return -1;
+
+  ctx->request.done = NULL;
+  assuan_process_done (server.ctx, done (ctx, result));
+
+  /* Lines which arrived meanwhile may already be buffered, in which
+     case the descriptor does not become readable for them.  */
+  if (!server.gone && assuan_pending_line (server.ctx))
+    return pinentry_server_process ();
+  return server.gone;
+}
+
+
+void
+pinentry_server_stop (void)
+{
+  if (!server.ctx)
+    return;
+
+  if (server.depth)
+    {
+      server.stop = 1;
+      return;
+    }
+
+  if (default_ctx.request.done)
+    {
+      /* Drop the deferred request; there is nobody to answer.  */
+      default_ctx.request.done = NULL;
+      default_ctx.request.getpin = 0;
+      default_ctx.pe.ctx_assuan = NULL;
+      pinentry_setbuffer_clear (&default_ctx.pe);
+    }
+  server_release (server.ctx);
+  memset (&server, 0, sizeof server);
+}
+
+
+
+pinentry_ctx_t
+pinentry_ctx_new (pinentry_cmd_handler_t handler,
+                  const struct pinentry_ctx_cbs *cbs, void *opaque)
+{
+  pinentry_ctx_t ctx;
+
+  ctx = calloc (1, sizeof *ctx);
+  if (!ctx)
+    return NULL;
+  ctx->handler = handler;
+  if (cbs)
+    ctx->cbs = *cbs;
+  ctx->opaque = opaque;
+  pinentry_reset (ctx, 1);
+  return ctx;
+}
+
+
+void
+pinentry_ctx_release (pinentry_ctx_t ctx)
+{
+  if (!ctx || ctx == &default_ctx)
+    return;
+
+  pinentry_reset (ctx, 1);
+  arena_release (&ctx->session_strings, 0);
+  arena_release (&ctx->request_strings, 0);
+#ifndef HAVE_W32_SYSTEM
+  free (ctx->owner_info.host);
+  free (ctx->owner_info.title);
+#endif
+  free (ctx);
+}
+
+
+void *
+pinentry_get_opaque (pinentry_t pin)
+{
+  return ctx_of (pin)->opaque;
+}
+
+
+/* Parse the arguments of OPTION in LINE the way libassuan does and
+   set the option in CTX.  */
+static gpg_error_t
+ctx_option_line (pinentry_ctx_t ctx, char *line)
+{
+  char *key, *value, *p;
+
+  for (key = line; *key == ' ' || *key == '\t'; key++)
+    ;
+  if (!*key || *key == '=')
+    return gpg_error (GPG_ERR_ASS_SYNTAX);
+  for (value = key; *value && *value != ' ' && *value != '\t'
+         && *value != '='; value++)
+    ;
+  if (*value)
+    {
+      if (*value == ' ' || *value == '\t')
+        *value++ = 0;
+      while (*value == ' ' || *value == '\t')
+        value++;
+      if (*value == '=')
+        {
+          *value++ = 0;
+          while (*value == ' ' || *value == '\t')
+            value++;
+          if (!*value)
+            return gpg_error (GPG_ERR_ASS_SYNTAX);
+        }
+      for (p = value + strlen (value);
+           p > value && (p[-1] == ' ' || p[-1] == '\t'); p--)
+        p[-1] = 0;
+    }
+
+  /* The double dashes are optional.  */
+  if (key[0] == '-' && key[1] == '-' && key[2])
+    key += 2;
+  if (*key == '-')
+    return gpg_error (GPG_ERR_ASS_SYNTAX);
+
+  return pinentry_ctx_option (ctx, key, value);
+}
+
+
+int
+pinentry_ctx_command (pinentry_ctx_t ctx, const char *line)
+{
+  char buffer[ASSUAN_LINELENGTH + 1];
+  command_handler_t handler;
+  char *args;
+  size_t n;
+
+  n = strlen (line);
+  if (n >= sizeof buffer)
+    return gpg_error (GPG_ERR_ASS_LINE_TOO_LONG);
+  memcpy (buffer, line, n + 1);
+
+  /* Split off the command name and make it upper case.  */
+  for (args = buffer; *args && *args != ' ' && *args != '\t'; args++)
+    if (*args >= 'a' && *args <= 'z')
+      *args -= 'a' - 'A';
+  if (*args)
+    *args++ = 0;
+  while (*args == ' ' || *args == '\t')
+    args++;
+
+  if (!*buffer)
+    return gpg_error (GPG_ERR_ASS_SYNTAX);
+
+  if (!strcmp (buffer, "OPTION"))
+    {
+      stats_count_command (ctx, buffer);
+      return ctx_option_line (ctx, args);
+    }
+  if (!strcmp (buffer, "RESET"))
+    {
+      stats_count_command (ctx, buffer);
+      pinentry_reset (ctx, 0);
+      return 0;
+    }
+  if (!strcmp (buffer, "NOP") || !strcmp (buffer, "BYE"))
+    {
+      stats_count_command (ctx, buffer);
+      return 0;
+    }
+
+  handler = find_command (buffer);
+  if (!handler)
+    return gpg_error (GPG_ERR_ASS_UNKNOWN_CMD);
+  stats_count_command (ctx, buffer);
+  return handler (ctx, args);
+}
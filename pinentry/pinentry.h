@@ -36,6 +36,12 @@ typedef enum {
   PINENTRY_COLOR_CYAN, PINENTRY_COLOR_WHITE
 } pinentry_color_t;
 
+/* Events recorded by pinentry_keybench_mark.  */
+typedef enum {
+  PINENTRY_KEYBENCH_KEY,	/* A synthetic key event has been queued.  */
+  PINENTRY_KEYBENCH_PAINT	/* The passphrase entry has been repainted.  */
+} pinentry_keybench_t;
+
 struct pinentry
 {
   /* The window title, or NULL.  (Assuan: "SETTITLE TITLE".)  */
@@ -95,6 +101,11 @@ struct pinentry
      or "OPTION no-grab".)  */
   int grab;
 
+  /* True if GETPIN and CONFIRM shall send a TIMING status line with
+     the breakdown of the time they took.  (Assuan: "OPTION
+     timing-status".)  */
+  int timing_status;
+
   /* The PID of the owner or 0 if not known.  The owner is the process
    * which actually triggered the the pinentry.  For example gpg.  */
   unsigned long owner_pid;
@@ -103,12 +114,12 @@ struct pinentry
    * known. */
   int owner_uid;
 
-  /* The malloced hostname of the owner or NULL.  */
+  /* The hostname of the owner or NULL.  */
   char *owner_host;
 
   /* The window ID of the parent window over which the pinentry window
      should be displayed.  (Assuan: "OPTION parent-wid WID".)  */
-  int parent_wid;
+  unsigned long parent_wid;
 
   /* The name of an optional file which will be touched after a curses
      entry has been displayed.  (Assuan: "OPTION touch-file
@@ -170,7 +181,7 @@ struct pinentry
      "SETQUALITYBAR LABEL".)  */
   char *quality_bar;
 
-  /* The tooltip to be show for the qualitybar.  Malloced or NULL.
+  /* The tooltip to be show for the qualitybar or NULL.
      (Assuan: "SETQUALITYBAR_TT TOOLTIP".)  */
   char *quality_bar_tt;
 
@@ -181,7 +192,7 @@ struct pinentry
   pinentry_color_t color_so;
   int color_so_bright;
 
-  /* Malloced and i18ned default strings or NULL.  These strings may
+  /* I18ned default strings or NULL.  These strings may
      include an underscore character to indicate an accelerator key.
      A double underscore represents a plain one.  */
   /* (Assuan: "OPTION default-ok OK").  */
@@ -217,8 +228,11 @@ struct pinentry
   /* Whether we may cache the password (according to the user).  */
   int may_cache_password;
 
-  /* NOTE: If you add any additional fields to this structure, be sure
-     to update the initializer in pinentry/pinentry.c!!!  */
+  /* NOTE: The strings of this structure, except for
+     SPECIFIC_ERR_INFO, are owned by the library and released as a
+     whole on RESET; frontends must not free or realloc them.  If you
+     add a field which needs to survive a RESET, be sure to save it in
+     pinentry_reset in pinentry/pinentry.c!!!  */
 
   /* For the quality indicator we need to do an inquiry.  Thus we need
      to save the assuan ctx.  */
@@ -254,6 +268,83 @@ int pinentry_loop (void);
 int pinentry_loop2 (int infd, int outfd);
 
 
+/* Instead of the blocking pinentry_loop, a frontend with its own main
+   loop may run the server from that loop.  pinentry_server_start sets
+   it up on INFD and OUTFD and returns 0, or -1 on error.  The frontend
+   then watches the descriptor returned by pinentry_server_fd and
+   calls pinentry_server_process whenever it is readable, including
+   while a dialog is shown from within a command handler; in that case
+   only the end of the connection is processed.  pinentry_server_process
+   returns 0 to go on and 1 once the connection has ended.  The
+   frontend then stops watching, closes an open dialog as canceled,
+   leaves its main loop and calls pinentry_server_stop.  */
+int pinentry_server_start (int infd, int outfd);
+int pinentry_server_fd (void);
+int pinentry_server_process (void);
+void pinentry_server_stop (void);
+
+/* A command handler run by pinentry_server_process may return this
+   to show its dialog without blocking.  Once it has the result it
+   would have returned, it calls pinentry_command_done.  Returns
+   the same as pinentry_server_process, or -1 if no result is
+   pending.  */
+#define PINENTRY_DEFERRED (-1000)
+int pinentry_command_done (pinentry_t pin, int result);
+
+
+/* A program may also embed the library and run the requests of
+   several sessions in-process, each with its own context.  Each
+   context holds a struct pinentry, its strings and statistics, and
+   is independent of the others and of the context of the Assuan
+   server.  Call pinentry_init first.  With POSIX threads, different
+   threads may work on different contexts at the same time, but a
+   context must only be used by one thread at a time.  */
+typedef struct pinentry_ctx_s *pinentry_ctx_t;
+
+/* The callbacks receiving what the server would send to its client.
+   They return 0 or a gpg-error code; each may be NULL.  */
+struct pinentry_ctx_cbs
+{
+  /* Take LENGTH bytes of the data sent by a command, which may be
+     split over several calls.  For GETPIN this is the passphrase;
+     BUFFER is secure memory and only valid during the call.  */
+  int (*data) (void *opaque, const void *buffer, size_t length);
+
+  /* Take the status line KEYWORD ARGS, e.g. "PIN_REPEATED".  */
+  int (*status) (void *opaque, const char *keyword, const char *args);
+
+  /* Return the quality of the PASSPHRASE of LENGTH being entered in
+     the range -100 to 100, the answer to INQUIRE QUALITY.  */
+  int (*quality) (void *opaque, const char *passphrase, size_t length);
+};
+
+/* Create a context whose requests are processed by HANDLER, or by
+   pinentry_cmd_handler if it is NULL.  CBS, which is copied, and
+   OPAQUE, which is passed to the callbacks, tell where the output
+   goes.  Returns NULL with errno set on error.  */
+pinentry_ctx_t pinentry_ctx_new (pinentry_cmd_handler_t handler,
+                                 const struct pinentry_ctx_cbs *cbs,
+                                 void *opaque);
+
+/* Release CTX and all its strings.  */
+void pinentry_ctx_release (pinentry_ctx_t ctx);
+
+/* Set the option KEY to VALUE in CTX as "OPTION KEY=VALUE" does; use
+   "" for options without a value.  Returns 0 or a gpg-error code.  */
+int pinentry_ctx_option (pinentry_ctx_t ctx, const char *key,
+                         const char *value);
+
+/* Run the Assuan command LINE, e.g. "SETDESC Foo%0ABar" or "GETPIN",
+   in CTX as the server would but without any I/O.  The command
+   handler runs before this returns; PINENTRY_DEFERRED is not
+   supported.  Returns 0 or the gpg-error code of the ERR line.  */
+int pinentry_ctx_command (pinentry_ctx_t ctx, const char *line);
+
+/* Return the OPAQUE value of the context of PIN; for use by a command
+   handler.  NULL for the server.  */
+void *pinentry_get_opaque (pinentry_t pin);
+
+
 /* Convert the UTF-8 encoded string TEXT to the encoding given in
    LC_CTYPE.  Return NULL on error. */
 char *pinentry_utf8_to_local (const char *lc_ctype, const char *text);
@@ -269,6 +360,27 @@ char *pinentry_get_title (pinentry_t pe);
 int pinentry_inq_quality (pinentry_t pin,
                           const char *passphrase, size_t length);
 
+/* Return the number of synthetic keystrokes a frontend shall type
+   into the passphrase entry to measure its keystroke latency, or 0 if
+   the envvar PINENTRY_KEYBENCH does not request this.  After the last
+   key the frontend shall accept the entry.  */
+int pinentry_keybench_keys (void);
+
+/* Record the event WHAT for the current synthetic keystroke of the
+   request whose command handler runs in the calling thread, or of the
+   server if there is none.  Returns true if it was recorded; for
+   PINENTRY_KEYBENCH_PAINT that is only the case for the first repaint
+   after a key.  */
+int pinentry_keybench_mark (pinentry_keybench_t what);
+
+/* Print the time since the start of the process if the envvar
+   PINENTRY_TIMING asks for it and PHASE has not been reached before.
+   The frontends mark "toolkit" once the toolkit is initialized and
+   "dialog" each time a dialog becomes visible; the latter is also
+   the start of the GETPIN latency reported by GETINFO stats of the
+   request whose command handler runs in the calling thread.  */
+void pinentry_timing (const char *phase);
+
 /* Try to make room for at least LEN bytes for the pin in the pinentry
    PIN.  Returns new buffer on success and 0 on failure.  */
 char *pinentry_setbufferlen (pinentry_t pin, int len);
@@ -284,7 +396,7 @@ void pinentry_setbuffer_use (pinentry_t pin, char *buffer, int len);
 void pinentry_init (const char *pgmname);
 
 /* Return true if either DISPLAY is set or ARGV contains the string
-   "--display". */
+   "--display" and that display is not known to be unreachable.  */
 int pinentry_have_display (int argc, char **argv);
 
 /* Parse the command line options.  May exit the program if only help
@@ -296,7 +408,9 @@ void pinentry_set_flavor_flag (const char *string);
 
 
 
-/* The caller must define this variable to process assuan commands.  */
+/* The caller must define this variable to process assuan commands.
+   A program using only contexts with their own handler may set it
+   to NULL.  */
 extern pinentry_cmd_handler_t pinentry_cmd_handler;
 
 
@@ -0,0 +1,819 @@
+/* spawn-bench.c - Start many pinentries and measure their latencies
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of PINENTRY.
+ *
+ * PINENTRY is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PINENTRY is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* This program starts the given pinentry programs as gpg-agent does,
+ * several of them concurrently, and talks Assuan to each of them.
+ * For every program it reports
+ *
+ *   ready     - the time from fork until the greeting arrived,
+ *   first-ok  - the time from fork until the first command was
+ *               answered,
+ *   getpin    - the round trip time of a GETPIN,
+ *   rss       - the peak resident set size of the pinentry,
+ *
+ * as the median and the 99th percentile over all runs.
+ *
+ * Each pinentry gets its own pseudo terminal which is passed with
+ * OPTION ttyname.  The tty and curses flavors (including GUI flavors
+ * which fell back to curses) are answered by typing a passphrase into
+ * that terminal once they have drawn their prompt.  pinentry-script
+ * answers by itself.  Other flavors can't be answered without a
+ * human; for them GETPIN is not run.  With --xvfb a private Xvfb
+ * server is started and used as the display for the GUI flavors.
+ *
+ * With --keys N the pinentries are asked through PINENTRY_KEYBENCH
+ * to type N synthetic keys into their entry with a quality bar shown
+ * and to accept it; the frontends supporting this can thus also be
+ * benchmarked on Xvfb or with QT_QPA_PLATFORM=offscreen.  The KEYBENCH
+ * status lines they send are summarized as the delay from the key to
+ * the INQUIRE QUALITY, to its reply and to the repaint of the
+ * entry.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define PGM "spawn-bench"
+
+/* As in libassuan.  */
+#define LINELENGTH 1002
+
+#define MAX_GETPINS 64
+#define MAX_KEYSAMPLES 96
+
+
+/* The result of one pinentry run as sent from the worker process to
+ * the parent.  All times are in milliseconds since the fork.  It is
+ * smaller than PIPE_BUF so that it is written atomically.  */
+struct sample
+{
+  int failed;
+  char flavor[32];
+  double ready;
+  double first_ok;
+  int ngetpins;
+  double getpin[MAX_GETPINS];
+  long maxrss;  /* In KiB.  */
+  int nkeys;
+  float keybench[MAX_KEYSAMPLES][3];  /* Inquire, reply, paint.  */
+};
+
+/* The connection to one pinentry.  */
+struct conn
+{
+  pid_t pid;
+  int to;          /* Its stdin.  */
+  int from;        /* Its stdout.  */
+  int pty;         /* Master side of its terminal.  */
+  int slave;       /* Keeps the terminal open between prompts.  */
+  char ttyname[64];
+  struct sample *sample;  /* Receives the KEYBENCH samples.  */
+  int type_pending;  /* The passphrase is still to be typed.  */
+  int prompted;      /* The pinentry has written to its terminal.  */
+  double deadline;
+  char buf[4096];
+  size_t len;
+};
+
+static int verbose;
+static int timeout = 30;
+static int ngetpins = 3;
+static int keys;
+static pid_t xvfb_pid;
+
+static const char passphrase[] = "correct horse battery staple";
+
+
+static double
+now_msec (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+
+
+static int
+open_pty (struct conn *c)
+{
+  const char *name;
+
+  c->pty = posix_openpt (O_RDWR | O_NOCTTY);
+  if (c->pty == -1)
+    return -1;
+  if (grantpt (c->pty) || unlockpt (c->pty) || !(name = ptsname (c->pty))
+      || strlen (name) >= sizeof c->ttyname)
+    {
+      close (c->pty);
+      return -1;
+    }
+  strcpy (c->ttyname, name);
+  fcntl (c->pty, F_SETFL, fcntl (c->pty, F_GETFL) | O_NONBLOCK);
+
+  /* Without an open slave the master reports a hangup and typed
+     input may be lost while the pinentry has closed the terminal.  */
+  c->slave = open (name, O_RDWR | O_NOCTTY);
+  if (c->slave == -1)
+    {
+      close (c->pty);
+      return -1;
+    }
+  return 0;
+}
+
+
+static int
+spawn (struct conn *c, const char *pgm)
+{
+  int to[2], from[2];
+  int fd;
+
+  if (pipe (to))
+    return -1;
+  if (pipe (from))
+    {
+      close (to[0]);
+      close (to[1]);
+      return -1;
+    }
+
+  c->pid = fork ();
+  if (c->pid == (pid_t)-1)
+    return -1;
+  if (!c->pid)
+    {
+      dup2 (to[0], 0);
+      dup2 (from[1], 1);
+      if (!verbose)
+        {
+          fd = open ("/dev/null", O_WRONLY);
+          if (fd != -1)
+            dup2 (fd, 2);
+        }
+      for (fd = 3; fd < 256; fd++)
+        close (fd);
+      /* Don't let a curses fallback grab our own terminal.  */
+      setsid ();
+      execl (pgm, pgm, (char *)NULL);
+      fprintf (stderr, PGM ": can't exec '%s': %s\n", pgm, strerror (errno));
+      _exit (127);
+    }
+  close (to[0]);
+  close (from[1]);
+  c->to = to[1];
+  c->from = from[0];
+  return 0;
+}
+
+
+/* Read what the pinentry wrote to its terminal.  This is done
+ * whenever we wait for it so that it never blocks on a full pty.  */
+static void
+drain_pty (struct conn *c)
+{
+  char buf[1024];
+
+  while (read (c->pty, buf, sizeof buf) > 0)
+    if (c->type_pending)
+      c->prompted = 1;
+}
+
+
+/* Type the passphrase once the pinentry has shown its prompt and
+ * switched off the echo.  Typing earlier races with its change of
+ * the terminal modes.  */
+static void
+type_passphrase (struct conn *c)
+{
+  struct termios tio;
+  char buf[sizeof passphrase + 1];
+
+  if (!c->type_pending || !c->prompted
+      || tcgetattr (c->slave, &tio) || (tio.c_lflag & ECHO))
+    return;
+
+  strcpy (buf, passphrase);
+  strcat (buf, "\r");
+  if (write (c->pty, buf, strlen (buf)) == strlen (buf))
+    c->type_pending = 0;
+}
+
+
+static int
+write_line (struct conn *c, const char *line)
+{
+  size_t n = strlen (line);
+  ssize_t nw;
+
+  while (n)
+    {
+      nw = write (c->to, line, n);
+      if (nw < 0 && errno == EINTR)
+        continue;
+      if (nw < 0)
+        return -1;
+      line += nw;
+      n -= nw;
+    }
+  return 0;
+}
+
+
+/* Read one line into LINE of SIZE bytes.  Return -1 on EOF, error
+ * or timeout.  */
+static int
+read_line (struct conn *c, char *line, size_t size)
+{
+  struct pollfd pfd[2];
+  char *nl;
+  ssize_t nr;
+  size_t n;
+  int ms;
+
+  while (!(nl = memchr (c->buf, '\n', c->len)))
+    {
+      if (c->len == sizeof c->buf)
+        return -1;
+
+      ms = (int)(c->deadline - now_msec ());
+      if (ms <= 0)
+        return -1;
+      /* The terminal modes can't be polled for.  */
+      if (c->type_pending && ms > 5)
+        ms = 5;
+      pfd[0].fd = c->from;
+      pfd[0].events = POLLIN;
+      pfd[1].fd = c->pty;
+      pfd[1].events = POLLIN;
+      if (poll (pfd, 2, ms) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return -1;
+        }
+      if (pfd[1].revents & POLLIN)
+        drain_pty (c);
+      type_passphrase (c);
+      if (!(pfd[0].revents & (POLLIN | POLLHUP)))
+        continue;
+
+      nr = read (c->from, c->buf + c->len, sizeof c->buf - c->len);
+      if (nr < 0 && errno == EINTR)
+        continue;
+      if (nr <= 0)
+        return -1;
+      c->len += nr;
+    }
+
+  n = nl - c->buf;
+  if (n >= size)
+    n = size - 1;
+  memcpy (line, c->buf, n);
+  line[n] = 0;
+  c->len -= nl + 1 - c->buf;
+  memmove (c->buf, nl + 1, c->len);
+  if (verbose > 1)
+    fprintf (stderr, PGM "[%lu]: <- %s\n", (unsigned long)c->pid, line);
+  return 0;
+}
+
+
+/* Run COMMAND and wait for its final OK or ERR.  The first data line
+ * is stored in DATA of SIZE bytes if DATA is not NULL.  Return 0 for
+ * OK, 1 for ERR and -1 if the connection failed.  */
+static int
+transact (struct conn *c, const char *command, char *data, size_t size)
+{
+  char line[LINELENGTH + 2];
+  size_t n;
+
+  if (verbose > 1)
+    fprintf (stderr, PGM "[%lu]: -> %s\n", (unsigned long)c->pid, command);
+  if (write_line (c, command) || write_line (c, "\n"))
+    return -1;
+  for (;;)
+    {
+      if (read_line (c, line, sizeof line))
+        return -1;
+      if (!strncmp (line, "OK", 2) && (!line[2] || line[2] == ' '))
+        return 0;
+      if (!strncmp (line, "ERR", 3) && (!line[3] || line[3] == ' '))
+        {
+          if (verbose)
+            fprintf (stderr, PGM ": %s: %s\n", command, line);
+          return 1;
+        }
+      if (!strncmp (line, "D ", 2) && data)
+        {
+          n = strlen (line + 2);
+          if (n >= size)
+            n = size - 1;
+          memcpy (data, line + 2, n);
+          data[n] = 0;
+          data = NULL;
+        }
+      else if (!strncmp (line, "S KEYBENCH ", 11) && c->sample
+               && c->sample->nkeys < MAX_KEYSAMPLES)
+        {
+          float *kb = c->sample->keybench[c->sample->nkeys];
+
+          if (sscanf (line + 11, "%*d %f %f %f", kb, kb + 1, kb + 2) == 3)
+            c->sample->nkeys++;
+        }
+      else if (!strncmp (line, "INQUIRE QUALITY", 15))
+        write_line (c, "D 50\nEND\n");
+      else if (!strncmp (line, "INQUIRE", 7))
+        write_line (c, "CAN\n");
+    }
+}
+
+
+/* Return true if a flavor can be answered through its terminal or
+ * answers by itself.  */
+static int
+answerable (const char *flavor)
+{
+  return (!strcmp (flavor, "tty") || !strcmp (flavor, "script")
+          || strstr (flavor, "curses"));
+}
+
+
+/* Run one session with PGM and store the results in S.  */
+static void
+run_one (const char *pgm, struct sample *s)
+{
+  static const char *options[] =
+    {
+      "OPTION ttytype=vt100",
+      "OPTION lc-ctype=C",
+      "OPTION allow-external-password-cache",
+      "OPTION default-ok=_OK",
+      "OPTION default-cancel=_Cancel",
+      "OPTION default-prompt=PIN:",
+      NULL
+    };
+  struct conn c;
+  char line[LINELENGTH + 2];
+  struct rusage ru;
+  double t0, t1;
+  int i, status;
+
+  memset (s, 0, sizeof *s);
+  memset (&c, 0, sizeof c);
+  s->failed = 1;
+  strcpy (s->flavor, "?");
+
+  if (open_pty (&c))
+    {
+      fprintf (stderr, PGM ": can't open a pty: %s\n", strerror (errno));
+      return;
+    }
+
+  t0 = now_msec ();
+  c.deadline = t0 + timeout * 1000.0;
+  if (spawn (&c, pgm))
+    {
+      fprintf (stderr, PGM ": can't start '%s': %s\n", pgm, strerror (errno));
+      close (c.slave);
+      close (c.pty);
+      return;
+    }
+
+  if (read_line (&c, line, sizeof line) || strncmp (line, "OK", 2))
+    goto leave;
+  s->ready = now_msec () - t0;
+
+  snprintf (line, sizeof line, "OPTION ttyname=%s", c.ttyname);
+  if (transact (&c, line, NULL, 0))
+    goto leave;
+  s->first_ok = now_msec () - t0;
+
+  for (i = 0; options[i]; i++)
+    if (transact (&c, options[i], NULL, 0) < 0)
+      goto leave;
+  if (transact (&c, "GETINFO flavor", s->flavor, sizeof s->flavor))
+    goto leave;
+  if (transact (&c, "SETKEYINFO n/0123456789ABCDEF0123456789ABCDEF01234567",
+                NULL, 0)
+      || transact (&c, "SETDESC Please enter the passphrase to unlock the"
+                   " OpenPGP secret key.", NULL, 0)
+      || transact (&c, "SETPROMPT Passphrase:", NULL, 0))
+    goto leave;
+  if (keys && transact (&c, "SETQUALITYBAR", NULL, 0))
+    goto leave;
+
+  c.sample = s;
+  if (keys || answerable (s->flavor))
+    for (i = 0; i < ngetpins && i < MAX_GETPINS; i++)
+      {
+        drain_pty (&c);
+        c.type_pending = 1;
+        c.prompted = 0;
+        t1 = now_msec ();
+        if (transact (&c, "GETPIN", NULL, 0))
+          goto leave;
+        s->getpin[s->ngetpins++] = now_msec () - t1;
+      }
+
+  transact (&c, "BYE", NULL, 0);
+  s->failed = 0;
+
+ leave:
+  close (c.to);
+  close (c.from);
+  if (s->failed)
+    kill (c.pid, SIGKILL);
+  while (wait4 (c.pid, &status, 0, &ru) == -1 && errno == EINTR)
+    ;
+  s->maxrss = ru.ru_maxrss;
+  close (c.slave);
+  close (c.pty);
+}
+
+
+
+/* A list of samples.  */
+struct series
+{
+  double *v;
+  size_t n;
+  size_t nalloced;
+};
+
+static void
+add_value (struct series *se, double value)
+{
+  if (se->n == se->nalloced)
+    {
+      se->nalloced = se->nalloced? 2 * se->nalloced : 64;
+      se->v = realloc (se->v, se->nalloced * sizeof *se->v);
+      if (!se->v)
+        {
+          fprintf (stderr, PGM ": out of core\n");
+          exit (1);
+        }
+    }
+  se->v[se->n++] = value;
+}
+
+static int
+cmp_double (const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return x < y? -1 : x > y;
+}
+
+/* Print the median and the 99th percentile of SE.  */
+static void
+print_series (struct series *se)
+{
+  size_t idx;
+
+  if (!se->n)
+    {
+      printf (" %8s %8s", "-", "-");
+      return;
+    }
+  qsort (se->v, se->n, sizeof *se->v, cmp_double);
+  idx = (se->n * 99) / 100;
+  if (idx >= se->n)
+    idx = se->n - 1;
+  printf (" %8.1f %8.1f", se->v[se->n / 2], se->v[idx]);
+}
+
+
+/* Run PGM RUNS times with up to JOBS instances at once and print a
+ * line with the results.  */
+static void
+bench (const char *pgm, int runs, int jobs)
+{
+  struct series ready = { 0 }, first_ok = { 0 }, getpin = { 0 };
+  struct series keybench[3] = { { 0 } };
+  struct sample s;
+  char flavor[32];
+  long maxrss = 0;
+  int started = 0, running = 0, done = 0, failed = 0, reaped = 0;
+  const char *name;
+  ssize_t n;
+  int fds[2];
+  pid_t pid;
+  int i, j;
+
+  if (pipe (fds))
+    {
+      fprintf (stderr, PGM ": pipe failed: %s\n", strerror (errno));
+      exit (1);
+    }
+
+  strcpy (flavor, "?");
+  while (done < runs)
+    {
+      while (running < jobs && started < runs)
+        {
+          pid = fork ();
+          if (pid == (pid_t)-1)
+            {
+              fprintf (stderr, PGM ": fork failed: %s\n", strerror (errno));
+              exit (1);
+            }
+          if (!pid)
+            {
+              close (fds[0]);
+              run_one (pgm, &s);
+              if (write (fds[1], &s, sizeof s) != sizeof s)
+                _exit (1);
+              _exit (0);
+            }
+          started++;
+          running++;
+        }
+
+      n = read (fds[0], &s, sizeof s);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n != sizeof s)
+        {
+          fprintf (stderr, PGM ": lost a worker\n");
+          exit (1);
+        }
+      running--;
+      done++;
+      while ((pid = waitpid (-1, NULL, WNOHANG)) > 0)
+        if (pid != xvfb_pid)
+          reaped++;
+
+      if (s.failed)
+        {
+          failed++;
+          continue;
+        }
+      if (!strcmp (flavor, "?"))
+        strcpy (flavor, s.flavor);
+      add_value (&ready, s.ready);
+      add_value (&first_ok, s.first_ok);
+      for (i = 0; i < s.ngetpins; i++)
+        add_value (&getpin, s.getpin[i]);
+      for (i = 0; i < s.nkeys; i++)
+        for (j = 0; j < 3; j++)
+          if (s.keybench[i][j] >= 0)
+            add_value (keybench + j, s.keybench[i][j] / 1000.0);
+      if (s.maxrss > maxrss)
+        maxrss = s.maxrss;
+    }
+  close (fds[0]);
+  close (fds[1]);
+  while (reaped < started && (pid = waitpid (-1, NULL, 0)) > 0)
+    if (pid != xvfb_pid)
+      reaped++;
+
+  name = strrchr (pgm, '/');
+  name = name? name + 1 : pgm;
+  printf ("%-18s %-12s %5d %5d", name, flavor, done, failed);
+  print_series (&ready);
+  print_series (&first_ok);
+  print_series (&getpin);
+  printf (" %8ld\n", maxrss);
+  if (keys)
+    {
+      printf ("%-18s %-12s %5lu %5s", "  keystrokes", "",
+              (unsigned long)keybench[0].n, "");
+      for (j = 0; j < 3; j++)
+        print_series (keybench + j);
+      putchar ('\n');
+    }
+
+  free (ready.v);
+  free (first_ok.v);
+  free (getpin.v);
+  for (j = 0; j < 3; j++)
+    free (keybench[j].v);
+}
+
+
+
+static void
+stop_xvfb (void)
+{
+  if (xvfb_pid > 0)
+    {
+      kill (xvfb_pid, SIGTERM);
+      waitpid (xvfb_pid, NULL, 0);
+      xvfb_pid = 0;
+    }
+}
+
+
+/* Start Xvfb on the first free display starting at :99 and set
+ * DISPLAY to it.  */
+static void
+start_xvfb (void)
+{
+  char display[16], sock[64];
+  struct stat st;
+  double deadline;
+  int num, fd;
+
+  for (num = 99; num < 199; num++)
+    {
+      snprintf (sock, sizeof sock, "/tmp/.X11-unix/X%d", num);
+      if (stat (sock, &st))
+        break;
+    }
+  snprintf (display, sizeof display, ":%d", num);
+
+  xvfb_pid = fork ();
+  if (xvfb_pid == (pid_t)-1)
+    {
+      fprintf (stderr, PGM ": fork failed: %s\n", strerror (errno));
+      exit (1);
+    }
+  if (!xvfb_pid)
+    {
+      fd = open ("/dev/null", O_RDWR);
+      if (fd != -1)
+        {
+          dup2 (fd, 0);
+          dup2 (fd, 1);
+          if (!verbose)
+            dup2 (fd, 2);
+        }
+      execlp ("Xvfb", "Xvfb", display, "-nolisten", "tcp",
+              "-screen", "0", "1280x1024x24", (char *)NULL);
+      _exit (127);
+    }
+  atexit (stop_xvfb);
+
+  deadline = now_msec () + 10000;
+  while (stat (sock, &st))
+    {
+      if (now_msec () > deadline || waitpid (xvfb_pid, NULL, WNOHANG))
+        {
+          fprintf (stderr, PGM ": can't start Xvfb on %s\n", display);
+          exit (1);
+        }
+      usleep (10000);
+    }
+  setenv ("DISPLAY", display, 1);
+  unsetenv ("WAYLAND_DISPLAY");
+  if (verbose)
+    fprintf (stderr, PGM ": using Xvfb on %s\n", display);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  int runs = 20;
+  int jobs = 4;
+  int xvfb = 0;
+  char line[16];
+
+  if (argc)
+    { argc--; argv++; }
+  while (argc && last_argc != argc)
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--"))
+        {
+          argc--; argv++;
+          break;
+        }
+      else if (!strcmp (*argv, "--help"))
+        {
+          fputs ("usage: " PGM " [options] PINENTRY...\n"
+                 "Options:\n"
+                 "  --runs N        start each pinentry N times [20]\n"
+                 "  --jobs N        run N pinentries concurrently [4]\n"
+                 "  --getpins N     GETPIN commands per pinentry [3]\n"
+                 "  --keys N        let the pinentries type N keys\n"
+                 "  --timeout SECS  give up on a pinentry after SECS [30]\n"
+                 "  --xvfb          start an Xvfb server as the display\n"
+                 "  --verbose       print errors and the pinentries'"
+                 " stderr\n"
+                 "  --debug         also print the Assuan traffic\n",
+                 stdout);
+          exit (0);
+        }
+      else if (!strcmp (*argv, "--verbose"))
+        {
+          verbose = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--debug"))
+        {
+          verbose = 2;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--xvfb"))
+        {
+          xvfb = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--runs") && argc > 1)
+        {
+          runs = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--jobs") && argc > 1)
+        {
+          jobs = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--keys") && argc > 1)
+        {
+          keys = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--getpins") && argc > 1)
+        {
+          ngetpins = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--timeout") && argc > 1)
+        {
+          timeout = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strncmp (*argv, "--", 2))
+        {
+          fprintf (stderr, PGM ": unknown option '%s'\n", *argv);
+          exit (1);
+        }
+    }
+  if (!argc)
+    {
+      fprintf (stderr, "usage: " PGM " [options] PINENTRY...\n");
+      exit (1);
+    }
+  if (runs < 1)
+    runs = 1;
+  if (jobs < 1)
+    jobs = 1;
+  if (timeout < 1)
+    timeout = 1;
+  if (ngetpins > MAX_GETPINS)
+    ngetpins = MAX_GETPINS;
+
+  signal (SIGPIPE, SIG_IGN);
+  if (xvfb)
+    start_xvfb ();
+  if (keys > 0)
+    {
+      snprintf (line, sizeof line, "%d", keys);
+      setenv ("PINENTRY_KEYBENCH", line, 1);
+    }
+  else
+    keys = 0;
+
+  printf ("%-18s %-12s %5s %5s %17s %17s %17s %8s\n",
+          "", "", "", "", "ready [ms]", "first-ok [ms]", "getpin [ms]",
+          "");
+  printf ("%-18s %-12s %5s %5s %8s %8s %8s %8s %8s %8s %8s\n",
+          "program", "flavor", "runs", "fail", "p50", "p99", "p50", "p99",
+          "p50", "p99", "rss[KiB]");
+  if (keys)
+    printf ("%-18s %-12s %5s %5s %17s %17s %17s\n",
+            "", "", "keys", "", "inquire [ms]", "reply [ms]", "paint [ms]");
+  for (; argc; argc--, argv++)
+    bench (*argv, runs, jobs);
+
+  return 0;
+}
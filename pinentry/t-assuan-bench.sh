@@ -0,0 +1,27 @@
+#!/bin/sh
+# t-assuan-bench.sh - Run a short assuan-bench session as a test
+# Copyright (C) 2026 g10 Code GmbH
+#
+# This file is part of PINENTRY.
+#
+# PINENTRY is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# PINENTRY is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, see <https://www.gnu.org/licenses/>.
+# SPDX-License-Identifier: GPL-2.0+
+
+# assuan-bench exits with an error if a command of the session fails.
+
+set -e
+
+./assuan-bench --iterations 20
+./assuan-bench --iterations 20 --inproc
+./assuan-bench --iterations 20 --inproc --option-burst 100
@@ -0,0 +1,348 @@
+/* t-server.c - Check the Assuan server run from a main loop
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of PINENTRY.
+ *
+ * PINENTRY is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PINENTRY is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* The GUI frontends watch the Assuan connection from their main loop
+ * with pinentry_server_start and pinentry_server_process.  This test
+ * does the same with a poll loop and talks to the server over two
+ * pipes.  It checks a result deferred with PINENTRY_DEFERRED, a
+ * dialog running its own nested loop, and the end of the connection
+ * while either kind of dialog is open.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifndef HAVE_W32_SYSTEM
+# include <fcntl.h>
+# include <poll.h>
+# include <signal.h>
+# include <unistd.h>
+#endif
+
+#include "pinentry.h"
+
+#define PGM "t-server"
+
+#ifndef HAVE_W32_SYSTEM
+
+/* How the command handler shows its dialog.  */
+enum dialog_mode
+  {
+    DIALOG_DEFERRED,    /* Return PINENTRY_DEFERRED.  */
+    DIALOG_NESTED,      /* Run a nested poll loop.  */
+    DIALOG_NESTED_EOF   /* Likewise, and the client goes away.  */
+  };
+
+static enum dialog_mode mode;
+
+/* The request deferred by the handler or NULL.  */
+static pinentry_t pending;
+
+/* Set when the nested dialog saw the end of the connection.  */
+static int dialog_canceled;
+
+/* The client's ends of the pipes.  */
+static int client_out = -1;
+static int client_in = -1;
+
+static int errors;
+
+#define fail(...) do { fprintf (stderr, PGM ": " __VA_ARGS__);     \
+                       putc ('\n', stderr); errors++; } while (0)
+
+
+/* Wait up to TIMEOUT ms for input on the server and process it, as
+   the watch of a frontend would.  Returns what pinentry_server_process
+   returns, or 0 if there was no input.  */
+static int
+server_step (int timeout)
+{
+  struct pollfd pfd;
+
+  pfd.fd = pinentry_server_fd ();
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  if (poll (&pfd, 1, timeout) <= 0)
+    return 0;
+  return pinentry_server_process ();
+}
+
+
+static int
+handler (pinentry_t pe)
+{
+  int i;
+
+  if (mode == DIALOG_DEFERRED)
+    {
+      pending = pe;
+      return PINENTRY_DEFERRED;
+    }
+
+  if (mode == DIALOG_NESTED_EOF)
+    {
+      close (client_out);
+      client_out = -1;
+    }
+
+  /* The dialog is shown for a while.  */
+  for (i = 0; i < 5; i++)
+    if (server_step (10))
+      {
+        dialog_canceled = 1;
+        pe->canceled = 1;
+        return -1;
+      }
+
+  if (!pe->pin)
+    return 1;
+  pinentry_setbufferlen (pe, 4);
+  strcpy (pe->pin, "xyz");
+  return 3;
+}
+
+pinentry_cmd_handler_t pinentry_cmd_handler = handler;
+
+
+static void
+client_send (const char *line)
+{
+  size_t n = strlen (line);
+
+  if (write (client_out, line, n) != (ssize_t)n)
+    {
+      fprintf (stderr, PGM ": write failed: %s\n", strerror (errno));
+      exit (1);
+    }
+}
+
+
+/* Return what the server has written since the last call.  */
+static const char *
+client_read (void)
+{
+  static char buffer[4096];
+  ssize_t n;
+
+  n = read (client_in, buffer, sizeof buffer - 1);
+  buffer[n > 0? n : 0] = 0;
+  return buffer;
+}
+
+
+static void
+expect (const char *what, const char *output, const char *text)
+{
+  if (!strstr (output, text))
+    fail ("%s: expected '%s' in '%s'", what, text, output);
+}
+
+
+/* Start a server on fresh pipes and read its greeting.  */
+static void
+start (void)
+{
+  int to_server[2], from_server[2];
+
+  if (pipe (to_server) || pipe (from_server))
+    {
+      fprintf (stderr, PGM ": pipe failed: %s\n", strerror (errno));
+      exit (1);
+    }
+  fcntl (from_server[0], F_SETFL, O_NONBLOCK);
+  client_out = to_server[1];
+  client_in = from_server[0];
+
+  if (pinentry_server_start (to_server[0], from_server[1]))
+    {
+      fprintf (stderr, PGM ": can't start the server\n");
+      exit (1);
+    }
+  expect ("start", client_read (), "OK");
+  pending = NULL;
+  dialog_canceled = 0;
+}
+
+
+static void
+stop (void)
+{
+  pinentry_server_stop ();
+  if (client_out != -1)
+    close (client_out);
+  close (client_in);
+  client_out = client_in = -1;
+}
+
+
+/* Step the server until the handler has deferred a request.  */
+static void
+wait_pending (const char *what)
+{
+  int i;
+
+  for (i = 0; !pending && i < 100; i++)
+    if (server_step (10))
+      break;
+  if (!pending)
+    fail ("%s: no deferred request", what);
+}
+
+
+static void
+test_deferred (void)
+{
+  pinentry_t pe;
+  const char *output;
+
+  start ();
+  mode = DIALOG_DEFERRED;
+
+  client_send ("SETDESC Enter it\nGETPIN\n");
+  wait_pending ("deferred GETPIN");
+  output = client_read ();
+  expect ("deferred GETPIN", output, "OK");
+  if (strstr (output, "D "))
+    fail ("deferred GETPIN answered early: '%s'", output);
+
+  if (pending)
+    {
+      pe = pending;
+      pending = NULL;
+      pinentry_setbufferlen (pe, 4);
+      strcpy (pe->pin, "def");
+      if (pinentry_command_done (pe, 3))
+        fail ("deferred GETPIN: connection lost");
+      output = client_read ();
+      expect ("deferred GETPIN", output, "D def\nOK");
+
+      if (pinentry_command_done (pe, 3) != -1)
+        fail ("pinentry_command_done accepted a second result");
+    }
+
+  client_send ("CONFIRM\n");
+  wait_pending ("deferred CONFIRM");
+  if (pending)
+    {
+      pe = pending;
+      pending = NULL;
+      if (pinentry_command_done (pe, 1))
+        fail ("deferred CONFIRM: connection lost");
+      expect ("deferred CONFIRM", client_read (), "OK");
+    }
+
+  client_send ("BYE\n");
+  if (server_step (1000) != 1)
+    fail ("BYE did not end the connection");
+  stop ();
+}
+
+
+static void
+test_deferred_eof (void)
+{
+  pinentry_t pe;
+
+  start ();
+  mode = DIALOG_DEFERRED;
+
+  client_send ("GETPIN\n");
+  wait_pending ("deferred GETPIN before EOF");
+  pe = pending;
+  pending = NULL;
+
+  close (client_out);
+  client_out = -1;
+  if (server_step (1000) != 1)
+    fail ("EOF during a deferred dialog was not seen");
+
+  /* The frontend closes its dialog as canceled.  */
+  if (pe && pinentry_command_done (pe, -1) != 1)
+    fail ("deferred result after EOF not refused");
+  stop ();
+
+  if (pe && pinentry_command_done (pe, -1) != -1)
+    fail ("deferred result accepted after pinentry_server_stop");
+}
+
+
+static void
+test_nested (void)
+{
+  start ();
+  mode = DIALOG_NESTED;
+
+  client_send ("GETPIN\n");
+  if (server_step (1000))
+    fail ("nested GETPIN ended the connection");
+  expect ("nested GETPIN", client_read (), "D xyz\nOK");
+  if (dialog_canceled)
+    fail ("nested dialog canceled without EOF");
+
+  close (client_out);
+  client_out = -1;
+  if (server_step (1000) != 1)
+    fail ("EOF after the nested dialog was not seen");
+  stop ();
+}
+
+
+static void
+test_nested_eof (void)
+{
+  start ();
+  mode = DIALOG_NESTED_EOF;
+
+  client_send ("GETPIN\n");
+  if (server_step (1000) != 1)
+    fail ("EOF during the nested dialog did not end the connection");
+  if (!dialog_canceled)
+    fail ("nested dialog not canceled on EOF");
+  if (pinentry_server_process () != 1)
+    fail ("connection not reported as ended after the dialog");
+  stop ();
+}
+
+#endif /*!HAVE_W32_SYSTEM*/
+
+
+int
+main (void)
+{
+#ifdef HAVE_W32_SYSTEM
+  fprintf (stderr, PGM ": needs poll and pipes - skipped\n");
+  return 77;
+#else
+  /* A reply to a client which has gone must not kill the test.  */
+  signal (SIGPIPE, SIG_IGN);
+  pinentry_init (PGM);
+
+  test_deferred ();
+  test_deferred_eof ();
+  test_nested ();
+  test_nested_eof ();
+
+  return !!errors;
+#endif
+}
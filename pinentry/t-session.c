@@ -0,0 +1,132 @@
+/* t-session.c - Check that a session does not grow with OPTION and RESET
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of PINENTRY.
+ *
+ * PINENTRY is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PINENTRY is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* A long-lived pinentry sees the same OPTIONs again and again, each
+ * followed by a RESET.  This test repeats such a session on a context
+ * and checks that the heap stays flat and the options survive the
+ * RESET.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_MALLINFO2
+# include <malloc.h>
+#endif
+
+#include "pinentry.h"
+
+#define PGM "t-session"
+
+/* Allowed growth of the heap in bytes over the measured iterations.  */
+#define MAX_GROWTH 16384
+
+pinentry_cmd_handler_t pinentry_cmd_handler;
+
+static char ttyinfo[200];
+
+static int
+data_cb (void *opaque, const void *buffer, size_t length)
+{
+  size_t n = strlen (ttyinfo);
+
+  (void)opaque;
+
+  if (length >= sizeof ttyinfo - n)
+    length = sizeof ttyinfo - n - 1;
+  memcpy (ttyinfo + n, buffer, length);
+  ttyinfo[n + length] = 0;
+  return 0;
+}
+
+
+static void
+run (pinentry_ctx_t ctx, int iteration)
+{
+  char line[100];
+  int rc;
+
+  snprintf (line, sizeof line, "OPTION ttyname=/dev/pts/%d", iteration);
+  rc = pinentry_ctx_command (ctx, line);
+  if (!rc)
+    {
+      snprintf (line, sizeof line, "_OK %d", iteration);
+      rc = pinentry_ctx_option (ctx, "default-ok", line);
+    }
+  if (!rc)
+    rc = pinentry_ctx_command (ctx, "SETDESC Please enter the passphrase");
+  if (!rc)
+    rc = pinentry_ctx_command (ctx, "RESET");
+  if (rc)
+    {
+      fprintf (stderr, PGM ": command failed: %d\n", rc);
+      exit (1);
+    }
+}
+
+
+int
+main (void)
+{
+#ifdef HAVE_MALLINFO2
+  struct pinentry_ctx_cbs cbs = { data_cb, NULL, NULL };
+  pinentry_ctx_t ctx;
+  size_t before, after;
+  int i;
+
+  pinentry_init (PGM);
+  ctx = pinentry_ctx_new (NULL, &cbs, NULL);
+  if (!ctx)
+    {
+      fprintf (stderr, PGM ": can't create context\n");
+      return 1;
+    }
+
+  for (i = 0; i < 1000; i++)
+    run (ctx, i);
+  before = mallinfo2 ().uordblks;
+  for (; i < 50000; i++)
+    run (ctx, i);
+  after = mallinfo2 ().uordblks;
+
+  if (after > before + MAX_GROWTH)
+    {
+      fprintf (stderr, PGM ": heap grew from %lu to %lu bytes\n",
+               (unsigned long)before, (unsigned long)after);
+      return 1;
+    }
+
+  if (pinentry_ctx_command (ctx, "GETINFO ttyinfo")
+      || strcmp (ttyinfo, "/dev/pts/49999 - -"))
+    {
+      fprintf (stderr, PGM ": option lost on RESET: '%s'\n", ttyinfo);
+      return 1;
+    }
+
+  pinentry_ctx_release (ctx);
+  return 0;
+#else
+  fprintf (stderr, PGM ": mallinfo2 is not available - skipped\n");
+  return 77;
+#endif
+}
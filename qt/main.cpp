@@ -28,6 +28,9 @@
 
 #include "pinentryconfirm.h"
 #include "pinentrydialog.h"
+#ifdef ENABLE_MAINLOOP_SERVER
+#include "pinentryserver.h"
+#endif
 #include "pinentry.h"
 
 #include <qapplication.h>
@@ -40,6 +43,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#ifndef Q_OS_WIN
+#include <unistd.h>
+#endif
 
 #include <stdexcept>
 #include <gpg-error.h>
@@ -220,7 +226,14 @@ qt_cmd_handler(pinentry_t pe)
         }
 
         const QString pinStr = pinentry.pin();
-        QByteArray pin = pinStr.toUtf8();
+        secmem::string pin;
+        try {
+            pin = toSecureUtf8(pinStr);
+        } catch (const std::exception &) {
+            /* The passphrase does not fit into the secure memory.  */
+            pe->specific_err = gpg_error (GPG_ERR_TOO_LARGE);
+            return -1;
+        }
 
         if (!!pe->repeat_passphrase) {
             /* Should not have been possible to accept
@@ -229,11 +242,11 @@ qt_cmd_handler(pinentry_t pe)
             pe->repeat_okay = (pinStr == pinentry.repeatedPin());
         }
 
-        int len = strlen(pin.constData());
+        int len = strlen(pin.c_str());
         if (len >= 0) {
             pinentry_setbufferlen(pe, len + 1);
             if (pe->pin) {
-                strcpy(pe->pin, pin.constData());
+                strcpy(pe->pin, pin.c_str());
                 return len;
             }
         }
@@ -354,11 +367,24 @@ main(int argc, char *argv[])
         i = argc;
         app = new QApplication(i, new_argv);
         app->setWindowIcon(QIcon(QLatin1String(":/document-encrypt.png")));
+        pinentry_timing("toolkit");
     }
 
     pinentry_parse_opts(argc, argv);
 
-    int rc = pinentry_loop();
+    int rc;
+#if defined(ENABLE_MAINLOOP_SERVER) && !defined(Q_OS_WIN)
+    if (app) {
+        /* Watch the Assuan connection from the event loop so that an
+           open dialog is canceled when the connection ends.  */
+        PinentryServer server;
+        app->setQuitOnLastWindowClosed(false);
+        rc = server.start(STDIN_FILENO, STDOUT_FILENO) ? app->exec() : -1;
+    } else
+#endif
+    {
+        rc = pinentry_loop();
+    }
     delete app;
     return rc ? EXIT_FAILURE : EXIT_SUCCESS ;
 }
@@ -37,6 +37,8 @@
 #include <QAction>
 #include <QCheckBox>
 
+#include <exception>
+
 #ifdef Q_OS_WIN
 #include <windows.h>
 #endif
@@ -103,6 +105,44 @@ void raiseWindow(QWidget *w)
 #endif
 }
 
+/* Convert S to UTF-8 in secure memory.  QString::toUtf8 would leave a
+   copy of the passphrase on the normal heap.  Unpaired surrogates are
+   replaced by U+FFFD.  */
+secmem::string toSecureUtf8(const QString &s)
+{
+    secmem::string result;
+
+    result.reserve(3 * s.size());
+    for (int i = 0; i < s.size(); i++) {
+        uint c = s.at(i).unicode();
+
+        if ((c & 0xfc00) == 0xd800 && i + 1 < s.size()
+            && (s.at(i + 1).unicode() & 0xfc00) == 0xdc00) {
+            c = 0x10000 + ((c - 0xd800) << 10)
+                + (s.at(++i).unicode() - 0xdc00);
+        } else if ((c & 0xf800) == 0xd800) {
+            c = 0xfffd;
+        }
+
+        if (c < 0x80) {
+            result.push_back(c);
+        } else if (c < 0x800) {
+            result.push_back(0xc0 | (c >> 6));
+            result.push_back(0x80 | (c & 0x3f));
+        } else if (c < 0x10000) {
+            result.push_back(0xe0 | (c >> 12));
+            result.push_back(0x80 | ((c >> 6) & 0x3f));
+            result.push_back(0x80 | (c & 0x3f));
+        } else {
+            result.push_back(0xf0 | (c >> 18));
+            result.push_back(0x80 | ((c >> 12) & 0x3f));
+            result.push_back(0x80 | ((c >> 6) & 0x3f));
+            result.push_back(0x80 | (c & 0x3f));
+        }
+    }
+    return result;
+}
+
 QPixmap icon(QStyle::StandardPixmap which)
 {
     QPixmap pm = qApp->windowIcon().pixmap(48, 48);
@@ -135,7 +175,10 @@ PinEntryDialog::PinEntryDialog(QWidget *parent, const char *name,
       mVisibilityTT(visibilityTT),
       mHideTT(hideTT),
       mVisiActionEdit(NULL),
-      mVisiCB(NULL)
+      mVisiCB(NULL),
+      mKeybenchKeys(pinentry_keybench_keys()),
+      mKeybenchStarted(false),
+      mKeybenchTyped(false)
 {
     _timed_out = false;
     setWindowFlags(windowFlags() & ~Qt::WindowContextHelpButtonHint);
@@ -255,12 +298,60 @@ PinEntryDialog::PinEntryDialog(QWidget *parent, const char *name,
 
     connect(qApp, SIGNAL(focusChanged(QWidget *, QWidget *)),
             this, SLOT(focusChanged(QWidget *, QWidget *)));
+
+    if (mKeybenchKeys) {
+        _edit->installEventFilter(this);
+    }
 }
 
 void PinEntryDialog::showEvent(QShowEvent *event)
 {
     QDialog::showEvent(event);
     raiseWindow(this);
+    pinentry_timing("dialog");
+
+    if (mKeybenchKeys && !mKeybenchStarted) {
+        mKeybenchStarted = true;
+        QTimer::singleShot(0, this, SLOT(keybenchNext()));
+    }
+}
+
+/* Queue the next synthetic key for the keystroke latency measurement
+   or, after the last one, accept the dialog the way a user would.  */
+void PinEntryDialog::keybenchNext()
+{
+    if (!mKeybenchKeys) {
+        if (mRepeat) {
+            mRepeat->setText(_edit->text());
+        }
+        QApplication::postEvent(_edit, new QKeyEvent(QEvent::KeyPress,
+                                                     Qt::Key_Return,
+                                                     Qt::NoModifier));
+        return;
+    }
+
+    mKeybenchKeys--;
+    mKeybenchTyped = false;
+    pinentry_keybench_mark(PINENTRY_KEYBENCH_KEY);
+    QApplication::postEvent(_edit, new QKeyEvent(QEvent::KeyPress, Qt::Key_A,
+                                                 Qt::NoModifier,
+                                                 QLatin1String("a")));
+    QApplication::postEvent(_edit, new QKeyEvent(QEvent::KeyRelease, Qt::Key_A,
+                                                 Qt::NoModifier,
+                                                 QLatin1String("a")));
+}
+
+bool PinEntryDialog::eventFilter(QObject *obj, QEvent *event)
+{
+    if (obj == _edit) {
+        if (event->type() == QEvent::KeyPress) {
+            mKeybenchTyped = true;
+        } else if (event->type() == QEvent::Paint && mKeybenchTyped
+                   && pinentry_keybench_mark(PINENTRY_KEYBENCH_PAINT)) {
+            QTimer::singleShot(0, this, SLOT(keybenchNext()));
+        }
+    }
+    return QDialog::eventFilter(obj, event);
 }
 
 void PinEntryDialog::setDescription(const QString &txt)
@@ -365,10 +456,16 @@ void PinEntryDialog::updateQuality(const QString &txt)
     if (!_have_quality_bar || !_pinentry_info) {
         return;
     }
-    const QByteArray utf8_pin = txt.toUtf8();
-    const char *pin = utf8_pin.constData();
-    length = strlen(pin);
-    percent = length ? pinentry_inq_quality(_pinentry_info, pin, length) : 0;
+    /* A paste may not fit into the secure memory; the exception must
+       not leave this slot.  */
+    try {
+        const secmem::string utf8_pin = toSecureUtf8(txt);
+        const char *pin = utf8_pin.c_str();
+        length = strlen(pin);
+        percent = length ? pinentry_inq_quality(_pinentry_info, pin, length) : 0;
+    } catch (const std::exception &) {
+        length = 0;
+    }
     if (!length) {
         _quality_bar->reset();
     } else {
@@ -29,6 +29,7 @@
 #include <QTimer>
 
 #include "pinentry.h"
+#include "secmem++.h"
 
 class QLabel;
 class QPushButton;
@@ -42,6 +43,8 @@ QPixmap icon(QStyle::StandardPixmap which = QStyle::SP_CustomBase);
 
 void raiseWindow(QWidget *w);
 
+secmem::string toSecureUtf8(const QString &s);
+
 class PinEntryDialog : public QDialog
 {
     Q_OBJECT
@@ -89,9 +92,11 @@ protected slots:
     void textChanged(const QString &);
     void focusChanged(QWidget *old, QWidget *now);
     void toggleVisibility();
+    void keybenchNext();
 
 protected:
     /* reimp */ void showEvent(QShowEvent *event);
+    /* reimp */ bool eventFilter(QObject *obj, QEvent *event);
 
 private:
     QLabel    *_icon;
@@ -114,6 +119,9 @@ private:
                mHideTT;
     QAction   *mVisiActionEdit;
     QCheckBox *mVisiCB;
+    int        mKeybenchKeys;
+    bool       mKeybenchStarted;
+    bool       mKeybenchTyped;
 };
 
 #endif // __PINENTRYDIALOG_H__
@@ -0,0 +1,68 @@
+/* pinentryserver.cpp - Runs the Assuan server from the Qt event loop
+ *
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#include "pinentryserver.h"
+#include "pinentry.h"
+
+#include <QApplication>
+#include <QDialog>
+#include <QSocketNotifier>
+
+PinentryServer::PinentryServer(QObject *parent)
+    : QObject(parent), _notifier(0)
+{
+}
+
+PinentryServer::~PinentryServer()
+{
+    if (_notifier) {
+        delete _notifier;
+        pinentry_server_stop();
+    }
+}
+
+bool PinentryServer::start(int infd, int outfd)
+{
+    if (pinentry_server_start(infd, outfd)) {
+        return false;
+    }
+    _notifier = new QSocketNotifier(pinentry_server_fd(),
+                                    QSocketNotifier::Read, this);
+    connect(_notifier, SIGNAL(activated(int)), this, SLOT(slotInput()));
+    return true;
+}
+
+/* This also runs from the event loop of an open dialog.  */
+void PinentryServer::slotInput()
+{
+    if (!pinentry_server_process()) {
+        return;
+    }
+
+    /* The connection has ended.  Cancel an open dialog and leave all
+       event loops, so that main returns once the command handler
+       is done.  */
+    _notifier->setEnabled(false);
+    if (QDialog *dialog = qobject_cast<QDialog *>(QApplication::activeModalWidget())) {
+        dialog->reject();
+    }
+    QCoreApplication::exit(0);
+}
+
+#include "pinentryserver.moc"
@@ -0,0 +1,43 @@
+/* pinentryserver.h - Runs the Assuan server from the Qt event loop
+ *
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#ifndef PINENTRYSERVER_H
+#define PINENTRYSERVER_H
+
+#include <QObject>
+
+class QSocketNotifier;
+
+class PinentryServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PinentryServer(QObject *parent = 0);
+    ~PinentryServer();
+
+    bool start(int infd, int outfd);
+
+private slots:
+    void slotInput();
+
+private:
+    QSocketNotifier *_notifier;
+};
+
+#endif
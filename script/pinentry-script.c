@@ -0,0 +1,489 @@
+/* pinentry-script.c - A pinentry answering from a rules file
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of PINENTRY.
+ *
+ * PINENTRY is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PINENTRY is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* This pinentry never talks to a human.  It answers GETPIN, CONFIRM
+ * and MESSAGE from the rules file named by the environment variable
+ * PINENTRY_SCRIPT_RULES so that gpg-agent and the pinentry core can
+ * be exercised and timed on a machine without a display or a tty.
+ *
+ * Each line of the rules file is either a directive or a rule.  Empty
+ * lines and lines starting with '#' are ignored.  The directive
+ *
+ *   seed N
+ *
+ * seeds the random generator used for the delays; the default seed
+ * is 1 so that runs are reproducible.  A rule is
+ *
+ *   COMMAND [KEY=VALUE]...
+ *
+ * where COMMAND is "getpin", "confirm", "message" or "*".  The first
+ * rule whose COMMAND and patterns match the request is used.  Values
+ * may use the Assuan percent escapes, e.g. "%20" for a space.  The
+ * keys are:
+ *
+ *   keyinfo=PATTERN  Glob matched against the SETKEYINFO value.
+ *   desc=PATTERN     Glob matched against the SETDESC value.
+ *   pin=STRING       Passphrase returned for GETPIN.
+ *   result=RESULT    One of "ok" (default), "cancel", "notok" or
+ *                    "timeout".
+ *   delay=DIST       Time to wait before answering.
+ *   keystroke=DIST   Time to wait per character of the passphrase.
+ *   quality          Send a quality inquiry after each character if
+ *                    the caller has set a quality bar.
+ *
+ * DIST is "MS", "uniform:MIN:MAX" or "normal:MEAN:SD", all in
+ * milliseconds.  If the total delay exceeds the timeout set by the
+ * caller the request fails with a timeout.  A request matching no
+ * rule is canceled.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <ctype.h>
+#include <time.h>
+#include <fnmatch.h>
+#include <gpg-error.h>
+
+#include "pinentry.h"
+#include "memory.h"
+
+enum rule_cmd
+  {
+    RULE_ANY,
+    RULE_GETPIN,
+    RULE_CONFIRM,
+    RULE_MESSAGE
+  };
+
+enum rule_result
+  {
+    RESULT_OK,
+    RESULT_CANCEL,
+    RESULT_NOTOK,
+    RESULT_TIMEOUT
+  };
+
+enum dist_type
+  {
+    DIST_FIXED,
+    DIST_UNIFORM,
+    DIST_NORMAL
+  };
+
+struct dist
+{
+  enum dist_type type;
+  double a;
+  double b;
+};
+
+struct rule
+{
+  struct rule *next;
+  int lnr;
+  enum rule_cmd cmd;
+  char *keyinfo;
+  char *desc;
+  char *pin;
+  enum rule_result result;
+  struct dist delay;
+  struct dist keystroke;
+  int quality;
+};
+
+static struct rule *rules;
+static unsigned long rnd_state = 1;
+
+
+/* Return a random number in [0,1).  */
+static double
+rnd (void)
+{
+  rnd_state = rnd_state * 1103515245 + 12345;
+  return ((rnd_state >> 16) & 0x7fff) / 32768.0;
+}
+
+
+/* Draw a value in milliseconds from D.  */
+static double
+dist_sample (const struct dist *d)
+{
+  double v;
+  int i;
+
+  switch (d->type)
+    {
+    case DIST_UNIFORM:
+      v = d->a + (d->b - d->a) * rnd ();
+      break;
+    case DIST_NORMAL:
+      /* The sum of 12 uniform values approximates a normal
+         distribution well enough and does not need libm.  */
+      for (v = -6, i = 0; i < 12; i++)
+        v += rnd ();
+      v = d->a + d->b * v;
+      break;
+    default:
+      v = d->a;
+      break;
+    }
+  return v < 0? 0 : v;
+}
+
+
+static int
+dist_parse (struct dist *d, const char *s)
+{
+  char *end;
+
+  if (!strncmp (s, "uniform:", 8))
+    {
+      d->type = DIST_UNIFORM;
+      s += 8;
+    }
+  else if (!strncmp (s, "normal:", 7))
+    {
+      d->type = DIST_NORMAL;
+      s += 7;
+    }
+  else
+    d->type = DIST_FIXED;
+
+  d->a = strtod (s, &end);
+  if (end == s)
+    return -1;
+  if (d->type == DIST_FIXED)
+    return *end? -1 : 0;
+  if (*end != ':')
+    return -1;
+  s = end + 1;
+  d->b = strtod (s, &end);
+  if (end == s || *end)
+    return -1;
+  return 0;
+}
+
+
+/* Undo the percent escaping of STRING in place.  */
+static void
+unescape (char *string)
+{
+  char *d = string;
+  const char *s = string;
+
+  while (*s)
+    {
+      if (*s == '%' && isxdigit ((unsigned char)s[1])
+          && isxdigit ((unsigned char)s[2]))
+        {
+          char hex[3] = { s[1], s[2], 0 };
+
+          *d++ = (char)strtoul (hex, NULL, 16);
+          s += 3;
+        }
+      else
+        *d++ = *s++;
+    }
+  *d = 0;
+}
+
+
+static char *
+xstrdup_unescaped (const char *string)
+{
+  char *p = strdup (string);
+
+  if (!p)
+    {
+      perror ("pinentry-script");
+      exit (EXIT_FAILURE);
+    }
+  unescape (p);
+  return p;
+}
+
+
+static int
+parse_rule (struct rule *r, char *line)
+{
+  char *tok, *value;
+
+  tok = strtok (line, " \t");
+  if (!strcmp (tok, "*"))
+    r->cmd = RULE_ANY;
+  else if (!strcasecmp (tok, "getpin"))
+    r->cmd = RULE_GETPIN;
+  else if (!strcasecmp (tok, "confirm"))
+    r->cmd = RULE_CONFIRM;
+  else if (!strcasecmp (tok, "message"))
+    r->cmd = RULE_MESSAGE;
+  else
+    return -1;
+
+  while ((tok = strtok (NULL, " \t")))
+    {
+      value = strchr (tok, '=');
+      if (value)
+        *value++ = 0;
+
+      if (!strcmp (tok, "quality") && !value)
+        r->quality = 1;
+      else if (!value)
+        return -1;
+      else if (!strcmp (tok, "keyinfo"))
+        r->keyinfo = xstrdup_unescaped (value);
+      else if (!strcmp (tok, "desc"))
+        r->desc = xstrdup_unescaped (value);
+      else if (!strcmp (tok, "pin"))
+        r->pin = xstrdup_unescaped (value);
+      else if (!strcmp (tok, "delay"))
+        {
+          if (dist_parse (&r->delay, value))
+            return -1;
+        }
+      else if (!strcmp (tok, "keystroke"))
+        {
+          if (dist_parse (&r->keystroke, value))
+            return -1;
+        }
+      else if (!strcmp (tok, "result"))
+        {
+          if (!strcmp (value, "ok"))
+            r->result = RESULT_OK;
+          else if (!strcmp (value, "cancel"))
+            r->result = RESULT_CANCEL;
+          else if (!strcmp (value, "notok"))
+            r->result = RESULT_NOTOK;
+          else if (!strcmp (value, "timeout"))
+            r->result = RESULT_TIMEOUT;
+          else
+            return -1;
+        }
+      else
+        return -1;
+    }
+  return 0;
+}
+
+
+static void
+load_rules (const char *fname)
+{
+  FILE *fp;
+  char line[1024];
+  char *p, *end;
+  struct rule **tail = &rules;
+  struct rule *r;
+  int lnr = 0;
+
+  fp = fopen (fname, "r");
+  if (!fp)
+    {
+      fprintf (stderr, "pinentry-script: can't open `%s': %s\n",
+               fname, strerror (errno));
+      exit (EXIT_FAILURE);
+    }
+
+  while (fgets (line, sizeof line, fp))
+    {
+      lnr++;
+      p = line + strspn (line, " \t");
+      p[strcspn (p, "\r\n")] = 0;
+      if (!*p || *p == '#')
+        continue;
+
+      if (!strncmp (p, "seed", 4) && (p[4] == ' ' || p[4] == '\t'))
+        {
+          rnd_state = strtoul (p + 5, &end, 0);
+          if (end == p + 5 || *end)
+            goto bad;
+          continue;
+        }
+
+      r = calloc (1, sizeof *r);
+      if (!r)
+        {
+          perror ("pinentry-script");
+          exit (EXIT_FAILURE);
+        }
+      r->lnr = lnr;
+      if (parse_rule (r, p))
+        goto bad;
+      *tail = r;
+      tail = &r->next;
+    }
+  if (ferror (fp))
+    {
+      fprintf (stderr, "pinentry-script: error reading `%s': %s\n",
+               fname, strerror (errno));
+      exit (EXIT_FAILURE);
+    }
+  fclose (fp);
+  return;
+
+ bad:
+  fprintf (stderr, "pinentry-script: %s:%d: invalid line\n", fname, lnr);
+  exit (EXIT_FAILURE);
+}
+
+
+static struct rule *
+find_rule (pinentry_t pe)
+{
+  enum rule_cmd cmd;
+  struct rule *r;
+
+  if (pe->pin)
+    cmd = RULE_GETPIN;
+  else if (pe->one_button)
+    cmd = RULE_MESSAGE;
+  else
+    cmd = RULE_CONFIRM;
+
+  for (r = rules; r; r = r->next)
+    {
+      if (r->cmd != RULE_ANY && r->cmd != cmd)
+        continue;
+      if (r->keyinfo
+          && fnmatch (r->keyinfo, pe->keyinfo? pe->keyinfo : "", 0))
+        continue;
+      if (r->desc
+          && fnmatch (r->desc, pe->description? pe->description : "", 0))
+        continue;
+      return r;
+    }
+  return NULL;
+}
+
+
+/* Sleep for MS milliseconds and account them in *ELAPSED.  Return
+   true if the timeout of the request has been exceeded.  */
+static int
+wait_ms (pinentry_t pe, double ms, double *elapsed)
+{
+  struct timespec ts;
+
+  if (pe->timeout && *elapsed + ms > pe->timeout * 1000.0)
+    ms = pe->timeout * 1000.0 - *elapsed;
+  *elapsed += ms;
+  if (ms > 0)
+    {
+      ts.tv_sec = (time_t)(ms / 1000);
+      ts.tv_nsec = (long)((ms - ts.tv_sec * 1000.0) * 1000000);
+      while (nanosleep (&ts, &ts) && errno == EINTR)
+        ;
+    }
+  return pe->timeout && *elapsed >= pe->timeout * 1000.0;
+}
+
+
+static int
+script_cmd_handler (pinentry_t pe)
+{
+  struct rule *r;
+  const char *pin;
+  double elapsed = 0;
+  size_t len, i;
+  int timed_out;
+
+  r = find_rule (pe);
+  if (!r)
+    {
+      if (pe->debug)
+        fprintf (stderr, "pinentry-script: no rule matches\n");
+      pe->canceled = 1;
+      return -1;
+    }
+  if (pe->debug)
+    fprintf (stderr, "pinentry-script: using rule at line %d\n", r->lnr);
+
+  timed_out = wait_ms (pe, dist_sample (&r->delay), &elapsed);
+
+  pin = r->pin? r->pin : "";
+  len = strlen (pin);
+  if (pe->pin && r->result == RESULT_OK && !timed_out)
+    {
+      if (!pinentry_setbufferlen (pe, len + 1))
+        {
+          pe->specific_err = gpg_error_from_syserror ();
+          pe->specific_err_loc = "setbufferlen";
+          return -1;
+        }
+      /* Type the passphrase one character at a time.  */
+      for (i = 0; i < len && !timed_out; i++)
+        {
+          timed_out = wait_ms (pe, dist_sample (&r->keystroke), &elapsed);
+          if (r->quality && pe->quality_bar)
+            pinentry_inq_quality (pe, pin, i + 1);
+        }
+      strcpy (pe->pin, pin);
+    }
+
+  if (timed_out || r->result == RESULT_TIMEOUT)
+    {
+      pe->specific_err = gpg_error (GPG_ERR_TIMEOUT);
+      return -1;
+    }
+
+  switch (r->result)
+    {
+    case RESULT_CANCEL:
+      pe->canceled = 1;
+      return -1;
+    case RESULT_NOTOK:
+      return pe->pin? -1 : 0;
+    default:
+      break;
+    }
+
+  if (pe->pin && pe->repeat_passphrase)
+    pe->repeat_okay = 1;
+  return 1;
+}
+
+
+pinentry_cmd_handler_t pinentry_cmd_handler = script_cmd_handler;
+
+
+int
+main (int argc, char *argv[])
+{
+  const char *fname;
+
+  pinentry_init ("pinentry-script");
+
+  /* Consumes all arguments.  */
+  pinentry_parse_opts (argc, argv);
+
+  fname = getenv ("PINENTRY_SCRIPT_RULES");
+  if (fname && *fname)
+    load_rules (fname);
+
+  if (pinentry_loop ())
+    return 1;
+
+  return 0;
+}
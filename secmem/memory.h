@@ -30,21 +30,57 @@ extern "C" {
 #endif
 
 
+/* Usage statistics of a secure memory pool; see secmem_get_stats.
+   All sizes are in bytes and include the block headers.  */
+struct secmem_stats
+{
+  size_t poolsize;	/* Size of the pool.  */
+  size_t poollen;	/* Part of the pool ever carved into blocks.  */
+  size_t cur_alloced;	/* Currently allocated.  */
+  size_t max_alloced;	/* Peak of CUR_ALLOCED.  */
+  unsigned cur_blocks;	/* Number of allocated blocks.  */
+  unsigned max_blocks;	/* Peak of CUR_BLOCKS.  */
+  size_t free_bytes;	/* Available for allocation.  */
+  size_t largest_free;	/* Largest block which can still be allocated.  */
+  const char *backend;	/* Name of the backend providing the pool.  */
+  double setup_ms;	/* Time to create and lock the pool.  */
+};
+
 /* values for flags, hardcoded in secmem.c */
 #define SECMEM_WARN		0
 #define SECMEM_DONT_WARN	1
 #define SECMEM_SUSPEND_WARN	2
 
+/* Wipe policies for secmem_set_wipe_policy.  */
+#define SECMEM_WIPE_SINGLE	0	/* One pass of zeros (default).  */
+#define SECMEM_WIPE_LEGACY	1	/* Passes of 0xff, 0xaa, 0x55, 0.  */
+
+/* Pools for secmem_malloc_in.  The secret pool, which is also used by
+   secmem_malloc, holds passphrases and other secrets; the io pool
+   holds the buffers of the Assuan protocol so that their churn does
+   not fragment the secret pool or exhaust it.  */
+#define SECMEM_POOL_SECRET	0
+#define SECMEM_POOL_IO		1
+#define SECMEM_NPOOLS		2
+
 void secmem_init( size_t npool );
+void secmem_init_pool( int pool, size_t npool );
 void secmem_term( void );
 void *secmem_malloc( size_t size );
 void *secmem_realloc( void *a, size_t newsize );
+void *secmem_malloc_in( int pool, size_t size );
+void *secmem_realloc_in( int pool, void *a, size_t newsize );
 void secmem_free( void *a );
 int  m_is_secure( const void *p );
 void secmem_dump_stats(void);
+void secmem_dump_blocks (void);
 void secmem_set_flags( unsigned flags );
 unsigned secmem_get_flags(void);
 size_t secmem_get_max_size (void);
+void secmem_get_stats (struct secmem_stats *stats);
+void secmem_get_pool_stats (int pool, struct secmem_stats *stats);
+void secmem_set_wipe_policy (int policy);
+int secmem_set_backend (const char *name);
 
 #if 0
 {
@@ -1,5 +1,6 @@
 /* STL allocator for secmem
  * Copyright (C) 2008 Marc Mutz <marc@kdab.com>
+ * Copyright (C) 2026 g10 Code GmbH
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -19,73 +20,123 @@
 #ifndef __SECMEM_SECMEMPP_H__
 #define __SECMEM_SECMEMPP_H__
 
-#include "secmem/memory.h"
+#include "memory.h"
 #include <cstddef>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/* Allocator and containers keeping their elements in secure memory.
+ * They need C++11.  Freed storage is wiped by secmem_free.  */
 
 namespace secmem {
 
     template <typename T>
     class alloc {
     public:
-        // type definitions:
-        typedef size_t    size_type;
-        typedef ptrdiff_t difference_type;
-        typedef T*        pointer;
-        typedef const T*  const_pointer;
-        typedef T&        reference;
-        typedef const T&  const_reference;
-        typedef T         value_type;
-
-        // rebind
-        template <typename U>
-        struct rebind {
-            typedef alloc<U> other;
-        };
-
-        // address
-        pointer address( reference value ) const {
-            return &value;
-        }
-        const_pointer address( const_reference value ) const {
-            return &value;
-        }
+        typedef T           value_type;
+        typedef std::size_t size_type;
+        typedef std::ptrdiff_t difference_type;
 
-        // (trivial) ctors and dtors
-        alloc() {}
-        alloc( const alloc & ) {}
-        template <typename U> alloc( const alloc<U> & ) {}
-        // copy ctor is ok
-        ~alloc() {}
+        // All instances share the pool.
+        typedef std::true_type propagate_on_container_move_assignment;
+        typedef std::true_type is_always_equal;
 
-        // de/allocation
-        size_type max_size() const {
-            return secmem_get_max_size();
-        }
+        alloc() noexcept {}
+        template <typename U> alloc( const alloc<U> & ) noexcept {}
 
-        pointer allocate( size_type n, void * =0 ) {
-            return static_cast<pointer>( secmem_malloc( n * sizeof(T) ) );
+        T *allocate( size_type n ) {
+            if( n > max_size() )
+                throw std::bad_alloc();
+            void *p = secmem_malloc( n * sizeof(T) );
+            if( !p )
+                throw std::bad_alloc();
+            return static_cast<T*>( p );
         }
 
-        void deallocate( pointer p, size_type ) {
+        void deallocate( T *p, size_type ) noexcept {
             secmem_free( p );
         }
 
-        // de/construct
-        void construct( pointer p, const T & value ) {
-            void * loc = p;
-            new (loc)T(value);
-        }
-        void destruct( pointer p ) {
-            p->~T();
+        size_type max_size() const noexcept {
+            return secmem_get_max_size() / sizeof(T);
         }
     };
 
-    // equality comparison
-    template <typename T1,typename T2>
+    template <typename T1, typename T2>
     bool operator==( const alloc<T1> &, const alloc<T2> & ) { return true; }
     template <typename T1, typename T2>
     bool operator!=( const alloc<T1> &, const alloc<T2> & ) { return false; }
 
+    template <typename T>
+    using vector = std::vector< T, alloc<T> >;
+
+    // A NUL terminated string in secure memory.  Unlike std::string
+    // with alloc it has no small buffer within the object, so even
+    // short strings never leave the pool.  Moves only pass on the
+    // buffer.
+    class string {
+    public:
+        typedef std::size_t size_type;
+
+        string() {}
+        explicit string( const char *s ) {
+            if( s )
+                append( s, std::strlen( s ) );
+        }
+        string( const char *s, size_type n ) {
+            append( s, n );
+        }
+
+        size_type size() const {
+            return buf_.empty() ? 0 : buf_.size() - 1;
+        }
+        bool empty() const { return size() == 0; }
+        const char *c_str() const {
+            return buf_.empty() ? "" : buf_.data();
+        }
+        const char *data() const { return c_str(); }
+
+        void reserve( size_type n ) { buf_.reserve( n + 1 ); }
+
+        string &append( const char *s, size_type n ) {
+            if( n ) {
+                if( buf_.empty() )
+                    buf_.push_back( '\0' );
+                buf_.insert( buf_.end() - 1, s, s + n );
+            }
+            return *this;
+        }
+        string &append( const char *s ) {
+            return append( s, std::strlen( s ) );
+        }
+        void push_back( char c ) { append( &c, 1 ); }
+        string &operator+=( char c ) { return append( &c, 1 ); }
+        string &operator+=( const char *s ) { return append( s ); }
+
+        // Release and thereby wipe the buffer.
+        void clear() { vector<char>().swap( buf_ ); }
+
+        friend bool operator==( const string &a, const string &b ) {
+            return a.size() == b.size()
+                && !std::memcmp( a.c_str(), b.c_str(), a.size() );
+        }
+        friend bool operator==( const string &a, const char *b ) {
+            return b && a.size() == std::strlen( b )
+                && !std::memcmp( a.c_str(), b, a.size() );
+        }
+        friend bool operator!=( const string &a, const string &b ) {
+            return !( a == b );
+        }
+        friend bool operator!=( const string &a, const char *b ) {
+            return !( a == b );
+        }
+
+    private:
+        vector<char> buf_;
+    };
+
 }
 
 #endif /* __SECMEM_SECMEMPP_H__ */
@@ -0,0 +1,888 @@
+/* secmem-bench.c - Benchmark and fragmentation stress for secmem
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of PINENTRY.
+ *
+ * PINENTRY is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PINENTRY is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* This program replays allocation traces against the secure memory
+ * allocator and reports for each trace the operations per second,
+ * the peak pool usage, the worst fragmentation seen and the number
+ * of allocations which failed because the pool was exhausted.
+ *
+ * The built-in traces model the users of the pool:
+ *
+ *   random      - Random sizes freed in random order.
+ *   assuan      - libassuan contexts, line buffers and inquiry data
+ *                 as routed through the Assuan malloc hooks.
+ *   passphrase  - Passphrase buffers grown with secmem_realloc the
+ *                 way pinentry-tty and pinentry_setbufferlen do while
+ *                 Assuan buffers are alive.
+ *   tqstring    - SecTQString growing one character at a time.
+ *
+ * A recorded trace may be given as a file with one operation per
+ * line:
+ *
+ *   m SLOT SIZE   - secmem_malloc SIZE bytes into SLOT
+ *   r SLOT SIZE   - secmem_realloc SLOT to SIZE bytes
+ *   f SLOT        - secmem_free SLOT
+ *
+ * SLOT is a number below 4096; lines starting with '#' are ignored.
+ * The program fails if blocks are left in the pool after a trace has
+ * freed all its slots.
+ *
+ * With --wipe-bench the throughput of wiping areas of various sizes
+ * with the old byte-wise wipememory2 and both wipe policies is
+ * measured instead.
+ *
+ * With --setup-bench the time to create a pool with each backend and
+ * the time of the first allocation spanning the whole pool, which
+ * includes the page faults of a lazily populated pool, are measured
+ * instead.
+ *
+ * With --threads N, N threads allocate, grow, check and free blocks
+ * concurrently for --seconds seconds while the main thread polls
+ * m_is_secure and the statistics.  Each block is filled with a
+ * pattern of its owner which is verified before the block is resized
+ * or freed; a mismatch is reported and makes the program fail.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include "memory.h"
+#include "secmem-util.h"
+
+#define PGM "secmem-bench"
+
+#define MAX_SLOTS 4096
+
+#define DIM(v) (sizeof(v)/sizeof((v)[0]))
+
+enum op_type { OP_MALLOC, OP_REALLOC, OP_FREE };
+
+struct op
+{
+  enum op_type type;
+  unsigned slot;
+  size_t size;
+};
+
+struct trace
+{
+  const char *name;
+  struct op *ops;
+  size_t nops;
+  size_t nalloced;
+};
+
+struct result
+{
+  double ops_per_sec;
+  size_t max_alloced;
+  size_t max_poollen;
+  unsigned max_blocks;
+  double max_frag;
+  unsigned long failures;
+};
+
+static size_t poolsize;
+static void *slots[MAX_SLOTS];
+static unsigned long rnd_state = 42;
+
+
+static unsigned long
+rnd (unsigned long n)
+{
+  rnd_state = rnd_state * 1103515245 + 12345;
+  return ((rnd_state >> 16) & 0x7fffffff) % n;
+}
+
+
+static void
+add_op (struct trace *t, enum op_type type, unsigned slot, size_t size)
+{
+  if (t->nops == t->nalloced)
+    {
+      t->nalloced = t->nalloced? 2 * t->nalloced : 1024;
+      t->ops = realloc (t->ops, t->nalloced * sizeof *t->ops);
+      if (!t->ops)
+        {
+          fprintf (stderr, PGM ": out of core\n");
+          exit (1);
+        }
+    }
+  t->ops[t->nops].type = type;
+  t->ops[t->nops].slot = slot;
+  t->ops[t->nops].size = size;
+  t->nops++;
+}
+
+
+static void
+gen_random (struct trace *t)
+{
+  unsigned live[64];
+  int nlive = 0;
+  unsigned next = 0;
+  int i;
+
+  t->name = "random";
+  for (i = 0; i < 20000; i++)
+    {
+      if (nlive && (nlive == 64 || rnd (2)))
+        {
+          int k = rnd (nlive);
+
+          add_op (t, OP_FREE, live[k], 0);
+          live[k] = live[--nlive];
+        }
+      else
+        {
+          /* Mostly small blocks with the occasional large one.  */
+          size_t size = rnd (8)? 16 + rnd (240) : 256 + rnd (1792);
+
+          live[nlive] = next++ % MAX_SLOTS;
+          add_op (t, OP_MALLOC, live[nlive++], size);
+        }
+    }
+  while (nlive)
+    add_op (t, OP_FREE, live[--nlive], 0);
+}
+
+
+/* Slots 0..19 are the context and its command table, 20..39 are
+ * per command buffers.  */
+static void
+gen_assuan (struct trace *t)
+{
+  int conn, cmd, i;
+
+  t->name = "assuan";
+  for (conn = 0; conn < 200; conn++)
+    {
+      /* The context with its inbound and outbound line buffers.  */
+      add_op (t, OP_MALLOC, 0, 2400);
+      /* The command table entries.  */
+      for (i = 1; i < 19; i++)
+        add_op (t, OP_MALLOC, i, 24 + rnd (16));
+      for (cmd = 0; cmd < 30; cmd++)
+        {
+          /* The data line buffer and, for quality inquiries, a growing
+             membuf.  */
+          add_op (t, OP_MALLOC, 20, 64 + rnd (64));
+          if (!rnd (3))
+            {
+              add_op (t, OP_MALLOC, 21, 256);
+              add_op (t, OP_REALLOC, 21, 512);
+              add_op (t, OP_FREE, 21, 0);
+            }
+          add_op (t, OP_FREE, 20, 0);
+        }
+      for (i = 18; i >= 0; i--)
+        add_op (t, OP_FREE, i, 0);
+    }
+}
+
+
+/* Slot 0 is an Assuan context, slot 1 the passphrase buffer and slot
+ * 2 the copy sent back to the agent.  */
+static void
+gen_passphrase (struct trace *t)
+{
+  int n, len, count, target;
+
+  t->name = "passphrase";
+  for (n = 0; n < 500; n++)
+    {
+      add_op (t, OP_MALLOC, 0, 2400);
+
+      /* pinentry-tty: start with 128 bytes and double.  Every tenth
+         passphrase is a long paste.  */
+      target = n % 10? 8 + rnd (56) : 512 + rnd (3584);
+      len = 128;
+      add_op (t, OP_MALLOC, 1, len);
+      for (count = 0; count < target; count++)
+        if (count == len - 1)
+          {
+            len *= 2;
+            add_op (t, OP_REALLOC, 1, len);
+          }
+
+      /* pinentry_setbufferlen: at least 2048 bytes.  */
+      add_op (t, OP_MALLOC, 2, target + 1 < 2048? 2048 : target + 1);
+      add_op (t, OP_FREE, 1, 0);
+      add_op (t, OP_FREE, 2, 0);
+      add_op (t, OP_FREE, 0, 0);
+    }
+}
+
+
+/* As computeNewMax in tqt/secqstring.cpp.  */
+static unsigned
+compute_new_max (unsigned len)
+{
+  unsigned new_max = 4;
+
+  while (new_max < len)
+    new_max *= 2;
+  return new_max;
+}
+
+
+static void
+gen_tqstring (struct trace *t)
+{
+  unsigned len, max, slot;
+  int n, target;
+
+  t->name = "tqstring";
+  for (n = 0; n < 500; n++)
+    {
+      target = n % 10? 8 + rnd (56) : 512 + rnd (1536);
+      slot = n & 1;
+      max = 0;
+      for (len = 1; len <= target; len++)
+        if (len > max)
+          {
+            /* A new vector is allocated, the old one is copied and
+               released.  A TQChar has 2 bytes.  */
+            max = compute_new_max (len);
+            add_op (t, OP_MALLOC, 2, 2 * max);
+            if (len > 1)
+              add_op (t, OP_FREE, slot, 0);
+            add_op (t, OP_MALLOC, slot, 2 * max);
+            add_op (t, OP_FREE, 2, 0);
+          }
+      add_op (t, OP_FREE, slot, 0);
+    }
+}
+
+
+static void
+read_trace (struct trace *t, const char *fname)
+{
+  FILE *fp;
+  char line[256];
+  unsigned slot;
+  unsigned long size;
+  char type;
+  int lnr = 0;
+
+  fp = fopen (fname, "r");
+  if (!fp)
+    {
+      fprintf (stderr, PGM ": can't open '%s': %s\n", fname, strerror (errno));
+      exit (1);
+    }
+  t->name = fname;
+  while (fgets (line, sizeof line, fp))
+    {
+      lnr++;
+      if (*line == '#' || *line == '\n')
+        continue;
+      size = 0;
+      if (sscanf (line, "%c %u %lu", &type, &slot, &size) < 2
+          || slot >= MAX_SLOTS
+          || (type != 'm' && type != 'r' && type != 'f'))
+        {
+          fprintf (stderr, PGM ": %s:%d: invalid line\n", fname, lnr);
+          exit (1);
+        }
+      add_op (t, type == 'm'? OP_MALLOC : type == 'r'? OP_REALLOC : OP_FREE,
+              slot, size);
+    }
+  fclose (fp);
+}
+
+
+
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* Run trace T once.  If R is not NULL record the pool statistics
+ * after each operation.  Returns true if the pool still has blocks
+ * allocated after all slots have been freed.  */
+static int
+replay (struct trace *t, struct result *r)
+{
+  struct secmem_stats st;
+  struct op *op;
+  void *p;
+  double frag;
+  size_t i;
+
+  for (i = 0; i < t->nops; i++)
+    {
+      op = t->ops + i;
+      switch (op->type)
+        {
+        case OP_MALLOC:
+          secmem_free (slots[op->slot]);
+          slots[op->slot] = secmem_malloc (op->size);
+          if (!slots[op->slot] && r)
+            r->failures++;
+          break;
+        case OP_REALLOC:
+          p = secmem_realloc (slots[op->slot], op->size);
+          if (p)
+            slots[op->slot] = p;
+          else if (r)
+            r->failures++;
+          break;
+        case OP_FREE:
+          secmem_free (slots[op->slot]);
+          slots[op->slot] = NULL;
+          break;
+        }
+
+      if (r)
+        {
+          secmem_get_stats (&st);
+          if (st.max_alloced > r->max_alloced)
+            r->max_alloced = st.max_alloced;
+          if (st.poollen > r->max_poollen)
+            r->max_poollen = st.poollen;
+          if (st.max_blocks > r->max_blocks)
+            r->max_blocks = st.max_blocks;
+          frag = st.free_bytes? 1.0 - (double)st.largest_free / st.free_bytes
+                              : 0.0;
+          if (frag > r->max_frag)
+            r->max_frag = frag;
+        }
+    }
+
+  for (i = 0; i < MAX_SLOTS; i++)
+    {
+      secmem_free (slots[i]);
+      slots[i] = NULL;
+    }
+
+  secmem_get_stats (&st);
+  return st.cur_blocks || st.cur_alloced;
+}
+
+
+/* Run trace T.  Returns true if blocks were left in the pool.  */
+static int
+run_trace (struct trace *t, int iterations)
+{
+  struct result r;
+  double t0, t1;
+  int leaked;
+  int i;
+
+  memset (&r, 0, sizeof r);
+
+  /* First a run with a fresh pool to collect the statistics.  */
+  secmem_init (poolsize);
+  leaked = replay (t, &r);
+  secmem_term ();
+
+  /* Then the timed runs.  */
+  secmem_init (poolsize);
+  t0 = now ();
+  for (i = 0; i < iterations; i++)
+    leaked |= replay (t, NULL);
+  t1 = now ();
+  secmem_term ();
+
+  r.ops_per_sec = (double)t->nops * iterations / (t1 - t0);
+  printf ("%-12s %8lu %12.0f %9lu %9lu %7u %6.1f%% %8lu\n",
+          t->name, (unsigned long)t->nops, r.ops_per_sec,
+          (unsigned long)r.max_alloced, (unsigned long)r.max_poollen,
+          r.max_blocks, 100.0 * r.max_frag, r.failures);
+  if (leaked)
+    fprintf (stderr, PGM ": %s: blocks left after freeing all slots\n",
+             t->name);
+  return leaked;
+}
+
+
+/* Wipe areas of various sizes the old way, with four byte-wise
+ * passes, and with both wipe policies.  */
+static void
+run_wipe (void)
+{
+  static const size_t sizes[] =
+    { 32, 128, 512, 2048, 16384, 262144, 1048576 };
+  const size_t volume = 256 * 1024 * 1024;
+  char *buf;
+  double t0, t[3];
+  size_t i, n, reps, r;
+  int k;
+
+  buf = malloc (sizes[DIM (sizes) - 1]);
+  if (!buf)
+    {
+      fprintf (stderr, PGM ": out of core\n");
+      exit (1);
+    }
+
+  printf ("%-8s %14s %14s %14s\n",
+          "size", "bytewise[MB/s]", "legacy[MB/s]", "single[MB/s]");
+  for (i = 0; i < DIM (sizes); i++)
+    {
+      n = sizes[i];
+      for (k = 0; k < 3; k++)
+        {
+          /* The byte-wise passes are slow; do fewer of them.  */
+          if (!k)
+            reps = volume / n / 16 + 1;
+          else
+            reps = volume / n;
+
+          t0 = now ();
+          for (r = reps; r; r--)
+            switch (k)
+              {
+              case 0:
+                wipememory2 (buf, 0xff, n);
+                wipememory2 (buf, 0xaa, n);
+                wipememory2 (buf, 0x55, n);
+                wipememory2 (buf, 0x00, n);
+                break;
+              case 1:
+                fast_wipememory2 (buf, 0xff, n);
+                fast_wipememory2 (buf, 0xaa, n);
+                fast_wipememory2 (buf, 0x55, n);
+                fast_wipememory (buf, n);
+                break;
+              default:
+                fast_wipememory (buf, n);
+                break;
+              }
+          t[k] = (double)reps * n / (now () - t0) / 1e6;
+        }
+      printf ("%-8lu %14.0f %14.0f %14.0f\n",
+              (unsigned long)n, t[0], t[1], t[2]);
+    }
+  free (buf);
+}
+
+
+/* Create and tear down the pool with each backend.  */
+static void
+run_setup (int iterations)
+{
+  static const char *backends[] = { "legacy", "locked", "memfd_secret" };
+  struct secmem_stats st;
+  double setup, first, t0;
+  const char *used;
+  void *p;
+  size_t i;
+  int k;
+
+  printf ("%-14s %-14s %10s %10s\n",
+          "backend", "used", "setup[us]", "first[us]");
+  for (i = 0; i < DIM (backends); i++)
+    {
+      secmem_set_backend (backends[i]);
+      setup = first = 0;
+      used = "?";
+      for (k = 0; k < iterations; k++)
+        {
+          secmem_init (poolsize);
+          secmem_get_stats (&st);
+          setup += st.setup_ms * 1e3;
+          used = st.backend;
+          t0 = now ();
+          p = secmem_malloc (st.poolsize - 32);
+          first += (now () - t0) * 1e6;
+          secmem_free (p);
+          secmem_term ();
+        }
+      printf ("%-14s %-14s %10.1f %10.1f\n", backends[i], used,
+              setup / iterations, first / iterations);
+    }
+}
+
+
+#ifdef HAVE_PTHREAD
+#define STRESS_SLOTS 8
+
+struct stress
+{
+  pthread_t thread;
+  unsigned id;
+  unsigned long ops;
+  unsigned long failures;
+  unsigned long corrupt;
+};
+
+/* Set by the main thread to end the stress; polled by the threads.  */
+static int stress_stop;
+#ifndef __GNUC__
+static pthread_mutex_t stress_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
+static int
+stress_stopped (void)
+{
+#ifdef __GNUC__
+  return __atomic_load_n (&stress_stop, __ATOMIC_ACQUIRE);
+#else
+  int stop;
+
+  pthread_mutex_lock (&stress_lock);
+  stop = stress_stop;
+  pthread_mutex_unlock (&stress_lock);
+  return stop;
+#endif
+}
+
+
+static void
+stress_end (void)
+{
+#ifdef __GNUC__
+  __atomic_store_n (&stress_stop, 1, __ATOMIC_RELEASE);
+#else
+  pthread_mutex_lock (&stress_lock);
+  stress_stop = 1;
+  pthread_mutex_unlock (&stress_lock);
+#endif
+}
+
+
+static void
+stress_fill (unsigned char *p, size_t n, unsigned id, size_t from)
+{
+  size_t i;
+
+  for (i = from; i < n; i++)
+    p[i] = (unsigned char)(id * 31 + i);
+}
+
+
+static int
+stress_check (const unsigned char *p, size_t n, unsigned id)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    if (p[i] != (unsigned char)(id * 31 + i))
+      return 0;
+  return 1;
+}
+
+
+static void *
+stress_thread (void *arg)
+{
+  struct stress *st = arg;
+  unsigned char *slot[STRESS_SLOTS];
+  size_t len[STRESS_SLOTS];
+  unsigned long state = st->id + 1;
+  unsigned char *p;
+  size_t n;
+  int i;
+
+  memset (slot, 0, sizeof slot);
+  memset (len, 0, sizeof len);
+  while (!stress_stopped ())
+    {
+      state = state * 1103515245 + 12345;
+      i = (state >> 8) % STRESS_SLOTS;
+      n = (state >> 16) % 200 + 1;
+      if (slot[i] && !stress_check (slot[i], len[i], st->id))
+        st->corrupt++;
+      switch ((state >> 24) % 3)
+        {
+        case 0:
+          secmem_free (slot[i]);
+          slot[i] = secmem_malloc (n);
+          len[i] = slot[i]? n : 0;
+          if (slot[i])
+            stress_fill (slot[i], n, st->id, 0);
+          else
+            st->failures++;
+          break;
+        case 1:
+          if (n < len[i])
+            n = len[i] + 16;
+          p = secmem_realloc (slot[i], n);
+          if (p)
+            {
+              stress_fill (p, n, st->id, len[i]);
+              slot[i] = p;
+              len[i] = n;
+            }
+          else
+            st->failures++;
+          break;
+        default:
+          secmem_free (slot[i]);
+          slot[i] = NULL;
+          len[i] = 0;
+          break;
+        }
+      st->ops++;
+    }
+  for (i = 0; i < STRESS_SLOTS; i++)
+    secmem_free (slot[i]);
+  return NULL;
+}
+
+
+/* Run NTHREADS threads for SECONDS.  Returns true if a corrupted
+ * block was seen.  */
+static int
+run_stress (int nthreads, int seconds)
+{
+  struct stress *st;
+  struct secmem_stats stats;
+  unsigned long ops = 0, failures = 0, corrupt = 0, polls = 0;
+  double t0;
+  int i;
+
+  st = calloc (nthreads, sizeof *st);
+  if (!st)
+    {
+      fprintf (stderr, PGM ": out of core\n");
+      exit (1);
+    }
+  secmem_init (poolsize);
+  t0 = now ();
+  for (i = 0; i < nthreads; i++)
+    {
+      st[i].id = i;
+      if (pthread_create (&st[i].thread, NULL, stress_thread, st + i))
+        {
+          fprintf (stderr, PGM ": can't create thread: %s\n",
+                   strerror (errno));
+          exit (1);
+        }
+    }
+  while (now () - t0 < seconds)
+    {
+      secmem_get_stats (&stats);
+      if (m_is_secure (&stats))
+        corrupt++;
+      polls++;
+    }
+  stress_end ();
+  for (i = 0; i < nthreads; i++)
+    {
+      pthread_join (st[i].thread, NULL);
+      ops += st[i].ops;
+      failures += st[i].failures;
+      corrupt += st[i].corrupt;
+    }
+
+  secmem_get_stats (&stats);
+  printf ("threads %d: %lu ops, %.0f ops/s, %lu failed, %lu polls,"
+          " %u blocks left, %lu corrupted\n",
+          nthreads, ops, ops / (now () - t0), failures, polls,
+          stats.cur_blocks, corrupt);
+  if (stats.cur_blocks)
+    corrupt++;
+  secmem_term ();
+  free (st);
+  return corrupt != 0;
+}
+#endif /*HAVE_PTHREAD*/
+
+
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  int iterations = 20;
+  const char *only = NULL;
+  int wipe_bench = 0;
+  int setup_bench = 0;
+  int threads = 0;
+  int seconds = 2;
+  struct trace traces[4];
+  struct trace recorded;
+  int rc = 0;
+  int found = 0;
+  int i;
+
+  if (argc)
+    { argc--; argv++; }
+  while (argc && last_argc != argc)
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--"))
+        {
+          argc--; argv++;
+          break;
+        }
+      else if (!strcmp (*argv, "--help"))
+        {
+          fputs ("usage: " PGM " [options] [TRACEFILE]\n"
+                 "Options:\n"
+                 "  --iterations N  replay each trace N times [20]\n"
+                 "  --poolsize N    size of the secure pool [16384]\n"
+                 "  --trace NAME    run only the built-in trace NAME\n"
+                 "  --wipe POLICY   wipe freed blocks with POLICY,"
+                 " single or legacy\n"
+                 "  --wipe-bench    measure the wiping throughput\n"
+                 "  --backend NAME  use the pool backend NAME\n"
+                 "  --setup-bench   measure the setup of each backend\n"
+                 "  --threads N     stress the pool from N threads\n"
+                 "  --seconds N     run the stress for N seconds [2]\n",
+                 stdout);
+          exit (0);
+        }
+      else if (!strcmp (*argv, "--iterations") && argc > 1)
+        {
+          iterations = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--poolsize") && argc > 1)
+        {
+          poolsize = strtoul (argv[1], NULL, 0);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--trace") && argc > 1)
+        {
+          only = argv[1];
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--wipe") && argc > 1)
+        {
+          if (!strcmp (argv[1], "single"))
+            secmem_set_wipe_policy (SECMEM_WIPE_SINGLE);
+          else if (!strcmp (argv[1], "legacy"))
+            secmem_set_wipe_policy (SECMEM_WIPE_LEGACY);
+          else
+            {
+              fprintf (stderr, PGM ": unknown wipe policy '%s'\n", argv[1]);
+              exit (1);
+            }
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--backend") && argc > 1)
+        {
+          if (secmem_set_backend (argv[1]))
+            {
+              fprintf (stderr, PGM ": unknown backend '%s'\n", argv[1]);
+              exit (1);
+            }
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--threads") && argc > 1)
+        {
+          threads = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--seconds") && argc > 1)
+        {
+          seconds = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--setup-bench"))
+        {
+          setup_bench = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--wipe-bench"))
+        {
+          wipe_bench = 1;
+          argc--; argv++;
+        }
+      else if (!strncmp (*argv, "--", 2))
+        {
+          fprintf (stderr, PGM ": unknown option '%s'\n", *argv);
+          exit (1);
+        }
+    }
+  if (argc > 1)
+    {
+      fprintf (stderr, "usage: " PGM " [options] [TRACEFILE]\n");
+      exit (1);
+    }
+  if (iterations < 1)
+    iterations = 1;
+  if (!poolsize)
+    poolsize = 16384;
+
+  if (wipe_bench)
+    {
+      run_wipe ();
+      return 0;
+    }
+
+  secmem_set_flags (SECMEM_DONT_WARN);
+
+  if (setup_bench)
+    {
+      run_setup (iterations);
+      return 0;
+    }
+
+  if (threads > 0)
+    {
+#ifdef HAVE_PTHREAD
+      return run_stress (threads, seconds);
+#else
+      /* 77 tells "make check" to skip the test.  */
+      fprintf (stderr, PGM ": built without thread support\n");
+      return 77;
+#endif
+    }
+
+  printf ("%-12s %8s %12s %9s %9s %7s %7s %8s\n",
+          "trace", "ops", "ops/s", "peak", "poollen", "blocks", "frag",
+          "failed");
+
+  if (argc)
+    {
+      memset (&recorded, 0, sizeof recorded);
+      read_trace (&recorded, *argv);
+      return run_trace (&recorded, iterations);
+    }
+
+  memset (traces, 0, sizeof traces);
+  gen_random (traces + 0);
+  gen_assuan (traces + 1);
+  gen_passphrase (traces + 2);
+  gen_tqstring (traces + 3);
+  for (i = 0; i < 4; i++)
+    if (!only || !strcmp (only, traces[i].name))
+      {
+        rc |= run_trace (traces + i, iterations);
+        found = 1;
+      }
+  if (!found)
+    {
+      fprintf (stderr, PGM ": unknown trace '%s'\n", only);
+      return 1;
+    }
+
+  return rc;
+}
@@ -36,6 +36,14 @@
 # endif
 #endif
 #include <string.h>
+#include <time.h>
+#ifdef HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
+#if defined(HAVE_PTHREAD) && defined(__GNUC__)
+# define SECMEM_THREADS 1
+# include <pthread.h>
+#endif
 
 #include "memory.h"
 
@@ -101,20 +109,312 @@ struct memblock_struct {
 
 
 
-static void  *pool;
-static volatile int pool_okay; /* may be checked in an atexit function */
-static int   pool_is_mmapped;
-static size_t poolsize; /* allocated length */
-static size_t poollen;	/* used length */
-static MEMBLOCK *unused_blocks;
-static unsigned max_alloced;
-static unsigned cur_alloced;
-static unsigned max_blocks;
-static unsigned cur_blocks;
+#define DEFAULT_IO_POOLSIZE 16384
+
+#ifdef ENABLE_SECMEM_DEBUG
+/* Allocation tracking.  If the envvar PINENTRY_SECMEM_DEBUG is set
+ * when a pool is created, the caller, size and time of each live
+ * block are kept in a table outside of the pool with one entry per
+ * 32 byte unit of the pool.  secmem_dump_blocks prints them along
+ * with a map of the pool; this is also done when a pool is exhausted
+ * and for the blocks still allocated at secmem_term.  */
+struct alloc_site {
+    const void *caller;	 /* Return address of the allocating call.  */
+    size_t size;	 /* Requested size.  */
+    unsigned long serial; /* Number of the allocation or 0 if free.  */
+    double time;	 /* Milliseconds since the pool was created.  */
+};
+#endif /*ENABLE_SECMEM_DEBUG*/
+
+/* A pool of secure memory.  Blocks are carved from the pool in
+ * sequence and kept on the pool's free list once freed.  */
+struct pool_s {
+    const char *name;
+    size_t defsize;	  /* Default size of the pool.  */
+    int fast_wipe;	  /* Ignore the wipe policy.  */
+    void  *pool;
+    volatile int pool_okay; /* may be checked in an atexit function */
+    int   pool_is_mmapped;
+    int   backend;	  /* The BACKEND_ actually used.  */
+    double setup_ms;	  /* Time spent to create the pool.  */
+    size_t poolsize;	  /* allocated length */
+    size_t poollen;	  /* used length */
+    MEMBLOCK *unused_blocks;
+    unsigned max_alloced;
+    unsigned cur_alloced;
+    unsigned max_blocks;
+    unsigned cur_blocks;
+#ifdef ENABLE_SECMEM_DEBUG
+    struct alloc_site *sites;
+#endif
+};
+
+/* Indexed by SECMEM_POOL_SECRET and SECMEM_POOL_IO.  The blocks of
+ * the io pool are freed at a high rate.  A single pass of zeros
+ * clears them as well as the legacy passes do, so that pool always
+ * uses it.  */
+static struct pool_s pools[SECMEM_NPOOLS] = {
+    { "secret", DEFAULT_POOLSIZE, 0 },
+    { "io", DEFAULT_IO_POOLSIZE, 1 }
+};
+
 static int disable_secmem;
 static int show_warning;
 static int no_warning;
 static int suspend_warning;
+static int wipe_policy = SECMEM_WIPE_SINGLE;
+
+/* The ways to get the memory for a pool.  BACKEND_AUTO tries
+ * BACKEND_LOCKED and falls back to BACKEND_LEGACY; an explicitly
+ * requested backend falls back the same way.  */
+enum {
+    BACKEND_AUTO,
+    BACKEND_MEMFD_SECRET, /* memfd_secret(2), locked and unmapped
+			     from the kernel.  */
+    BACKEND_LOCKED,	  /* Anonymous mapping, locked and prefaulted.  */
+    BACKEND_LEGACY,	  /* Anonymous or /dev/zero mapping or malloc,
+			     locked with mlock.  */
+    BACKEND_MALLOC	  /* Only reported if the legacy mmap failed.  */
+};
+static const char *backend_names[] = {
+    "auto", "memfd_secret", "locked", "legacy", "malloc"
+};
+static int requested_backend = -1;
+
+#ifdef SECMEM_THREADS
+/* All pools are protected by POOL_LOCK.  Blocks of the smallest
+ * sizes freed by a thread are kept in a magazine of that thread and
+ * handed out to it again without taking the lock.  A magazine holds
+ * up to MAG_ROUNDS blocks of each of the MAG_CLASSES smallest sizes
+ * per pool; blocks are returned to the pools when the thread exits.
+ * The usage counters are updated atomically.  Only secmem_init and
+ * secmem_term may not run concurrently with other secmem functions;
+ * m_is_secure never takes the lock.  */
+#define MAG_CLASSES 4	/* Blocks of 32, 64, 96 and 128 bytes.  */
+#define MAG_ROUNDS  4
+
+struct magazine {
+    unsigned generation;
+    unsigned n[SECMEM_NPOOLS][MAG_CLASSES];
+    MEMBLOCK *blocks[SECMEM_NPOOLS][MAG_CLASSES][MAG_ROUNDS];
+};
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t mag_once = PTHREAD_ONCE_INIT;
+static pthread_key_t mag_key;
+static int mag_key_okay;
+static unsigned mag_generation; /* Bumped by secmem_term.  */
+/* The key only serves to run mag_destroy; the magazine is looked up
+ * through the faster thread-local variable.  */
+static __thread struct magazine *thread_mag;
+
+# define LOCK_POOLS()	pthread_mutex_lock (&pool_lock)
+# define UNLOCK_POOLS()	pthread_mutex_unlock (&pool_lock)
+# define ATOMIC_ADD(v,n) __atomic_add_fetch (&(v), (n), __ATOMIC_RELAXED)
+# define ATOMIC_SUB(v,n) __atomic_sub_fetch (&(v), (n), __ATOMIC_RELAXED)
+# define ATOMIC_GET(v)	 __atomic_load_n (&(v), __ATOMIC_RELAXED)
+#else
+# define LOCK_POOLS()	do { } while (0)
+# define UNLOCK_POOLS()	do { } while (0)
+# define ATOMIC_ADD(v,n) ((v) += (n))
+# define ATOMIC_SUB(v,n) ((v) -= (n))
+# define ATOMIC_GET(v)	 (v)
+#endif
+
+#ifdef __GNUC__
+# define CALLER __builtin_return_address (0)
+#else
+# define CALLER NULL
+#endif
+
+/* Return a timestamp in milliseconds.  */
+static double
+get_msec (void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+#else
+    return (double)clock () * 1e3 / CLOCKS_PER_SEC;
+#endif
+}
+
+/* Raise *MAX to V.  */
+static void
+update_max (unsigned *max, unsigned v)
+{
+#ifdef SECMEM_THREADS
+    unsigned old = __atomic_load_n (max, __ATOMIC_RELAXED);
+
+    while( v > old
+	   && !__atomic_compare_exchange_n (max, &old, v, 1,
+					    __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED) )
+	;
+#else
+    if( v > *max )
+	*max = v;
+#endif
+}
+
+/* Account for NBLOCKS blocks with SIZE bytes handed out from PL.  */
+static void
+count_alloc (struct pool_s *pl, unsigned size, unsigned nblocks)
+{
+    update_max (&pl->max_alloced, ATOMIC_ADD (pl->cur_alloced, size));
+    if( nblocks )
+	update_max (&pl->max_blocks, ATOMIC_ADD (pl->cur_blocks, nblocks));
+}
+
+
+#ifdef SECMEM_THREADS
+static void mag_destroy (void *arg);
+
+static void
+mag_create_key (void)
+{
+    if( !pthread_key_create (&mag_key, mag_destroy) )
+	mag_key_okay = 1;
+}
+
+/* Return the magazine of the calling thread.  If CREATE is false
+ * NULL is returned for a thread without one.  */
+static struct magazine *
+get_magazine (int create)
+{
+    struct magazine *mag = thread_mag;
+
+    if( !mag && create ) {
+	pthread_once (&mag_once, mag_create_key);
+	if( !mag_key_okay )
+	    return NULL;
+	mag = calloc (1, sizeof *mag);
+	if( mag && pthread_setspecific (mag_key, mag) ) {
+	    free (mag);
+	    mag = NULL;
+	}
+	if( !mag )
+	    return NULL;
+	mag->generation = mag_generation;
+	thread_mag = mag;
+    }
+    if( mag && mag->generation != mag_generation ) {
+	/* The pools have been torn down since.  */
+	memset (mag->n, 0, sizeof mag->n);
+	mag->generation = mag_generation;
+    }
+    return mag;
+}
+
+/* Take a block of SIZE bytes for PL from the magazine.  */
+static MEMBLOCK *
+mag_get (struct pool_s *pl, size_t size)
+{
+    struct magazine *mag;
+    size_t cls = size / 32 - 1;
+    unsigned *n;
+
+    if( cls >= MAG_CLASSES || !(mag = get_magazine (0)) )
+	return NULL;
+    n = &mag->n[pl - pools][cls];
+    return *n? mag->blocks[pl - pools][cls][--*n] : NULL;
+}
+
+/* Put the wiped block MB of PL into the magazine.  Returns false if
+ * it does not fit.  */
+static int
+mag_put (struct pool_s *pl, MEMBLOCK *mb)
+{
+    struct magazine *mag;
+    size_t cls = mb->size / 32 - 1;
+    unsigned *n;
+
+    if( cls >= MAG_CLASSES || !(mag = get_magazine (1)) )
+	return 0;
+    n = &mag->n[pl - pools][cls];
+    if( *n == MAG_ROUNDS )
+	return 0;
+    mag->blocks[pl - pools][cls][(*n)++] = mb;
+    return 1;
+}
+
+/* Return the blocks of an exiting thread's magazine to the pools.  */
+static void
+mag_destroy (void *arg)
+{
+    struct magazine *mag = arg;
+    struct pool_s *pl;
+    MEMBLOCK *mb;
+    int i, cls;
+
+    thread_mag = NULL;
+    LOCK_POOLS ();
+    if( mag->generation == mag_generation )
+	for( i = 0; i < SECMEM_NPOOLS; i++ ) {
+	    pl = pools + i;
+	    for( cls = 0; cls < MAG_CLASSES; cls++ )
+		while( mag->n[i][cls] ) {
+		    mb = mag->blocks[i][cls][--mag->n[i][cls]];
+		    mb->u.next = pl->unused_blocks;
+		    pl->unused_blocks = mb;
+		}
+	}
+    UNLOCK_POOLS ();
+    free (mag);
+}
+#endif /*SECMEM_THREADS*/
+
+
+#ifdef ENABLE_SECMEM_DEBUG
+static unsigned long sites_serial;
+static double sites_start;
+
+static void
+sites_init (struct pool_s *pl)
+{
+    const char *s = getenv ("PINENTRY_SECMEM_DEBUG");
+
+    if( !s || !*s )
+	return;
+    pl->sites = calloc (pl->poolsize / 32, sizeof *pl->sites);
+    if( !pl->sites )
+	log_error("can't allocate the secmem debug table\n");
+    if( !sites_start )
+	sites_start = get_msec ();
+}
+
+static struct alloc_site *
+get_site (struct pool_s *pl, MEMBLOCK *mb)
+{
+    return pl->sites + ((char*)mb - (char*)pl->pool) / 32;
+}
+
+/* Print the live blocks of PL and return their number.  */
+static unsigned
+dump_live_blocks (struct pool_s *pl)
+{
+    MEMBLOCK *mb;
+    struct alloc_site *site;
+    size_t off;
+    unsigned n = 0;
+    double now = get_msec ();
+
+    for( off = 0; off < pl->poollen; off += mb->size ) {
+	mb = (MEMBLOCK*)((char*)pl->pool + off);
+	site = get_site (pl, mb);
+	if( !site->serial )
+	    continue;
+	log_info("secmem: %s #%lu at %5lu: %5u bytes for %5lu,"
+		 " age %9.1f ms, caller %p\n",
+		 pl->name, site->serial, (ulong)off, mb->size,
+		 (ulong)site->size, now - site->time, site->caller);
+	n++;
+    }
+    return n;
+}
+#endif /*ENABLE_SECMEM_DEBUG*/
 
 
 static void
@@ -148,13 +448,10 @@ lock_pool( void *p, size_t n )
     }
 
 #elif defined(HAVE_MLOCK)
-    uid_t uid;
     int err;
 
-    uid = getuid();
-
 #ifdef HAVE_BROKEN_MLOCK
-    if( uid ) {
+    if( getuid() ) {
 	errno = EPERM;
 	err = errno;
     }
@@ -169,11 +466,6 @@ lock_pool( void *p, size_t n )
 	err = errno;
 #endif
 
-    if( uid && !geteuid() ) {
-	if( setuid( uid ) || getuid() != geteuid()  )
-	    log_fatal("failed to reset uid: %s\n", strerror(errno));
-    }
-
     if( err ) {
 	if( errno != EPERM
 #ifdef EAGAIN  /* OpenBSD returns this */
@@ -190,12 +482,109 @@ lock_pool( void *p, size_t n )
 }
 
 
+/* Give up the root privileges a setuid installation needs to lock
+ * the pools.  This is done once all pools are locked.  */
 static void
-init_pool( size_t n)
+drop_lock_privs( void )
+{
+#if !defined(USE_CAPABILITIES) && defined(HAVE_MLOCK)
+    uid_t uid;
+
+    uid = getuid();
+    if( uid && !geteuid() ) {
+	if( setuid( uid ) || getuid() != geteuid()  )
+	    log_fatal("failed to reset uid: %s\n", strerror(errno));
+    }
+#endif
+}
+
+
+#if HAVE_MMAP
+/* Map N bytes of memory obtained from memfd_secret.  Its pages are
+ * locked and removed from the kernel's direct map.  They are touched
+ * here so that no page fault occurs while the passphrase is typed.
+ * Note that Linux does not hibernate while such a mapping exists.  */
+static void *
+map_memfd_secret( size_t n, size_t pgsize )
+{
+#ifdef SYS_memfd_secret
+    int fd;
+    void *p;
+    size_t off;
+
+    fd = syscall( SYS_memfd_secret, 0 );
+    if( fd == -1 )
+	return MAP_FAILED;
+    if( ftruncate( fd, n ) ) {
+	close( fd );
+	return MAP_FAILED;
+    }
+    p = mmap( 0, n, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    if( p != MAP_FAILED )
+	for( off = 0; off < n; off += pgsize )
+	    ((volatile char*)p)[off] = 0;
+    return p;
+#else
+    (void)n;
+    (void)pgsize;
+    errno = ENOSYS;
+    return MAP_FAILED;
+#endif
+}
+
+
+/* Map N bytes of anonymous memory which the kernel locks and faults
+ * in right away.  */
+static void *
+map_locked( size_t n )
+{
+#if defined(MAP_ANONYMOUS) && defined(MAP_LOCKED) && defined(MAP_POPULATE)
+    return mmap( 0, n, PROT_READ|PROT_WRITE,
+		 MAP_PRIVATE|MAP_ANONYMOUS|MAP_LOCKED|MAP_POPULATE, -1, 0 );
+#else
+    (void)n;
+    errno = ENOSYS;
+    return MAP_FAILED;
+#endif
+}
+#endif /*HAVE_MMAP*/
+
+
+/* Return the backend requested by secmem_set_backend or the envvar
+ * PINENTRY_SECMEM_BACKEND.  */
+static int
+get_backend( void )
+{
+    const char *s;
+    int i;
+
+    if( requested_backend != -1 )
+	return requested_backend;
+
+    requested_backend = BACKEND_AUTO;
+    s = getenv( "PINENTRY_SECMEM_BACKEND" );
+    if( s && *s ) {
+	for( i = BACKEND_AUTO; i < BACKEND_MALLOC; i++ )
+	    if( !strcmp( s, backend_names[i] ) )
+		break;
+	if( i < BACKEND_MALLOC )
+	    requested_backend = i;
+	else
+	    log_info("unknown secmem backend '%s' ignored\n", s);
+    }
+    return requested_backend;
+}
+
+
+static void
+init_pool( struct pool_s *pl, size_t n)
 {
     size_t pgsize;
+    int backend = get_backend ();
+    double start = get_msec ();
 
-    poolsize = n;
+    pl->poolsize = n;
 
     if( disable_secmem )
 	log_bug("secure memory is disabled");
@@ -207,52 +596,108 @@ init_pool( size_t n)
 #endif
 
 #if HAVE_MMAP
-    poolsize = (poolsize + pgsize -1 ) & ~(pgsize-1);
+    pl->poolsize = (pl->poolsize + pgsize -1 ) & ~(pgsize-1);
+    pl->pool = MAP_FAILED;
+    if( backend == BACKEND_MEMFD_SECRET ) {
+	pl->pool = map_memfd_secret( pl->poolsize, pgsize );
+	if( pl->pool == MAP_FAILED )
+	    log_info("can't use memfd_secret: %s\n", strerror(errno));
+	else
+	    pl->backend = BACKEND_MEMFD_SECRET;
+    }
+    if( pl->pool == MAP_FAILED && backend != BACKEND_LEGACY ) {
+	pl->pool = map_locked( pl->poolsize );
+	if( pl->pool == MAP_FAILED && backend == BACKEND_LOCKED )
+	    log_info("can't map a locked pool: %s\n", strerror(errno));
+	else if( pl->pool != MAP_FAILED )
+	    pl->backend = BACKEND_LOCKED;
+    }
+    if( pl->pool == MAP_FAILED ) {
+	pl->backend = BACKEND_LEGACY;
 # ifdef MAP_ANONYMOUS
-       pool = mmap( 0, poolsize, PROT_READ|PROT_WRITE,
+	pl->pool = mmap( 0, pl->poolsize, PROT_READ|PROT_WRITE,
 				 MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
 # else /* map /dev/zero instead */
-    {	int fd;
-
-	fd = open("/dev/zero", O_RDWR);
-	if( fd == -1 ) {
-	    log_error("can't open /dev/zero: %s\n", strerror(errno) );
-	    pool = (void*)-1;
-	}
-	else {
-	    pool = mmap( 0, poolsize, PROT_READ|PROT_WRITE,
-				      MAP_PRIVATE, fd, 0);
-	    close (fd);
+	{   int fd;
+
+	    fd = open("/dev/zero", O_RDWR);
+	    if( fd == -1 ) {
+		log_error("can't open /dev/zero: %s\n", strerror(errno) );
+		pl->pool = (void*)-1;
+	    }
+	    else {
+		pl->pool = mmap( 0, pl->poolsize, PROT_READ|PROT_WRITE,
+					  MAP_PRIVATE, fd, 0);
+		close (fd);
+	    }
 	}
-    }
 # endif
-    if( pool == (void*)-1 )
+    }
+    if( pl->pool == (void*)-1 )
 	log_info("can't mmap pool of %u bytes: %s - using malloc\n",
-			    (unsigned)poolsize, strerror(errno));
+			    (unsigned)pl->poolsize, strerror(errno));
     else {
-	pool_is_mmapped = 1;
-	pool_okay = 1;
+	pl->pool_is_mmapped = 1;
+	pl->pool_okay = 1;
     }
 
+#else
+    (void)backend;
 #endif
-    if( !pool_okay ) {
-	pool = malloc( poolsize );
-	if( !pool )
+    if( !pl->pool_okay ) {
+	pl->backend = BACKEND_MALLOC;
+	pl->pool = malloc( pl->poolsize );
+	if( !pl->pool )
 	    log_fatal("can't allocate memory pool of %u bytes\n",
-						       (unsigned)poolsize);
+						       (unsigned)pl->poolsize);
 	else
-	    pool_okay = 1;
+	    pl->pool_okay = 1;
+    }
+    /* This is redundant but harmless for the locked backends.  The
+     * kernel refuses to mlock memfd_secret memory, which is always
+     * locked, so only a zero length is passed for it.  */
+    lock_pool( pl->pool,
+	       pl->backend == BACKEND_MEMFD_SECRET? 0 : pl->poolsize );
+    pl->poollen = 0;
+    pl->setup_ms = get_msec () - start;
+#ifdef ENABLE_SECMEM_DEBUG
+    sites_init (pl);
+#endif
+}
+
+
+/* Return the pool holding P or NULL.  */
+static struct pool_s *
+find_pool( const void *p )
+{
+    struct pool_s *pl;
+
+    for( pl = pools; pl < pools + SECMEM_NPOOLS; pl++ )
+	if( p >= pl->pool && p < (void*)((char*)pl->pool + pl->poolsize) )
+	    return pl;
+    return NULL;
+}
+
+
+/* Wipe N bytes at P of pool PL according to the wipe policy.  */
+static void
+wipe_block( struct pool_s *pl, void *p, size_t n )
+{
+    if( wipe_policy == SECMEM_WIPE_LEGACY && !pl->fast_wipe ) {
+	fast_wipememory2( p, 0xff, n );
+	fast_wipememory2( p, 0xaa, n );
+	fast_wipememory2( p, 0x55, n );
     }
-    lock_pool( pool, poolsize );
-    poollen = 0;
+    fast_wipememory( p, n );
 }
 
 
 /* concatenate unused blocks */
 static void
-compress_pool(void)
+compress_pool( struct pool_s *pl )
 {
     /* fixme: we really should do this */
+    (void)pl;
 }
 
 void
@@ -270,6 +715,31 @@ secmem_set_flags( unsigned flags )
     }
 }
 
+/* Select how freed blocks and the pool are wiped.  Multiple passes
+ * with different patterns were meant to defeat data remanence but
+ * don't do anything a single pass doesn't on current memory.  */
+void
+secmem_set_wipe_policy (int policy)
+{
+    wipe_policy = policy;
+}
+
+/* Select the backend for the pools created later: "auto",
+ * "memfd_secret", "locked" or "legacy".  This overrides the envvar
+ * PINENTRY_SECMEM_BACKEND.  Returns -1 for an unknown NAME.  */
+int
+secmem_set_backend( const char *name )
+{
+    int i;
+
+    for( i = BACKEND_AUTO; i < BACKEND_MALLOC; i++ )
+	if( !strcmp( name, backend_names[i] ) ) {
+	    requested_backend = i;
+	    return 0;
+	}
+    return -1;
+}
+
 unsigned
 secmem_get_flags(void)
 {
@@ -280,6 +750,26 @@ secmem_get_flags(void)
     return flags;
 }
 
+/* Create the pool POOL with N bytes.  Must be called before
+ * secmem_init to use other than the default size; secmem_init drops
+ * the privileges used to lock the pool.  */
+void
+secmem_init_pool( int pool, size_t n )
+{
+    struct pool_s *pl;
+
+    if( pool < 0 || pool >= SECMEM_NPOOLS )
+	log_bug("invalid secmem pool %d\n", pool);
+    pl = pools + pool;
+
+    if( n < pl->defsize )
+	n = pl->defsize;
+    if( !pl->pool_okay )
+	init_pool(pl, n);
+    else
+	log_error("Oops, secure memory pool already initialized\n");
+}
+
 void
 secmem_init( size_t n )
 {
@@ -300,164 +790,435 @@ secmem_init( size_t n )
 #endif
     }
     else {
-	if( n < DEFAULT_POOLSIZE )
-	    n = DEFAULT_POOLSIZE;
-	if( !pool_okay )
-	    init_pool(n);
-	else
-	    log_error("Oops, secure memory pool already initialized\n");
+	if( !pools[SECMEM_POOL_SECRET].pool_okay )
+	    secmem_init_pool( SECMEM_POOL_SECRET, n );
+	/* The other pools are created now too so that all of them are
+	 * locked before the privileges are dropped.  */
+	if( !pools[SECMEM_POOL_IO].pool_okay )
+	    secmem_init_pool( SECMEM_POOL_IO, 0 );
+	drop_lock_privs();
     }
 }
 
 
-void *
-secmem_malloc( size_t size )
+static void *
+do_malloc( struct pool_s *pl, size_t size, const void *caller )
 {
     MEMBLOCK *mb, *mb2;
     int compressed=0;
+#ifdef ENABLE_SECMEM_DEBUG
+    size_t requested = size;
+#endif
 
-    if( !pool_okay ) {
+    if( !pl->pool_okay ) {
 	log_info(
 	"operation is not possible without initialized secure memory\n");
 	log_info("(you may have used the wrong program for this task)\n");
 	exit(2);
     }
-    if( show_warning && !suspend_warning ) {
-	show_warning = 0;
-	print_warn();
-    }
 
     /* blocks are always a multiple of 32 */
     size += sizeof(MEMBLOCK);
     size = ((size + 31) / 32) * 32;
 
+#ifdef SECMEM_THREADS
+    mb = mag_get (pl, size);
+    if( mb )
+	goto leave;
+#endif
+
+    LOCK_POOLS ();
+    if( show_warning && !suspend_warning ) {
+	show_warning = 0;
+	print_warn();
+    }
+
   retry:
     /* try to get it from the used blocks */
-    for(mb = unused_blocks,mb2=NULL; mb; mb2=mb, mb = mb->u.next )
+    for(mb = pl->unused_blocks,mb2=NULL; mb; mb2=mb, mb = mb->u.next )
 	if( mb->size >= size ) {
 	    if( mb2 )
 		mb2->u.next = mb->u.next;
 	    else
-		unused_blocks = mb->u.next;
-	    goto leave;
+		pl->unused_blocks = mb->u.next;
+	    goto found;
 	}
     /* allocate a new block */
-    if( (poollen + size <= poolsize) ) {
-	mb = (void*)((char*)pool + poollen);
-	poollen += size;
+    if( (pl->poollen + size <= pl->poolsize) ) {
+	mb = (void*)((char*)pl->pool + pl->poollen);
+	pl->poollen += size;
 	mb->size = size;
     }
     else if( !compressed ) {
 	compressed=1;
-	compress_pool();
+	compress_pool(pl);
 	goto retry;
     }
-    else
+    else {
+	UNLOCK_POOLS ();
+#ifdef ENABLE_SECMEM_DEBUG
+	if( pl->sites ) {
+	    log_info("secmem: %s pool exhausted by %lu bytes for caller %p\n",
+		     pl->name, (ulong)requested, caller);
+	    secmem_dump_blocks ();
+	}
+#endif
 	return NULL;
+    }
 
+  found:
+    UNLOCK_POOLS ();
+#ifdef SECMEM_THREADS
   leave:
-    cur_alloced += mb->size;
-    cur_blocks++;
-    if( cur_alloced > max_alloced )
-	max_alloced = cur_alloced;
-    if( cur_blocks > max_blocks )
-	max_blocks = cur_blocks;
+#endif
+    count_alloc (pl, mb->size, 1);
 
     memset (&mb->u.aligned.c, 0,
 	    size - (size_t) &((struct memblock_struct *) 0)->u.aligned.c);
 
+#ifdef ENABLE_SECMEM_DEBUG
+    if( pl->sites ) {
+	struct alloc_site *site = get_site (pl, mb);
+
+	site->caller = caller;
+	site->size = requested;
+	site->serial = ATOMIC_ADD (sites_serial, 1);
+	site->time = get_msec ();
+    }
+#else
+    (void)caller;
+#endif
     return &mb->u.aligned.c;
 }
 
 
+static struct pool_s *
+get_pool( int pool )
+{
+    if( pool < 0 || pool >= SECMEM_NPOOLS )
+	log_bug("invalid secmem pool %d\n", pool);
+    return pools + pool;
+}
+
+
 void *
-secmem_realloc( void *p, size_t newsize )
+secmem_malloc( size_t size )
+{
+    return do_malloc (pools + SECMEM_POOL_SECRET, size, CALLER);
+}
+
+
+void *
+secmem_malloc_in( int pool, size_t size )
+{
+    return do_malloc (get_pool (pool), size, CALLER);
+}
+
+
+/* Try to grow the block MB of pool PL to SIZE bytes including the
+ * header by taking over the free blocks following it and the unused
+ * tail of the pool.  Returns true on success.  On failure MB may
+ * still have grown but not enough.  */
+static int
+grow_block( struct pool_s *pl, MEMBLOCK *mb, size_t size )
+{
+    MEMBLOCK *next, *fb, *fb2;
+    size_t off, n;
+
+    while( mb->size < size ) {
+	off = (char*)mb - (char*)pl->pool + mb->size;
+	if( off == pl->poollen ) {
+	    /* MB is the last block carved from the pool.  */
+	    n = size - mb->size;
+	    if( pl->poollen + n > pl->poolsize )
+		return 0;
+	    pl->poollen += n;
+	}
+	else {
+	    next = (MEMBLOCK*)((char*)pl->pool + off);
+	    for( fb = pl->unused_blocks, fb2 = NULL; fb && fb != next;
+		 fb2 = fb, fb = fb->u.next )
+		;
+	    if( !fb )
+		return 0; /* The next block is in use.  */
+	    if( fb2 )
+		fb2->u.next = fb->u.next;
+	    else
+		pl->unused_blocks = fb->u.next;
+	    n = next->size;
+	}
+	mb->size += n;
+	count_alloc (pl, n, 0);
+    }
+    return 1;
+}
+
+
+/* Resize P within its pool; if P is NULL allocate from PL.  */
+static void *
+do_realloc( struct pool_s *pl, void *p, size_t newsize, const void *caller )
 {
     MEMBLOCK *mb;
-    size_t size;
+    size_t size, oldsize;
     void *a;
+    int grown;
 
     if (! p)
-      return secmem_malloc(newsize);
+      return do_malloc( pl, newsize, caller );
 
+    pl = find_pool( p );
+    if( !pl )
+	log_bug("secmem_realloc: %p is not secure memory\n", p);
     mb = (MEMBLOCK*)((char*)p - ((size_t) &((MEMBLOCK*)0)->u.aligned.c));
-    size = mb->size;
-    if( newsize < size )
+    oldsize = mb->size;
+    size = newsize + sizeof(MEMBLOCK);
+    size = ((size + 31) / 32) * 32;
+    if( size <= oldsize )
 	return p; /* it is easier not to shrink the memory */
-    a = secmem_malloc( newsize );
-    memcpy(a, p, size);
-    memset((char*)a+size, 0, newsize-size);
+
+    LOCK_POOLS ();
+    grown = grow_block( pl, mb, size );
+    UNLOCK_POOLS ();
+    if( grown ) {
+	memset ((char*)mb + oldsize, 0, mb->size - oldsize);
+#ifdef ENABLE_SECMEM_DEBUG
+	if( pl->sites )
+	    get_site (pl, mb)->size = newsize;
+#endif
+	return p;
+    }
+
+    a = do_malloc( pl, newsize, caller );
+    if( !a )
+	return NULL;
+    memcpy(a, p, oldsize - ((size_t) &((MEMBLOCK*)0)->u.aligned.c));
     secmem_free(p);
     return a;
 }
 
 
+void *
+secmem_realloc( void *p, size_t newsize )
+{
+    return do_realloc( pools + SECMEM_POOL_SECRET, p, newsize, CALLER );
+}
+
+
+void *
+secmem_realloc_in( int pool, void *p, size_t newsize )
+{
+    return do_realloc( get_pool (pool), p, newsize, CALLER );
+}
+
+
 void
 secmem_free( void *a )
 {
+    struct pool_s *pl;
     MEMBLOCK *mb;
     size_t size;
 
     if( !a )
 	return;
 
+    pl = find_pool( a );
+    if( !pl )
+	log_bug("secmem_free: %p is not secure memory\n", a);
     mb = (MEMBLOCK*)((char*)a - ((size_t) &((MEMBLOCK*)0)->u.aligned.c));
     size = mb->size;
-    /* This does not make much sense: probably this memory is held in the
-     * cache. We do it anyway: */
-    wipememory2(mb, 0xff, size );
-    wipememory2(mb, 0xaa, size );
-    wipememory2(mb, 0x55, size );
-    wipememory2(mb, 0x00, size );
-    mb->size = size;
-    mb->u.next = unused_blocks;
-    unused_blocks = mb;
-    cur_blocks--;
-    cur_alloced -= size;
+#ifdef ENABLE_SECMEM_DEBUG
+    if( pl->sites )
+	get_site (pl, mb)->serial = 0;
+#endif
+    /* The size is kept intact for concurrent walks of the pool.  */
+    wipe_block( pl, &mb->u, size - ((size_t) &((MEMBLOCK*)0)->u) );
+    ATOMIC_SUB( pl->cur_blocks, 1 );
+    ATOMIC_SUB( pl->cur_alloced, size );
+#ifdef SECMEM_THREADS
+    if( mag_put( pl, mb ) )
+	return;
+#endif
+    LOCK_POOLS ();
+    mb->u.next = pl->unused_blocks;
+    pl->unused_blocks = mb;
+    UNLOCK_POOLS ();
 }
 
 int
 m_is_secure( const void *p )
 {
-    return p >= pool && p < (void*)((char*)pool+poolsize);
+    return find_pool( p ) != NULL;
 }
 
-void
-secmem_term()
+static void
+term_pool( struct pool_s *pl )
 {
-    if( !pool_okay )
+    if( !pl->pool_okay )
 	return;
 
-    wipememory2( pool, 0xff, poolsize);
-    wipememory2( pool, 0xaa, poolsize);
-    wipememory2( pool, 0x55, poolsize);
-    wipememory2( pool, 0x00, poolsize);
+#ifdef ENABLE_SECMEM_DEBUG
+    if( pl->sites ) {
+	if( pl->cur_blocks ) {
+	    log_info("secmem: %u blocks with %u bytes not freed in the"
+		     " %s pool:\n", pl->cur_blocks, pl->cur_alloced, pl->name);
+	    dump_live_blocks (pl);
+	}
+	free (pl->sites);
+	pl->sites = NULL;
+    }
+#endif
+
+    wipe_block( pl, pl->pool, pl->poolsize );
 #if HAVE_MMAP
-    if( pool_is_mmapped )
-	munmap( pool, poolsize );
+    if( pl->pool_is_mmapped )
+	munmap( pl->pool, pl->poolsize );
 #endif
-    pool = NULL;
-    pool_okay = 0;
-    poolsize=0;
-    poollen=0;
-    unused_blocks=NULL;
+    pl->pool = NULL;
+    pl->pool_okay = 0;
+    pl->pool_is_mmapped = 0;
+    pl->backend = BACKEND_AUTO;
+    pl->setup_ms = 0;
+    pl->poolsize=0;
+    pl->poollen=0;
+    pl->unused_blocks=NULL;
+    pl->cur_alloced = pl->max_alloced = 0;
+    pl->cur_blocks = pl->max_blocks = 0;
+}
+
+void
+secmem_term()
+{
+    int i;
+
+#ifdef SECMEM_THREADS
+    mag_generation++;
+#endif
+    for( i = 0; i < SECMEM_NPOOLS; i++ )
+	term_pool( pools + i );
 }
 
 
 void
 secmem_dump_stats()
 {
+    struct pool_s *pl;
+
     if( disable_secmem )
 	return;
-    fprintf(stderr,
-		"secmem usage: %u/%u bytes in %u/%u blocks of pool %lu/%lu\n",
-		cur_alloced, max_alloced, cur_blocks, max_blocks,
-		(ulong)poollen, (ulong)poolsize );
+    for( pl = pools; pl < pools + SECMEM_NPOOLS; pl++ ) {
+	if( !pl->pool_okay )
+	    continue;
+	fprintf(stderr,
+		"secmem%s%s usage: %u/%u bytes in %u/%u blocks of pool %lu/%lu\n",
+		pl == pools? "" : " ", pl == pools? "" : pl->name,
+		pl->cur_alloced, pl->max_alloced,
+		pl->cur_blocks, pl->max_blocks,
+		(ulong)pl->poollen, (ulong)pl->poolsize );
+    }
+}
+
+
+/* Print the statistics and, if allocation tracking is enabled, the
+ * live blocks and a map of each pool with one character per 32
+ * bytes: '#' for the start of a live block, '=' for its continuation,
+ * '.' for a free block and '_' for the part never used.  */
+void
+secmem_dump_blocks (void)
+{
+#ifdef ENABLE_SECMEM_DEBUG
+    struct pool_s *pl;
+    struct secmem_stats stats;
+    MEMBLOCK *mb;
+    char map[65];
+    size_t off, unit, nunits;
+    int live = 0;
+#endif
+
+    secmem_dump_stats ();
+#ifdef ENABLE_SECMEM_DEBUG
+    for( pl = pools; pl < pools + SECMEM_NPOOLS; pl++ ) {
+	if( !pl->pool_okay || !pl->sites )
+	    continue;
+
+	secmem_get_pool_stats (pl - pools, &stats);
+
+	LOCK_POOLS ();
+	dump_live_blocks (pl);
+	log_info("secmem: %s pool has %lu bytes free,"
+		 " largest free block %lu bytes\n", pl->name,
+		 (ulong)stats.free_bytes, (ulong)stats.largest_free);
+
+	nunits = pl->poolsize / 32;
+	off = 0;
+	for( unit = 0; unit < nunits; unit++ ) {
+	    char c;
+
+	    if( unit * 32 >= pl->poollen )
+		c = '_';
+	    else {
+		if( unit * 32 == off ) {
+		    mb = (MEMBLOCK*)((char*)pl->pool + off);
+		    live = get_site (pl, mb)->serial != 0;
+		    off += mb->size;
+		    c = live? '#' : '.';
+		}
+		else
+		    c = live? '=' : '.';
+	    }
+	    map[unit % 64] = c;
+	    if( unit % 64 == 63 || unit + 1 == nunits ) {
+		map[unit % 64 + 1] = 0;
+		log_info("secmem: %6lu %s\n",
+			 (ulong)(unit - unit % 64) * 32, map);
+	    }
+	}
+	UNLOCK_POOLS ();
+    }
+#endif /*ENABLE_SECMEM_DEBUG*/
 }
 
 
 size_t
 secmem_get_max_size (void)
 {
-  return poolsize;
+  return pools[SECMEM_POOL_SECRET].poolsize;
+}
+
+
+void
+secmem_get_pool_stats (int pool, struct secmem_stats *stats)
+{
+    struct pool_s *pl = get_pool (pool);
+    MEMBLOCK *mb;
+
+    memset (stats, 0, sizeof *stats);
+    if( !pl->pool_okay )
+	return;
+
+    stats->poolsize = pl->poolsize;
+    stats->cur_alloced = ATOMIC_GET (pl->cur_alloced);
+    stats->max_alloced = ATOMIC_GET (pl->max_alloced);
+    stats->cur_blocks = ATOMIC_GET (pl->cur_blocks);
+    stats->max_blocks = ATOMIC_GET (pl->max_blocks);
+    stats->backend = backend_names[pl->backend];
+    stats->setup_ms = pl->setup_ms;
+
+    /* The untouched tail of the pool counts as one free block.  Blocks
+     * held in the magazines of threads are not counted as free.  */
+    LOCK_POOLS ();
+    stats->poollen = pl->poollen;
+    stats->free_bytes = stats->largest_free = pl->poolsize - pl->poollen;
+    for( mb = pl->unused_blocks; mb; mb = mb->u.next ) {
+	stats->free_bytes += mb->size;
+	if( mb->size > stats->largest_free )
+	    stats->largest_free = mb->size;
+    }
+    UNLOCK_POOLS ();
+}
+
+
+void
+secmem_get_stats (struct secmem_stats *stats)
+{
+    secmem_get_pool_stats (SECMEM_POOL_SECRET, stats);
 }
@@ -0,0 +1,29 @@
+#!/bin/sh
+# t-secmem-bench.sh - Replay the secmem-bench traces as a test
+# Copyright (C) 2026 g10 Code GmbH
+#
+# This file is part of PINENTRY.
+#
+# PINENTRY is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# PINENTRY is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, see <https://www.gnu.org/licenses/>.
+# SPDX-License-Identifier: GPL-2.0+
+
+
+# secmem-bench exits with an error if a trace leaves blocks in the
+# pool.
+
+set -e
+
+for trace in random assuan passphrase tqstring; do
+    ./secmem-bench --iterations 2 --trace $trace
+done
@@ -0,0 +1,25 @@
+#!/bin/sh
+# t-secmem-stress.sh - Stress the secure memory from several threads
+# Copyright (C) 2026 g10 Code GmbH
+#
+# This file is part of PINENTRY.
+#
+# PINENTRY is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# PINENTRY is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, see <https://www.gnu.org/licenses/>.
+# SPDX-License-Identifier: GPL-2.0+
+
+
+# secmem-bench exits with an error if a block was corrupted or left
+# in the pool, and with 77 to skip if built without threads.
+
+exec ./secmem-bench --threads 4 --seconds 1
@@ -22,6 +22,13 @@
 
 #include <sys/types.h>
 
+#ifdef __cplusplus
+extern "C" {
+#if 0
+}
+#endif
+#endif
+
 #ifndef HAVE_BYTE_TYPEDEF
 # undef byte
 # ifdef __riscos__
@@ -55,6 +62,10 @@ void drop_privs(void);		/* finally drop privileges */
 #define wipememory(_ptr,_len) wipememory2(_ptr,0,_len)
 #define wipe(_ptr,_len)       wipememory2(_ptr,0,_len)
 
+/* The same as wipememory2 but much faster; see wipe.c.  */
+void fast_wipememory2 (void *ptr, int set, size_t len);
+#define fast_wipememory(_ptr,_len) fast_wipememory2(_ptr,0,_len)
+
 
 
 
@@ -62,5 +73,11 @@ void drop_privs(void);		/* finally drop privileges */
                      *(p) <= 'F'? (*(p)-'A'+10):(*(p)-'a'+10))
 #define xtoi_2(p)   ((xtoi_1(p) * 16) + xtoi_1((p)+1))
 
+#if 0
+{
+#endif
+#ifdef __cplusplus
+}
+#endif
 
 #endif
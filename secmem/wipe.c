@@ -0,0 +1,53 @@
+/* wipe.c - Wipe memory without the compiler optimizing it away
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of PINENTRY.
+ *
+ * PINENTRY is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PINENTRY is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stddef.h>
+#include <string.h>
+
+#include "util.h"
+
+/* The compiler can't know what a function called through a volatile
+   pointer does and thus can't remove the call as a dead store.  */
+static void *(*volatile memset_ptr) (void *, int, size_t) = memset;
+
+
+/* Set LEN bytes at PTR to SET in a single pass.  Unlike the
+   wipememory2 macro, which stores byte by byte, this uses the C
+   library's memset with the widest stores the CPU has; for areas
+   larger than the cache that includes non-temporal stores.  */
+void
+fast_wipememory2 (void *ptr, int set, size_t len)
+{
+#ifdef HAVE_EXPLICIT_BZERO
+  if (!set)
+    explicit_bzero (ptr, len);
+  else
+#endif
+    memset_ptr (ptr, set, len);
+
+#ifdef __GNUC__
+  /* Tell the compiler that the memory is still used.  */
+  __asm__ volatile ("" : : "r" (ptr) : "memory");
+#endif
+}
@@ -223,6 +223,7 @@ main (int argc, char *argv[])
          window anymore.  */
       i = argc;
       new TQApplication (i, new_argv);
+      pinentry_timing ("toolkit");
     }
 
 
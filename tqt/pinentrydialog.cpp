@@ -103,6 +103,7 @@ void PinEntryDialog::paintEvent( TQPaintEvent* ev )
   if( !_grabbed ) {
     _edit->grabKeyboard();
     _grabbed = true;
+    pinentry_timing ("dialog");
   }
   TQDialog::paintEvent( ev );
 }
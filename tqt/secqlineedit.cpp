@@ -95,6 +95,148 @@
 
 #define innerMargin 1
 
+static inline void wipeChars( TQChar *p, uint n )
+{
+    memset( (void*)p, 0, n * sizeof(TQChar) );
+}
+
+/* The text of the line edit in secure memory with a gap at the last
+   edit position.  Typing or deleting there only moves the bounds of
+   the gap; the gap is moved when editing elsewhere.  Characters
+   leaving the text are wiped right away.  */
+class SecTQGapBuffer
+{
+public:
+    SecTQGapBuffer() : buf(0), cap(0), gapStart(0), gapEnd(0) {}
+    ~SecTQGapBuffer() { if ( buf ) ::secmem_free( buf ); }
+
+    uint length() const { return cap - ( gapEnd - gapStart ); }
+    TQChar at( uint i ) const
+	{ return i < gapStart ? buf[i] : buf[i + gapEnd - gapStart]; }
+
+    void insert( uint pos, const TQChar *s, uint len );
+    void remove( uint pos, uint len );
+    void clear() { remove( 0, length() ); }
+    SecTQString mid( uint pos, uint len = 0xffffffff ) const;
+    bool isRightToLeft() const;
+
+private:
+    void moveGap( uint pos );
+    bool reserve( uint len );
+
+    TQChar *buf;
+    uint cap;
+    uint gapStart;
+    uint gapEnd;
+};
+
+void SecTQGapBuffer::moveGap( uint pos )
+{
+    uint n;
+
+    if ( pos < gapStart ) {
+	n = gapStart - pos;
+	memmove( buf + gapEnd - n, buf + pos, n * sizeof(TQChar) );
+	wipeChars( buf + pos, TQMIN( gapStart, gapEnd - n ) - pos );
+	gapStart -= n;
+	gapEnd -= n;
+    } else if ( pos > gapStart ) {
+	n = pos - gapStart;
+	memmove( buf + gapStart, buf + gapEnd, n * sizeof(TQChar) );
+	uint from = TQMAX( gapEnd, gapStart + n );
+	wipeChars( buf + from, gapEnd + n - from );
+	gapStart += n;
+	gapEnd += n;
+    }
+}
+
+/* Make room for LEN more characters.  The buffer is doubled so that
+   typing causes only a few allocations.  */
+bool SecTQGapBuffer::reserve( uint len )
+{
+    if ( gapEnd - gapStart >= len )
+	return TRUE;
+
+    uint tail = cap - gapEnd;
+    uint newCap = TQMAX( TQMAX( 2 * cap, length() + len ), 64u );
+    TQChar *nb = (TQChar*) ::secmem_malloc( newCap * sizeof(TQChar) );
+    if ( !nb )
+	return FALSE;
+    if ( buf ) {
+	memcpy( nb, buf, gapStart * sizeof(TQChar) );
+	memcpy( nb + newCap - tail, buf + gapEnd, tail * sizeof(TQChar) );
+	::secmem_free( buf );
+    }
+    buf = nb;
+    gapEnd = newCap - tail;
+    cap = newCap;
+    return TRUE;
+}
+
+void SecTQGapBuffer::insert( uint pos, const TQChar *s, uint len )
+{
+    if ( !len || !reserve( len ) )
+	return;
+    moveGap( TQMIN( pos, length() ) );
+    memcpy( buf + gapStart, s, len * sizeof(TQChar) );
+    gapStart += len;
+}
+
+void SecTQGapBuffer::remove( uint pos, uint len )
+{
+    if ( pos >= length() )
+	return;
+    len = TQMIN( len, length() - pos );
+    moveGap( pos );
+    wipeChars( buf + gapEnd, len );
+    gapEnd += len;
+}
+
+/* Return a copy of LEN characters starting at POS.  The copy lives
+   in secure memory and is wiped when the caller drops it.  */
+SecTQString SecTQGapBuffer::mid( uint pos, uint len ) const
+{
+    SecTQString s;
+
+    if ( pos >= length() )
+	return s;
+    len = TQMIN( len, length() - pos );
+    if ( !len )
+	return s;
+
+    uint head = pos < gapStart ? TQMIN( len, gapStart - pos ) : 0;
+    s.setLength( len );
+    if ( head )
+	s.replace( 0, head, buf + pos, head );
+    if ( len > head )
+	s.replace( head, len - head,
+		   buf + gapEnd + pos + head - gapStart, len - head );
+    return s;
+}
+
+/* Like SecTQString::isRightToLeft.  */
+bool SecTQGapBuffer::isRightToLeft() const
+{
+    for ( uint i = 0; i < length(); i++ ) {
+	switch( at( i ).direction() )
+	{
+	case TQChar::DirL:
+	case TQChar::DirLRO:
+	case TQChar::DirLRE:
+	    return FALSE;
+	case TQChar::DirR:
+	case TQChar::DirAL:
+	case TQChar::DirRLO:
+	case TQChar::DirRLE:
+	    return TRUE;
+	default:
+	    break;
+	}
+    }
+    return FALSE;
+}
+
+
 struct SecTQLineEditPrivate : public TQt
 {
     SecTQLineEditPrivate( SecTQLineEdit *q )
@@ -110,7 +252,7 @@ struct SecTQLineEditPrivate : public TQt
     void init( const SecTQString&);
 
     SecTQLineEdit *q;
-    SecTQString text;
+    SecTQGapBuffer buffer;
     int cursor;
     int cursorTimer;
     TQPoint tripleClick;
@@ -165,17 +307,17 @@ struct SecTQLineEditPrivate : public TQt
 	    Command& cmd = history[--undoState];
 	    switch ( cmd.type ) {
 	    case Insert:
-		text.remove( cmd.pos, 1);
+		buffer.remove( cmd.pos, 1 );
 		cursor = cmd.pos;
 		break;
 	    case Remove:
 	    case RemoveSelection:
-		text.insert( cmd.pos, cmd.c );
+		buffer.insert( cmd.pos, &cmd.c, 1 );
 		cursor = cmd.pos + 1;
 		break;
 	    case Delete:
 	    case DeleteSelection:
-		text.insert( cmd.pos, cmd.c );
+		buffer.insert( cmd.pos, &cmd.c, 1 );
 		cursor = cmd.pos;
 		break;
 	    case Separator:
@@ -199,14 +341,14 @@ struct SecTQLineEditPrivate : public TQt
 	    Command& cmd = history[undoState++];
 	    switch ( cmd.type ) {
 	    case Insert:
-		text.insert( cmd.pos, cmd.c );
+		buffer.insert( cmd.pos, &cmd.c, 1 );
 		cursor = cmd.pos + 1;
 		break;
 	    case Remove:
 	    case Delete:
 	    case RemoveSelection:
 	    case DeleteSelection:
-		text.remove( cmd.pos, 1 );
+		buffer.remove( cmd.pos, 1 );
 		cursor = cmd.pos;
 		break;
 	    case Separator:
@@ -227,12 +369,12 @@ struct SecTQLineEditPrivate : public TQt
 
 
     // bidi
-    inline bool isRightToLeft() const { return direction==TQChar::DirON?text.isRightToLeft():(direction==TQChar::DirR); }
+    inline bool isRightToLeft() const { return direction==TQChar::DirON?buffer.isRightToLeft():(direction==TQChar::DirR); }
 
     // selection
     int selstart, selend;
-    inline bool allSelected() const { return !text.isEmpty() && selstart == 0 && selend == (int)text.length(); }
-    inline bool hasSelectedText() const { return !text.isEmpty() && selend > selstart; }
+    inline bool allSelected() const { return buffer.length() && selstart == 0 && selend == (int)buffer.length(); }
+    inline bool hasSelectedText() const { return buffer.length() && selend > selstart; }
     inline void deselect() { selDirty |= (selend > selstart); selstart = selend = 0; }
     void removeSelectedText();
 #ifndef QT_NO_CLIPBOARD
@@ -419,7 +561,8 @@ SecTQLineEdit::~SecTQLineEdit()
 */
 SecTQString SecTQLineEdit::text() const
 {
-    return ( d->text.isNull() ? SecTQString ("") : d->text );
+    SecTQString s = d->buffer.mid( 0 );
+    return ( s.isNull() ? SecTQString ("") : s );
 }
 
 void SecTQLineEdit::setText( const SecTQString& text)
@@ -450,7 +593,7 @@ TQString SecTQLineEdit::displayText() const
 
     TQChar pwd_char = TQChar (style().styleHint( TQStyle::SH_LineEdit_PasswordCharacter, this));
     TQString res;
-    res.fill (pwd_char, d->text.length ());
+    res.fill (pwd_char, d->buffer.length ());
     return res;
 }
 
@@ -474,7 +617,7 @@ int SecTQLineEdit::maxLength() const
 void SecTQLineEdit::setMaxLength( int maxLength )
 {
     d->maxLength = maxLength;
-    setText( d->text );
+    setText( text() );
 }
 
 
@@ -596,7 +739,7 @@ int SecTQLineEdit::cursorPosition() const
 
 void SecTQLineEdit::setCursorPosition( int pos )
 {
-    if ( pos <= (int) d->text.length() )
+    if ( pos <= (int) d->buffer.length() )
 	d->moveCursor( pos );
 }
 
@@ -767,7 +910,7 @@ void SecTQLineEdit::home( bool mark )
 
 void SecTQLineEdit::end( bool mark )
 {
-    d->moveCursor( d->text.length(), mark );
+    d->moveCursor( d->buffer.length(), mark );
 }
 
 
@@ -856,7 +999,7 @@ bool SecTQLineEdit::hasSelectedText() const
 SecTQString SecTQLineEdit::selectedText() const
 {
     if ( d->hasSelectedText() )
-	return d->text.mid( d->selstart, d->selend - d->selstart );
+	return d->buffer.mid( d->selstart, d->selend - d->selstart );
     return SecTQString::null;
 }
 
@@ -881,11 +1024,11 @@ int SecTQLineEdit::selectionStart() const
 
 void SecTQLineEdit::setSelection( int start, int length )
 {
-    if ( start < 0 || start > (int)d->text.length() || length < 0 ) {
+    if ( start < 0 || start > (int)d->buffer.length() || length < 0 ) {
 	d->selstart = d->selend = 0;
     } else {
 	d->selstart = start;
-	d->selend = TQMIN( start + length, (int)d->text.length() );
+	d->selend = TQMIN( start + length, (int)d->buffer.length() );
 	d->cursor = d->selend;
     }
     update();
@@ -924,7 +1067,7 @@ bool SecTQLineEdit::isRedoAvailable() const
 void SecTQLineEdit::selectAll()
 {
     d->selstart = d->selend = d->cursor = 0;
-    d->moveCursor( d->text.length(), TRUE );
+    d->moveCursor( d->buffer.length(), TRUE );
 }
 
 /*!
@@ -961,7 +1104,7 @@ void SecTQLineEdit::clear()
     int priorState = d->undoState;
     resetInputContext();
     d->selstart = 0;
-    d->selend = d->text.length();
+    d->selend = d->buffer.length();
     d->removeSelectedText();
     d->separate();
     d->finishChange( priorState );
@@ -1213,7 +1356,7 @@ void SecTQLineEdit::mouseDoubleClickEvent( TQMouseEvent* e )
 	d->cursor = d->textLayout.previousCursorPosition( d->cursor, TQTextLayout::SkipWords );
 	// ## text layout should support end of words.
 	int end = d->textLayout.nextCursorPosition( d->cursor, TQTextLayout::SkipWords );
-	while ( end > d->cursor && d->text[end-1].isSpace() )
+	while ( end > d->cursor && d->buffer.at(end-1).isSpace() )
 	    --end;
 	d->moveCursor( end, TRUE );
 	d->tripleClickTimer = startTimer( TQApplication::doubleClickInterval() );
@@ -1309,7 +1452,7 @@ void SecTQLineEdit::keyPressEvent( TQKeyEvent * e )
 	    if ( !d->readOnly ) {
 		int priorState = d->undoState;
 		d->deselect();
-		while ( d->cursor < (int) d->text.length() )
+		while ( d->cursor < (int) d->buffer.length() )
 		    d->del();
 		d->finishChange( priorState );
 	    }
@@ -1477,7 +1620,8 @@ void SecTQLineEdit::imComposeEvent( TQIMEvent *e )
     if ( d->readOnly ) {
 	e->ignore();
     } else {
-	d->text.replace( d->imstart, d->imend - d->imstart, e->text() );
+	d->buffer.remove( d->imstart, d->imend - d->imstart );
+	d->buffer.insert( d->imstart, e->text().unicode(), e->text().length() );
 	d->imend = d->imstart + e->text().length();
 	d->imselstart = d->imstart + e->cursorPos();
 	d->imselend = d->imselstart + e->selectionLength();
@@ -1494,7 +1638,7 @@ void SecTQLineEdit::imEndEvent( TQIMEvent *e )
     if ( d->readOnly ) {
 	e->ignore();
     } else {
-	d->text.remove( d->imstart, d->imend - d->imstart );
+	d->buffer.remove( d->imstart, d->imend - d->imstart );
 	d->cursor = d->imselstart = d->imselend = d->imend = d->imstart;
 	d->textDirty = TRUE;
 	insert( e->text() );
@@ -1560,7 +1704,7 @@ void SecTQLineEdit::drawContents( TQPainter *p )
     int cix = 0;
     TQTextItem ci = d->textLayout.findItem( d->cursor );
     if ( ci.isValid() ) {
-	if ( d->cursor != (int)d->text.length() && d->cursor == ci.from() + ci.length()
+	if ( d->cursor != (int)d->buffer.length() && d->cursor == ci.from() + ci.length()
 	     && ci.isRightToLeft() != d->isRightToLeft() )
 	    ci = d->textLayout.findItem( d->cursor + 1 );
 	cix = ci.x() + ci.cursorToX( d->cursor - ci.from() );
@@ -1731,9 +1875,9 @@ void SecTQLineEditPrivate::init( const SecTQString& txt )
     q->setMouseTracking( TRUE );
     q->setAcceptDrops( TRUE );
     q->setFrame( TRUE );
-    text = txt;
+    buffer.insert( 0, txt.unicode(), txt.length() );
     updateTextLayout();
-    cursor = text.length();
+    cursor = buffer.length();
 }
 
 void SecTQLineEditPrivate::updateTextLayout()
@@ -1767,7 +1911,7 @@ int SecTQLineEditPrivate::xToPos( int x, TQTextItem::CursorPosition betweenOrOn
 	if ( x >= tir.left() && x <= tir.right() )
 	    return ti.xToCursor( x - tir.x(), betweenOrOn ) + ti.from();
     }
-    return x < 0 ? 0 : text.length();
+    return x < 0 ? 0 : buffer.length();
 }
 
 
@@ -1777,7 +1921,7 @@ TQRect SecTQLineEditPrivate::cursorRect() const
     int cix = cr.x() - hscroll + innerMargin;
     TQTextItem ci = textLayout.findItem( cursor );
     if ( ci.isValid() ) {
-	if ( cursor != (int)text.length() && cursor == ci.from() + ci.length()
+	if ( cursor != (int)buffer.length() && cursor == ci.from() + ci.length()
 	     && ci.isRightToLeft() != isRightToLeft() )
 	    ci = textLayout.findItem( cursor + 1 );
 	cix += ci.x() + ci.cursorToX( cursor - ci.from() );
@@ -1844,6 +1988,12 @@ void SecTQLineEditPrivate::finishChange( int validateFromState, bool setModified
 	lineDirty |= textDirty;
 	if ( setModified )
 	    modified = TRUE;
+	/* The text is only copied out of the buffer for connected
+	   receivers.  */
+	SecTQString text;
+	if ( q->receivers( SIGNAL(textChanged(const SecTQString&)) )
+	     || q->receivers( SIGNAL(textModified(const SecTQString&)) ) )
+	    text = q->text();
 	if ( textDirty ) {
 	    textDirty = FALSE;
 	    emit q->textChanged( text );
@@ -1864,11 +2014,11 @@ void SecTQLineEditPrivate::finishChange( int validateFromState, bool setModified
 void SecTQLineEditPrivate::setText( const SecTQString& txt )
 {
     deselect();
-    SecTQString oldText = text;
-    text = txt.isEmpty() ? SecTQString ("") : txt.left( maxLength );
+    buffer.clear();
+    buffer.insert( 0, txt.unicode(), TQMIN( txt.length(), (uint)maxLength ) );
     history.clear();
     undoState = 0;
-    cursor = text.length();
+    cursor = buffer.length();
     textDirty = 1; // Err on safe side.
 }
 
@@ -1903,9 +2053,9 @@ void SecTQLineEditPrivate::addCommand( const Command& cmd )
 
 void SecTQLineEditPrivate::insert( const SecTQString& s )
 {
-  int remaining = maxLength - text.length();
-  text.insert( cursor, s.left(remaining) );
-  for ( int i = 0; i < (int) s.left(remaining).length(); ++i )
+  uint n = TQMIN( s.length(), (uint)TQMAX( maxLength - (int)buffer.length(), 0 ) );
+  buffer.insert( cursor, s.unicode(), n );
+  for ( uint i = 0; i < n; ++i )
     {
 #ifndef SECURE_NO_UNDO
       addCommand( Command( Insert, cursor, s.at(i) ) );
@@ -1917,18 +2067,18 @@ void SecTQLineEditPrivate::insert( const SecTQString& s )
 
 void SecTQLineEditPrivate::del( bool wasBackspace )
 {
-    if ( cursor < (int) text.length() ) {
+    if ( cursor < (int) buffer.length() ) {
 #ifndef SECURE_NO_UNDO
-	addCommand ( Command( (CommandType)(wasBackspace?Remove:Delete), cursor, text.at(cursor) ) );
+	addCommand ( Command( (CommandType)(wasBackspace?Remove:Delete), cursor, buffer.at(cursor) ) );
 #endif /* SECURE_NO_UNDO */
-	text.remove( cursor, 1 );
+	buffer.remove( cursor, 1 );
 	textDirty = TRUE;
     }
 }
 
 void SecTQLineEditPrivate::removeSelectedText()
 {
-    if ( selstart < selend && selend <= (int) text.length() ) {
+    if ( selstart < selend && selend <= (int) buffer.length() ) {
 	separate();
 #ifndef SECURE_NO_UNDO
 	int i ;
@@ -1936,15 +2086,15 @@ void SecTQLineEditPrivate::removeSelectedText()
 	    // cursor is within the selection. Split up the commands
 	    // to be able to restore the correct cursor position
 	    for ( i = cursor; i >= selstart; --i )
-		addCommand ( Command( DeleteSelection, i, text.at(i) ) );
+		addCommand ( Command( DeleteSelection, i, buffer.at(i) ) );
 	    for ( i = selend - 1; i > cursor; --i )
-		addCommand ( Command( DeleteSelection, i - cursor + selstart - 1, text.at(i) ) );
+		addCommand ( Command( DeleteSelection, i - cursor + selstart - 1, buffer.at(i) ) );
 	} else {
 	    for ( i = selend-1; i >= selstart; --i )
-		addCommand ( Command( RemoveSelection, i, text.at(i) ) );
+		addCommand ( Command( RemoveSelection, i, buffer.at(i) ) );
 	}
 #endif /* SECURE_NO_UNDO */
-	text.remove( selstart, selend - selstart );
+	buffer.remove( selstart, selend - selstart );
 	if ( cursor > selstart )
 	    cursor -= TQMIN( cursor, selend ) - selstart;
 	deselect();
@@ -201,6 +201,7 @@ confirm (pinentry_t pinentry, FILE *ttyfi, FILE *ttyfo)
   free (msgbuffer);
 
   fflush (ttyfo);
+  pinentry_timing ("dialog");
 
   if (pinentry->ok)
     ok = button (pinentry->ok, "OK", ttyfo);
@@ -410,6 +411,7 @@ password (pinentry_t pinentry, FILE *ttyfi, FILE *ttyfo)
 	       (prompt[strlen(prompt) - 1] == ':'
 		|| prompt[strlen(prompt) - 1] == '?') ? "" : ":");
       fflush (ttyfo);
+      pinentry_timing ("dialog");
 
       passphrase = read_password (ttyfi, ttyfo);
       fputc ('\n', ttyfo);
@@ -489,6 +489,7 @@ dlg_proc (HWND dlg, UINT msg, WPARAM wparam, LPARAM lparam)
 /*       show_window_hierarchy (GetDesktopWindow (), 0); */
 
       ShowWindow (dlg, SW_SHOW);
+      pinentry_timing ("dialog");
       move_mouse_and_click ( GetDlgItem (dlg, IDC_PINENT_PROMPT) );
       raise_sip (dlg);
       break;